@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+namespace elf {
+  template <typename T>
+  constexpr T
+  byte_swap(T v) {
+    static_assert(std::is_integral<T>::value, "byte_swap of a non-integral type");
+    if constexpr(sizeof(T) == 1)
+      return v;
+    else if constexpr(sizeof(T) == 2)
+      return T(__builtin_bswap16(uint16_t(v)));
+    else if constexpr(sizeof(T) == 4)
+      return T(__builtin_bswap32(uint32_t(v)));
+    else
+      return T(__builtin_bswap64(uint64_t(v)));
+  }
+
+  // an integer held in network byte order. as a field of a packed wire
+  // struct laid over a buffer, reads and writes convert in place, so
+  // messages are decoded and built without an intermediate copy. copying
+  // one BigEndian to another moves the wire bytes unconverted.
+  template <typename T>
+  struct __attribute__((__packed__)) BigEndian {
+    BigEndian() = default;
+    constexpr BigEndian(T v) : _raw(to_wire(v)) {}
+
+    constexpr operator T() const { return to_wire(_raw); }
+    BigEndian& operator=(T v) { _raw = to_wire(v); return *this; }
+
+    static constexpr T
+    to_wire(T v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      return byte_swap(v);
+#else
+      return v;
+#endif
+    }
+
+    T _raw;
+  };
+
+  typedef BigEndian<uint16_t> be16_t;
+  typedef BigEndian<uint32_t> be32_t;
+  typedef BigEndian<uint64_t> be64_t;
+
+  static_assert(sizeof(be64_t) == 8 && alignof(be64_t) == 1, "BigEndian must be packed");
+  static_assert(std::is_trivially_copyable<be32_t>::value, "BigEndian must be trivially copyable");
+}
@@ -0,0 +1,70 @@
+#include "buffer_pool.h"
+
+#include <unistd.h>
+
+#include <cstring>
+
+using namespace elf;
+using namespace std;
+
+BufferPool::BufferPool(size_t max_size)
+  : _page(sysconf(_SC_PAGESIZE)) {
+  size_t classes = 1;
+  while((_page << (classes - 1)) < max_size)
+    classes++;
+  _max_size = _page << (classes - 1);
+  _free.resize(classes);
+}
+
+size_t
+BufferPool::class_of(size_t size) const {
+  size_t c = 0;
+  while((_page << c) < size)
+    c++;
+  return c;
+}
+
+bool
+BufferPool::reserve(RingBuffer& buf, size_t len) {
+  if(buf.write_avail() >= len)
+    return true;
+
+  size_t unread = buf.read_avail();
+  if(unread + len > _max_size)
+    return false;
+
+  size_t c = class_of(unread + len);
+  RingBuffer fresh;
+  if(_free[c].empty()) {
+    fresh.init(_page << c);
+    _mapped_bytes += fresh.capacity();
+  } else {
+    fresh.swap(_free[c].back());
+    _free[c].pop_back();
+  }
+  _outstanding++;
+
+  memcpy(fresh.write_head(), buf.read_head(), unread);
+  fresh.mark_written(unread);
+  release(buf);
+  buf.swap(fresh);
+  return true;
+}
+
+void
+BufferPool::release(RingBuffer& buf) {
+  if(!buf.capacity())
+    return;
+
+  buf.clear();
+  _free[class_of(buf.capacity())].emplace_back(std::move(buf));
+  _outstanding--;
+}
+
+size_t
+BufferPool::free_buffers() const {
+  size_t n = 0;
+  for(auto& f : _free)
+    n += f.size();
+  return n;
+}
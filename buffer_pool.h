@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "ring_buffer.h"
+
+namespace elf {
+  // RingBuffers recycled by one thread, in power of two size classes from a
+  // page up to max_size. buffers change hands by swapping into and out of
+  // the holder's RingBuffer, so a holder that releases keeps nothing mapped
+  // and holders that are mostly idle share a handful of buffers. released
+  // buffers are kept for reuse until the pool is destroyed.
+  class BufferPool {
+  public:
+    explicit BufferPool(size_t max_size);
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // make room for len more bytes in buf: take a buffer if it has none, or
+    // move its unread bytes into a larger one. false when that would need
+    // more than max_size.
+    bool reserve(RingBuffer& buf, size_t len);
+
+    // give buf's memory back to the pool, dropping anything unread
+    void release(RingBuffer& buf);
+
+    size_t max_size() const     { return _max_size; }
+    size_t outstanding() const  { return _outstanding; }
+    size_t mapped_bytes() const { return _mapped_bytes; }
+    size_t free_buffers() const;
+
+  private:
+    size_t class_of(size_t size) const;
+
+    size_t _page;
+    size_t _max_size;
+    std::vector<std::vector<RingBuffer>> _free;
+    size_t _outstanding = 0;
+    size_t _mapped_bytes = 0;
+  };
+}
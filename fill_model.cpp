@@ -0,0 +1,89 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "ouch_structs.h"
+#include "fill_model.h"
+
+using namespace OUCHSim;
+using namespace elf;
+using namespace std;
+
+void
+FillModelTable::load(const string& path) {
+  ifstream in(path);
+  if(!in)
+    throw runtime_error(path + ": cannot open fill model");
+  parse(in, path);
+}
+
+void
+FillModelTable::parse(istream& in, const string& source) {
+  string line;
+  size_t lineno = 0;
+  while(getline(in, line)) {
+    lineno++;
+    size_t hash = line.find('#');
+    if(hash != string::npos)
+      line.resize(hash);
+
+    istringstream words(line);
+    string symbol;
+    if(!(words >> symbol))
+      continue;
+
+    auto fail = [&](const string& what) {
+      return runtime_error(source + ":" + to_string(lineno) + ": " + what);
+    };
+    if(symbol.size() > 8)
+      throw fail("symbol " + symbol + " is longer than 8 characters");
+
+    FillModel model;
+    string setting;
+    while(words >> setting) {
+      size_t eq = setting.find('=');
+      if(eq == string::npos)
+        throw fail("expected key=value, got " + setting);
+      string key = setting.substr(0, eq);
+      string value = setting.substr(eq + 1);
+
+      try {
+        size_t used = 0;
+        if(key == "fill_prob")
+          model.fill_prob = stod(value, &used);
+        else if(key == "partial_prob")
+          model.partial_prob = stod(value, &used);
+        else if(key == "max_fills")
+          model.max_fills = stoul(value, &used);
+        else if(key == "lot")
+          model.lot = stoul(value, &used);
+        else if(key == "min_delay_us")
+          model.min_delay_us = stoul(value, &used);
+        else if(key == "max_delay_us")
+          model.max_delay_us = stoul(value, &used);
+        else
+          throw fail("unknown setting " + key);
+        if(used != value.size())
+          throw invalid_argument(value);
+      } catch(const logic_error&) {
+        throw fail("bad value for " + key + ": " + value);
+      }
+    }
+
+    if(model.fill_prob < 0 || model.fill_prob > 1 || model.partial_prob < 0 || model.partial_prob > 1)
+      throw fail("probabilities must be between 0 and 1");
+    if(!model.max_fills || !model.lot)
+      throw fail("max_fills and lot must be at least 1");
+    model.max_delay_us = max(model.max_delay_us, model.min_delay_us);
+
+    if(symbol == "*") {
+      _default = model;
+      continue;
+    }
+    char field[8];
+    OUCH::set_alpha_field(symbol, field, sizeof(field));
+    uint64_t key;
+    memcpy(&key, field, sizeof(key));
+    _models[key] = model;
+  }
+}
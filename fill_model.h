@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "ouch_order.h"
+
+namespace OUCHSim {
+  // how orders in one symbol are filled when there is nobody in the book to
+  // trade with. an order the model picks is filled in up to max_fills
+  // executions at its own price; each but the last may take only part of
+  // what is left. resting orders are filled after a delay drawn per fill,
+  // immediate-or-cancel orders at once, with the rest canceled.
+  struct FillModel {
+    double fill_prob = 0;
+    double partial_prob = 0;
+    uint32_t max_fills = 1;
+    // partial fills are whole lots
+    uint32_t lot = 1;
+    uint32_t min_delay_us = 0;
+    uint32_t max_delay_us = 0;
+
+    template <typename Rng>
+    bool
+    fills(Rng& rng) const {
+      return std::uniform_real_distribution<double>()(rng) < fill_prob;
+    }
+
+    // shares for the next fill of an order with leaves open and fills_left
+    // fills to go. the first fill of an order honours its minimum quantity.
+    template <typename Rng>
+    uint32_t
+    fill_qty(Rng& rng, uint32_t leaves, uint32_t minqty, uint32_t fills_left) const {
+      uint32_t qty = leaves;
+      if(fills_left > 1 && leaves > lot && std::uniform_real_distribution<double>()(rng) < partial_prob)
+        qty = lot * std::uniform_int_distribution<uint32_t>(1, (leaves - 1) / lot)(rng);
+      return std::max(qty, std::min(minqty, leaves));
+    }
+
+    template <typename Rng>
+    uint64_t
+    delay_ns(Rng& rng) const {
+      return uint64_t(std::uniform_int_distribution<uint32_t>(min_delay_us, max_delay_us)(rng)) * 1000;
+    }
+  };
+
+  // fill models by symbol. the file has a line per symbol: the symbol, then
+  // settings as key=value, e.g.
+  //
+  //   # symbol fill_prob partial_prob max_fills lot min_delay_us max_delay_us
+  //   *    fill_prob=0.1
+  //   AAPL fill_prob=0.9 partial_prob=0.5 max_fills=4 lot=100 max_delay_us=20000
+  //
+  // a symbol of * sets the model for symbols not listed. settings left out
+  // take the defaults in FillModel, under which nothing is filled.
+  class FillModelTable {
+  public:
+    // throws runtime_error naming the line of a bad setting
+    void load(const std::string& path);
+    void parse(std::istream& in, const std::string& source);
+
+    // the model for symbol, nullptr if it fills nothing
+    const FillModel*
+    find(const char* symbol) const {
+      uint64_t key;
+      memcpy(&key, symbol, sizeof(key));
+      auto it = _models.find(key);
+      const FillModel& model = it == _models.end() ? _default : it->second;
+      return model.fill_prob > 0 ? &model : nullptr;
+    }
+
+    bool empty() const { return _models.empty() && _default.fill_prob <= 0; }
+    size_t size() const { return _models.size(); }
+
+  private:
+    std::unordered_map<uint64_t, FillModel> _models;
+    FillModel _default;
+  };
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace elf {
+  // storage for the one asynchronous operation of a kind that an object has
+  // outstanding at a time, such as a connection's read. asio allocates its
+  // operation state through the handler's associated allocator, so wrapping
+  // the handler with bind_memory() reuses this block instead of the heap.
+  // a second operation in flight, or one that doesn't fit, falls back to
+  // operator new.
+  class HandlerMemory {
+  public:
+    HandlerMemory() = default;
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void*
+    allocate(size_t size) {
+      if(!_in_use && size <= sizeof(_storage)) {
+        _in_use = true;
+        return &_storage;
+      }
+      return ::operator new(size);
+    }
+
+    void
+    deallocate(void* p) {
+      if(p == &_storage)
+        _in_use = false;
+      else
+        ::operator delete(p);
+    }
+
+    bool in_use() const { return _in_use; }
+
+  private:
+    alignas(std::max_align_t) unsigned char _storage[256];
+    bool _in_use = false;
+  };
+
+  template <typename T>
+  class HandlerAllocator {
+  public:
+    typedef T value_type;
+
+    explicit HandlerAllocator(HandlerMemory& memory) : _memory(memory) {}
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept : _memory(other._memory) {}
+
+    T* allocate(size_t n)          { return static_cast<T*>(_memory.allocate(sizeof(T) * n)); }
+    void deallocate(T* p, size_t)  { _memory.deallocate(p); }
+
+    template <typename U>
+    bool operator==(const HandlerAllocator<U>& other) const noexcept { return &_memory == &other._memory; }
+    template <typename U>
+    bool operator!=(const HandlerAllocator<U>& other) const noexcept { return &_memory != &other._memory; }
+
+  private:
+    template <typename> friend class HandlerAllocator;
+    HandlerMemory& _memory;
+  };
+
+  template <typename Handler>
+  class MemoryBoundHandler {
+  public:
+    typedef HandlerAllocator<Handler> allocator_type;
+
+    MemoryBoundHandler(HandlerMemory& memory, Handler handler)
+      : _memory(memory), _handler(std::move(handler)) {}
+
+    allocator_type get_allocator() const noexcept { return allocator_type(_memory); }
+
+    template <typename... Args>
+    void operator()(Args&&... args) { _handler(std::forward<Args>(args)...); }
+
+  private:
+    HandlerMemory& _memory;
+    Handler _handler;
+  };
+
+  template <typename Handler>
+  inline MemoryBoundHandler<Handler>
+  bind_memory(HandlerMemory& memory, Handler handler) {
+    return MemoryBoundHandler<Handler>(memory, std::move(handler));
+  }
+}
@@ -0,0 +1,202 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "itch_reader.h"
+
+using namespace elf;
+using namespace std;
+
+// messages never straddle blocks, so a block must hold the largest one
+static constexpr size_t max_message_len = 2 + UINT16_MAX;
+
+static runtime_error
+reader_error(const string& path, const char* what) {
+  return runtime_error(path + ": " + what + ": " + strerror(errno));
+}
+
+ItchReader::ItchReader(const string& path, size_t block_size, size_t depth)
+  : _path(path), _block_size(max(block_size, 2 * max_message_len)), _depth(max<size_t>(depth, 1)) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw reader_error(path, "open");
+
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    ::close(fd);
+    throw reader_error(path, "fstat");
+  }
+  _len = st.st_size;
+
+  if(_len) {
+    void* p = mmap(nullptr, _len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED) {
+      ::close(fd);
+      throw reader_error(path, "mmap");
+    }
+    _base = static_cast<const char*>(p);
+    madvise(p, _len, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+
+  _compressed = _len >= 2 && uint8_t(_base[0]) == 0x1f && uint8_t(_base[1]) == 0x8b;
+  if(_compressed)
+    _thread = thread(&ItchReader::run, this);
+}
+
+ItchReader::~ItchReader() {
+  stop();
+  if(_base)
+    munmap(const_cast<char*>(_base), _len);
+}
+
+void
+ItchReader::stop() {
+  {
+    lock_guard<mutex> guard(_lock);
+    _stop = true;
+  }
+  _cv.notify_all();
+  if(_thread.joinable())
+    _thread.join();
+}
+
+bool
+ItchReader::next(const char*& begin, const char*& end) {
+  if(!_compressed) {
+    if(_done)
+      return false;
+    _done = true;
+    begin = _base;
+    end = _base + _len;
+    return true;
+  }
+
+  unique_lock<mutex> guard(_lock);
+  if(_current) {
+    _free.push_back(_current);
+    _current = nullptr;
+    _cv.notify_all();
+  }
+  _cv.wait(guard, [&] { return !_error.empty() || !_ready.empty() || _eof; });
+  if(!_error.empty())
+    throw runtime_error(_error);
+  if(_ready.empty()) {
+    _truncated = _leftover;
+    return false;
+  }
+
+  _current = _ready.front();
+  _ready.pop_front();
+  _cv.notify_all();
+  begin = _current->data.data();
+  end = begin + _current->used;
+  return true;
+}
+
+// inflates the mapping a block at a time. what follows the last whole
+// message of a block is carried to the front of the next.
+void
+ItchReader::run() {
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if(inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) {
+    lock_guard<mutex> guard(_lock);
+    _error = _path + ": inflateInit2 failed";
+    _cv.notify_all();
+    return;
+  }
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(_base));
+  z.avail_in = 0;
+  size_t in_left = _len;
+
+  vector<char> carry;
+  bool ended = false;
+  string error;
+  unique_lock<mutex> guard(_lock);
+
+  while(!ended) {
+    _cv.wait(guard, [&] { return _stop || _ready.size() < _depth; });
+    if(_stop)
+      break;
+
+    Block* block;
+    if(_free.empty()) {
+      _blocks.emplace_back(new Block());
+      block = _blocks.back().get();
+      block->data.resize(_block_size);
+    } else {
+      block = _free.back();
+      _free.pop_back();
+    }
+    guard.unlock();
+
+    memcpy(block->data.data(), carry.data(), carry.size());
+    size_t used = carry.size();
+    while(used < block->data.size() && !ended) {
+      // avail_in is 32 bits, so a large mapping is fed in pieces
+      if(!z.avail_in) {
+        if(!in_left) {
+          ended = true;
+          break;
+        }
+        z.avail_in = uInt(min<size_t>(in_left, 1u << 30));
+        in_left -= z.avail_in;
+      }
+
+      z.next_out = reinterpret_cast<Bytef*>(block->data.data() + used);
+      z.avail_out = uInt(block->data.size() - used);
+      int rc = inflate(&z, Z_NO_FLUSH);
+      used = block->data.size() - z.avail_out;
+
+      if(rc == Z_STREAM_END) {
+        // another member may follow; anything else after the end is ignored
+        if((z.avail_in || in_left) && z.next_in[0] == 0x1f)
+          inflateReset(&z);
+        else
+          ended = true;
+      } else if(rc == Z_BUF_ERROR && !z.avail_in && !in_left) {
+        ended = true;
+      } else if(rc != Z_OK && rc != Z_BUF_ERROR) {
+        error = _path + ": inflate: " + (z.msg ? z.msg : to_string(rc));
+        ended = true;
+      }
+    }
+
+    const char* p = block->data.data();
+    const char* end = p + used;
+    while(end - p >= 2) {
+      size_t len = uint8_t(p[0]) << 8 | uint8_t(p[1]);
+      if(size_t(end - p) < 2 + len)
+        break;
+      p += 2 + len;
+    }
+    block->used = p - block->data.data();
+    carry.assign(p, end);
+
+    guard.lock();
+    if(!error.empty()) {
+      _error = error;
+      _free.push_back(block);
+      break;
+    }
+    if(block->used)
+      _ready.push_back(block);
+    else
+      _free.push_back(block);
+    _cv.notify_all();
+  }
+
+  _eof = true;
+  _leftover = carry.size();
+  _cv.notify_all();
+  guard.unlock();
+  inflateEnd(&z);
+}
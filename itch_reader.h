@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace elf {
+  // streams the messages of a TotalView-ITCH 5.0 file, each behind its
+  // 2-byte big-endian length. the file is memory-mapped; a plain one is
+  // read in place, a gzip one (told by its magic, and possibly of several
+  // members) is inflated from the mapping by a thread of its own into a
+  // bounded queue of blocks of whole messages, so decompression and the
+  // consumer run side by side. blocks are recycled, not reallocated.
+  class ItchReader {
+  public:
+    ItchReader(const std::string& path, size_t block_size = 4 << 20, size_t depth = 4);
+    ~ItchReader();
+    ItchReader(const ItchReader&) = delete;
+    ItchReader& operator=(const ItchReader&) = delete;
+
+    // calls fn(msg, len) for each message in turn until it returns false,
+    // and returns whether the file was read to the end. a corrupt
+    // compressed file is thrown as runtime_error; a message cut short by
+    // the end of the file is left out and counted by truncated().
+    template <typename F>
+    bool
+    read(F&& fn) {
+      const char* p;
+      const char* end;
+      while(next(p, end)) {
+        while(end - p >= 2) {
+          size_t len = uint8_t(p[0]) << 8 | uint8_t(p[1]);
+          if(size_t(end - p) < 2 + len)
+            break;
+          _messages++;
+          if(!fn(p + 2, len))
+            return false;
+          p += 2 + len;
+        }
+        _truncated = end - p;
+      }
+      return true;
+    }
+
+    const std::string& path() const { return _path; }
+    bool compressed() const         { return _compressed; }
+    size_t file_bytes() const       { return _len; }
+    uint64_t messages() const       { return _messages; }
+    size_t truncated() const        { return _truncated; }
+
+  private:
+    struct Block {
+      std::vector<char> data;
+      size_t used = 0;
+    };
+
+    // the next run of whole messages, false at the end of the file
+    bool next(const char*& begin, const char*& end);
+    void run();
+    void stop();
+
+    std::string _path;
+    const char* _base = nullptr;
+    size_t _len = 0;
+    bool _compressed = false;
+    bool _done = false;
+    uint64_t _messages = 0;
+    size_t _truncated = 0;
+
+    size_t _block_size;
+    size_t _depth;
+    std::vector<std::unique_ptr<Block>> _blocks;
+    std::vector<Block*> _free;
+    std::deque<Block*> _ready;
+    Block* _current = nullptr;
+    bool _eof = false;
+    // bytes of a message the inflated file ended in the middle of
+    size_t _leftover = 0;
+    std::string _error;
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    bool _stop = false;
+  };
+}
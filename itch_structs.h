@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+
+#include "big_endian.h"
+#include "ouch_structs.h"
+
+namespace elf {
+
+  // NASDAQ TotalView-ITCH 5.0, as written to the binary files NASDAQ
+  // publishes: every message is preceded by its 2-byte big-endian length.
+  // only the messages that build books, and what names them, are decoded;
+  // the rest are skipped by length.
+  namespace ITCH50 {
+    namespace MessageType {
+      static const char SystemEvent            = 'S';
+      static const char StockDirectory         = 'R';
+      static const char StockTradingAction     = 'H';
+      static const char AddOrder               = 'A';
+      static const char AddOrderMPID           = 'F';
+      static const char OrderExecuted          = 'E';
+      static const char OrderExecutedWithPrice = 'C';
+      static const char OrderCancel            = 'X';
+      static const char OrderDelete            = 'D';
+      static const char OrderReplace           = 'U';
+      static const char Trade                  = 'P';
+      static const char CrossTrade             = 'Q';
+      static const char BrokenTrade            = 'B';
+    }
+
+    namespace Constants {
+      static const char SideBuy  = 'B';
+      static const char SideSell = 'S';
+    }
+
+    // timestamps are nanoseconds since midnight, in 6 bytes
+    struct __attribute__((__packed__)) Header {
+      char type;
+      be16_t locate;
+      be16_t tracking;
+      uint8_t timestamp[6];
+
+      uint64_t
+      nanos() const {
+        return uint64_t(timestamp[0]) << 40 | uint64_t(timestamp[1]) << 32 | uint64_t(timestamp[2]) << 24 |
+          uint64_t(timestamp[3]) << 16 | uint64_t(timestamp[4]) << 8 | uint64_t(timestamp[5]);
+      }
+    };
+
+    struct __attribute__((__packed__)) SystemEvent {
+      static constexpr char msg_type = MessageType::SystemEvent;
+      Header header;
+      char event_code;
+    };
+
+    struct __attribute__((__packed__)) StockDirectory {
+      static constexpr char msg_type = MessageType::StockDirectory;
+      Header header;
+      char stock[8];
+      char market_category;
+      char financial_status;
+      be32_t round_lot_size;
+      char round_lots_only;
+      char issue_classification;
+      char issue_subtype[2];
+      char authenticity;
+      char short_sale_threshold;
+      char ipo_flag;
+      char luld_tier;
+      char etp_flag;
+      be32_t etp_leverage;
+      char inverse;
+    };
+
+    struct __attribute__((__packed__)) StockTradingAction {
+      static constexpr char msg_type = MessageType::StockTradingAction;
+      Header header;
+      char stock[8];
+      char state;
+      char reserved;
+      char reason[4];
+    };
+
+    struct __attribute__((__packed__)) AddOrder {
+      static constexpr char msg_type = MessageType::AddOrder;
+      Header header;
+      be64_t ref;
+      char side;
+      be32_t shares;
+      char stock[8];
+      be32_t px;
+    };
+
+    struct __attribute__((__packed__)) AddOrderMPID {
+      static constexpr char msg_type = MessageType::AddOrderMPID;
+      Header header;
+      be64_t ref;
+      char side;
+      be32_t shares;
+      char stock[8];
+      be32_t px;
+      char attribution[4];
+    };
+
+    struct __attribute__((__packed__)) OrderExecuted {
+      static constexpr char msg_type = MessageType::OrderExecuted;
+      Header header;
+      be64_t ref;
+      be32_t shares;
+      be64_t match;
+    };
+
+    struct __attribute__((__packed__)) OrderExecutedWithPrice {
+      static constexpr char msg_type = MessageType::OrderExecutedWithPrice;
+      Header header;
+      be64_t ref;
+      be32_t shares;
+      be64_t match;
+      char printable;
+      be32_t px;
+    };
+
+    struct __attribute__((__packed__)) OrderCancel {
+      static constexpr char msg_type = MessageType::OrderCancel;
+      Header header;
+      be64_t ref;
+      be32_t shares;
+    };
+
+    struct __attribute__((__packed__)) OrderDelete {
+      static constexpr char msg_type = MessageType::OrderDelete;
+      Header header;
+      be64_t ref;
+    };
+
+    struct __attribute__((__packed__)) OrderReplace {
+      static constexpr char msg_type = MessageType::OrderReplace;
+      Header header;
+      be64_t ref;
+      be64_t new_ref;
+      be32_t shares;
+      be32_t px;
+    };
+
+    struct __attribute__((__packed__)) Trade {
+      static constexpr char msg_type = MessageType::Trade;
+      Header header;
+      be64_t ref;
+      char side;
+      be32_t shares;
+      char stock[8];
+      be32_t px;
+      be64_t match;
+    };
+
+    struct __attribute__((__packed__)) CrossTrade {
+      static constexpr char msg_type = MessageType::CrossTrade;
+      Header header;
+      be64_t shares;
+      char stock[8];
+      be32_t px;
+      be64_t match;
+      char cross_type;
+    };
+
+    struct __attribute__((__packed__)) BrokenTrade {
+      static constexpr char msg_type = MessageType::BrokenTrade;
+      Header header;
+      be64_t match;
+    };
+
+    static constexpr OUCH42::MessageSizeTable<SystemEvent, StockDirectory, StockTradingAction, AddOrder, AddOrderMPID,
+                                              OrderExecuted, OrderExecutedWithPrice, OrderCancel, OrderDelete,
+                                              OrderReplace, Trade, CrossTrade, BrokenTrade> decoded_sizes;
+
+    static_assert(sizeof(Header) == 11 && sizeof(StockDirectory) == 39, "ITCH 5.0 sizes");
+    static_assert(sizeof(AddOrder) == 36 && sizeof(OrderReplace) == 35 && sizeof(Trade) == 44, "ITCH 5.0 sizes");
+
+    // the size of a message we decode, 0 for the types we skip
+    inline size_t message_size(const char msgtype) { return decoded_sizes[msgtype]; }
+  }
+}
@@ -0,0 +1,53 @@
+#include <algorithm>
+
+#include "latency_histogram.h"
+
+using namespace elf;
+
+void
+LatencyHistogram::merge(const LatencyHistogram& other) {
+  for(size_t i=0; i<bucket_count; i++)
+    _counts[i] += other._counts[i];
+  _total += other._total;
+  _sum += other._sum;
+  _max = std::max(_max, other._max);
+  _min = std::min(_min, other._min);
+}
+
+void
+LatencyHistogram::reset() {
+  *this = LatencyHistogram();
+}
+
+uint64_t
+LatencyHistogram::lowest_value_of(size_t index) {
+  if(index < sub_buckets)
+    return index;
+  size_t shift = index / sub_buckets - 1;
+  return (sub_buckets + index % sub_buckets) << shift;
+}
+
+uint64_t
+LatencyHistogram::highest_value_of(size_t index) {
+  if(index < sub_buckets)
+    return index;
+  size_t shift = index / sub_buckets - 1;
+  return lowest_value_of(index) + (uint64_t(1) << shift) - 1;
+}
+
+uint64_t
+LatencyHistogram::percentile(double p) const {
+  if(!_total)
+    return 0;
+
+  uint64_t rank = uint64_t(p / 100.0 * _total + 0.5);
+  rank = std::max<uint64_t>(1, std::min(rank, _total));
+
+  uint64_t seen = 0;
+  for(size_t i=0; i<bucket_count; i++) {
+    seen += _counts[i];
+    if(seen >= rank)
+      return std::min(highest_value_of(i), _max);
+  }
+  return _max;
+}
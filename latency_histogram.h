@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace elf {
+  // log-bucketed histogram in the style of HdrHistogram. values below
+  // 2^sub_bucket_bits are counted exactly; above that each power of two is
+  // split into 2^sub_bucket_bits linear buckets, giving a relative error of
+  // at most 1/2^sub_bucket_bits over the whole range. values at or beyond
+  // 2^max_value_bits land in the last bucket.
+  class LatencyHistogram {
+  public:
+    static constexpr int sub_bucket_bits = 4;
+    static constexpr int max_value_bits = 40;
+    static constexpr size_t sub_buckets = size_t(1) << sub_bucket_bits;
+    static constexpr size_t bucket_count = sub_buckets * (max_value_bits - sub_bucket_bits + 1);
+
+    void
+    record(uint64_t value) {
+      _counts[index_of(value)]++;
+      _total++;
+      _sum += value;
+      if(value > _max)
+        _max = value;
+      if(value < _min)
+        _min = value;
+    }
+
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const { return _total; }
+    uint64_t min() const   { return _total ? _min : 0; }
+    uint64_t max() const   { return _max; }
+    uint64_t mean() const  { return _total ? _sum / _total : 0; }
+    // upper bound of the bucket holding the p-th percentile, p in [0, 100]
+    uint64_t percentile(double p) const;
+
+    static size_t
+    index_of(uint64_t value) {
+      if(value < sub_buckets)
+        return value;
+      int msb = 63 - __builtin_clzll(value);
+      if(msb >= max_value_bits)
+        return bucket_count - 1;
+      int shift = msb - sub_bucket_bits;
+      return sub_buckets * (shift + 1) + ((value >> shift) - sub_buckets);
+    }
+
+    static uint64_t lowest_value_of(size_t index);
+    static uint64_t highest_value_of(size_t index);
+
+  private:
+    uint32_t _counts[bucket_count] = {};
+    uint64_t _total = 0;
+    uint64_t _sum = 0;
+    uint64_t _min = UINT64_MAX;
+    uint64_t _max = 0;
+  };
+}
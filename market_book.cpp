@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cstring>
+
+#include "itch_structs.h"
+#include "market_book.h"
+
+using namespace OUCHSim;
+using namespace elf;
+using namespace std;
+
+MarketBook::MarketBook() {
+  memset(symbol, ' ', sizeof(symbol));
+}
+
+MarketBook::Levels::iterator
+MarketBook::find_level(Levels& levels, bool buy, uint32_t px) {
+  if(buy)
+    return lower_bound(levels.begin(), levels.end(), px,
+                       [](const MarketLevel& l, uint32_t p) { return l.px < p; });
+  else
+    return lower_bound(levels.begin(), levels.end(), px,
+                       [](const MarketLevel& l, uint32_t p) { return l.px > p; });
+}
+
+void
+MarketBook::add(bool buy, uint32_t px, uint32_t qty) {
+  Levels& levels = buy ? _bids : _asks;
+  auto it = find_level(levels, buy, px);
+  if(it == levels.end() || it->px != px)
+    it = levels.insert(it, MarketLevel{px, 0, 0});
+  it->qty += qty;
+  it->taken = 0;
+}
+
+void
+MarketBook::remove(bool buy, uint32_t px, uint32_t qty) {
+  Levels& levels = buy ? _bids : _asks;
+  auto it = find_level(levels, buy, px);
+  if(it == levels.end() || it->px != px)
+    return;
+  it->qty -= min(qty, it->qty);
+  it->taken = 0;
+  if(!it->qty)
+    levels.erase(it);
+}
+
+uint32_t
+MarketBook::crossing(bool buy, uint32_t px, uint32_t want) const {
+  const Levels& opposite = buy ? _asks : _bids;
+
+  uint32_t qty = 0;
+  for(auto it = opposite.rbegin(); it != opposite.rend() && qty < want; ++it) {
+    if(buy ? it->px > px : it->px < px)
+      break;
+    qty += it->available();
+  }
+  return qty;
+}
+
+void
+MarketBook::take(bool buy, uint32_t px, uint32_t qty) {
+  Levels& levels = buy ? _bids : _asks;
+  auto it = find_level(levels, buy, px);
+  if(it == levels.end() || it->px != px)
+    return;
+  it->taken += min(qty, it->available());
+}
+
+ItchBooks::ItchBooks(size_t capacity) : _books(UINT16_MAX + 1) {
+  size_t n = 16;
+  while(n < capacity)
+    n <<= 1;
+  rehash(n);
+}
+
+bool
+ItchBooks::is_book_message(char type) {
+  using namespace ITCH50::MessageType;
+  switch(type) {
+  case AddOrder: case AddOrderMPID: case OrderExecuted: case OrderExecutedWithPrice:
+  case OrderCancel: case OrderDelete: case OrderReplace:
+    return true;
+  default:
+    return false;
+  }
+}
+
+const MarketOrder*
+ItchBooks::apply(const char* msg, size_t len) {
+  using namespace ITCH50;
+  size_t size = message_size(msg[0]);
+  if(!size || len < size)
+    return nullptr;
+
+  uint16_t locate = reinterpret_cast<const Header*>(msg)->locate;
+  switch(msg[0]) {
+  case MessageType::StockDirectory: {
+    auto m = reinterpret_cast<const StockDirectory*>(msg);
+    memcpy(book_for(locate).symbol, m->stock, sizeof(m->stock));
+    return nullptr;
+  }
+  case MessageType::AddOrder: {
+    auto m = reinterpret_cast<const AddOrder*>(msg);
+    return add(m->ref, locate, m->side == Constants::SideBuy, m->px, m->shares);
+  }
+  case MessageType::AddOrderMPID: {
+    auto m = reinterpret_cast<const AddOrderMPID*>(msg);
+    return add(m->ref, locate, m->side == Constants::SideBuy, m->px, m->shares);
+  }
+  case MessageType::OrderExecuted: {
+    auto m = reinterpret_cast<const OrderExecuted*>(msg);
+    reduce(m->ref, m->shares);
+    return nullptr;
+  }
+  case MessageType::OrderExecutedWithPrice: {
+    // the print's price is the trade's, not the resting order's
+    auto m = reinterpret_cast<const OrderExecutedWithPrice*>(msg);
+    reduce(m->ref, m->shares);
+    return nullptr;
+  }
+  case MessageType::OrderCancel: {
+    auto m = reinterpret_cast<const OrderCancel*>(msg);
+    reduce(m->ref, m->shares);
+    return nullptr;
+  }
+  case MessageType::OrderDelete:
+    reduce(reinterpret_cast<const OrderDelete*>(msg)->ref, UINT32_MAX);
+    return nullptr;
+  case MessageType::OrderReplace: {
+    // the new order loses priority, but keeps the old one's stock and side
+    auto m = reinterpret_cast<const OrderReplace*>(msg);
+    MarketOrder* old = find(m->ref);
+    if(!old) {
+      _unknown_refs++;
+      return nullptr;
+    }
+    bool buy = old->buy;
+    uint16_t old_locate = old->locate;
+    book_for(old_locate).remove(buy, old->px, old->qty);
+    erase(old);
+    return add(m->new_ref, old_locate, buy, m->px, m->shares);
+  }
+  default:
+    return nullptr;
+  }
+}
+
+MarketBook&
+ItchBooks::book_for(uint16_t locate) {
+  unique_ptr<MarketBook>& book = _books[locate];
+  if(!book)
+    book.reset(new MarketBook());
+  return *book;
+}
+
+const MarketOrder*
+ItchBooks::add(uint64_t ref, uint16_t locate, bool buy, uint32_t px, uint32_t qty) {
+  if(!qty)
+    return nullptr;
+
+  // a reference reused while still open replaces the order it named
+  MarketOrder* order = find(ref);
+  if(order)
+    book_for(order->locate).remove(order->buy, order->px, order->qty);
+  else
+    order = insert(ref);
+
+  *order = MarketOrder{ref, px, qty, locate, buy};
+  book_for(locate).add(buy, px, qty);
+  return order;
+}
+
+void
+ItchBooks::reduce(uint64_t ref, uint32_t qty) {
+  MarketOrder* order = find(ref);
+  if(!order) {
+    _unknown_refs++;
+    return;
+  }
+
+  qty = min(qty, order->qty);
+  book_for(order->locate).remove(order->buy, order->px, qty);
+  order->qty -= qty;
+  if(!order->qty)
+    erase(order);
+}
+
+MarketOrder*
+ItchBooks::find(uint64_t ref) {
+  for(size_t i = home(ref); ; i = (i + 1) & _mask) {
+    MarketOrder& slot = _slots[i];
+    if(!slot.qty)
+      return nullptr;
+    if(slot.ref == ref)
+      return &slot;
+  }
+}
+
+// the slot for a reference known not to be in the table; the caller gives
+// it shares
+MarketOrder*
+ItchBooks::insert(uint64_t ref) {
+  if(_size >= _grow_at)
+    rehash(_slots.size() * 2);
+
+  size_t i = home(ref);
+  while(_slots[i].qty)
+    i = (i + 1) & _mask;
+  _size++;
+  return &_slots[i];
+}
+
+// backward shift: pull later entries of the chain into the hole unless
+// that would move them in front of their home slot
+void
+ItchBooks::erase(MarketOrder* order) {
+  size_t hole = order - _slots.data();
+  for(size_t j = (hole + 1) & _mask; _slots[j].qty; j = (j + 1) & _mask) {
+    size_t h = home(_slots[j].ref);
+    if(((j - h) & _mask) >= ((j - hole) & _mask)) {
+      _slots[hole] = _slots[j];
+      hole = j;
+    }
+  }
+
+  _slots[hole].qty = 0;
+  _size--;
+}
+
+void
+ItchBooks::rehash(size_t capacity) {
+  vector<MarketOrder> old;
+  old.swap(_slots);
+
+  _slots.assign(capacity, MarketOrder{0, 0, 0, 0, false});
+  _mask = capacity - 1;
+  _shift = 64 - __builtin_ctzll(capacity);
+  _grow_at = capacity - capacity/4;
+
+  for(const MarketOrder& order : old) {
+    if(!order.qty)
+      continue;
+    size_t i = home(order.ref);
+    while(_slots[i].qty)
+      i = (i + 1) & _mask;
+    _slots[i] = order;
+  }
+}
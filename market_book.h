@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace OUCHSim {
+  // taken is the part of qty the simulator's orders have traded with since
+  // the feed last changed the level; it isn't offered again
+  struct MarketLevel {
+    uint32_t px;
+    uint32_t qty;
+    uint32_t taken;
+
+    uint32_t available() const { return qty - taken; }
+  };
+
+  // the depth of one symbol as a market data feed shows it: shares by price
+  // on each side, in vectors sorted like OrderBook's, best at the back
+  class MarketBook {
+  public:
+    typedef std::vector<MarketLevel> Levels;
+
+    MarketBook();
+
+    void add(bool buy, uint32_t px, uint32_t qty);
+    void remove(bool buy, uint32_t px, uint32_t qty);
+    // shares on the opposite side an order on side buy limited at px would
+    // take, counted up to want
+    uint32_t crossing(bool buy, uint32_t px, uint32_t want) const;
+    // marks shares of the level at px on side buy as taken
+    void take(bool buy, uint32_t px, uint32_t qty);
+
+    const MarketLevel* best_bid() const { return _bids.empty() ? nullptr : &_bids.back(); }
+    const MarketLevel* best_ask() const { return _asks.empty() ? nullptr : &_asks.back(); }
+    const Levels& bids() const          { return _bids; }
+    const Levels& asks() const          { return _asks; }
+
+    // the stock, 8 characters space padded as in OUCH and ITCH
+    char symbol[8];
+
+  private:
+    Levels::iterator find_level(Levels& levels, bool buy, uint32_t px);
+
+    Levels _bids;
+    Levels _asks;
+  };
+
+  // an order of the feed's, by its reference number
+  struct MarketOrder {
+    uint64_t ref;
+    uint32_t px;
+    uint32_t qty;
+    uint16_t locate;
+    bool buy;
+  };
+
+  // the books of a TotalView-ITCH 5.0 feed, rebuilt from its order
+  // messages. books are indexed by the feed's stock locate and orders kept
+  // in an open-addressing table on their reference number, probed linearly
+  // with backward-shift deletion like TokenIndex; an order executed or
+  // canceled down to nothing leaves it.
+  class ItchBooks {
+  public:
+    ItchBooks(size_t capacity = 1 << 20);
+
+    // applies one message, returning the order it added to a book, if it
+    // did; valid until the next call. messages that don't touch a book are
+    // skipped, as are ones shorter than their type.
+    const MarketOrder* apply(const char* msg, size_t len);
+
+    // created by the stock's directory message, or by the first order in it
+    MarketBook* book(uint16_t locate) const { return _books[locate].get(); }
+    static bool is_book_message(char type);
+
+    size_t orders() const         { return _size; }
+    uint64_t unknown_refs() const { return _unknown_refs; }
+
+  private:
+    MarketBook& book_for(uint16_t locate);
+    size_t home(uint64_t ref) const { return (ref * 0x9e3779b97f4a7c15ULL) >> _shift; }
+    MarketOrder* find(uint64_t ref);
+    MarketOrder* insert(uint64_t ref);
+    void erase(MarketOrder* order);
+    void rehash(size_t capacity);
+    const MarketOrder* add(uint64_t ref, uint16_t locate, bool buy, uint32_t px, uint32_t qty);
+    void reduce(uint64_t ref, uint32_t qty);
+
+    std::vector<std::unique_ptr<MarketBook>> _books;
+    // an empty slot has no shares
+    std::vector<MarketOrder> _slots;
+    size_t _mask = 0;
+    int _shift = 0;
+    size_t _size = 0;
+    size_t _grow_at = 0;
+    uint64_t _unknown_refs = 0;
+  };
+}
@@ -0,0 +1,172 @@
+#include <algorithm>
+
+#include "ouch_structs.h"
+#include "order_book.h"
+
+using namespace OUCHSim;
+using namespace elf;
+using namespace std;
+
+bool
+OrderBook::is_buy(char side) {
+  return side == OUCH42::Constants::SideBuy;
+}
+
+OrderBook::Levels::iterator
+OrderBook::find_level(Levels& levels, bool buy, uint32_t px) {
+  if(buy)
+    return lower_bound(levels.begin(), levels.end(), px,
+                       [](const PriceLevel& l, uint32_t p) { return l.px < p; });
+  else
+    return lower_bound(levels.begin(), levels.end(), px,
+                       [](const PriceLevel& l, uint32_t p) { return l.px > p; });
+}
+
+uint32_t
+OrderBook::match(oid_t oid, uint64_t& match_id, FillList& fills) {
+  OUCHOrder& order = _store[oid];
+  bool buy = is_buy(order.side);
+  Levels& opposite = buy ? _asks : _bids;
+
+  while(order.leaves() && !opposite.empty()) {
+    PriceLevel& level = opposite.back();
+    if(buy ? level.px > order.px : level.px < order.px)
+      break;
+
+    while(order.leaves() && level.count) {
+      OUCHOrder& passive = _store[level.head];
+      uint32_t qty = min(order.leaves(), passive.leaves());
+
+      fills.push_back(Fill{level.head, oid, qty, level.px, match_id++});
+      passive.filled_qty += qty;
+      order.filled_qty += qty;
+      level.qty -= qty;
+
+      if(!passive.leaves()) {
+        passive.state = OrderState::FILLED;
+        unlink(level, passive);
+      }
+    }
+
+    if(!level.count)
+      opposite.pop_back();
+  }
+
+  if(!order.leaves())
+    order.state = OrderState::FILLED;
+
+  return order.leaves();
+}
+
+uint32_t
+OrderBook::crossing(bool buy, uint32_t px, uint32_t want) const {
+  const Levels& opposite = buy ? _asks : _bids;
+
+  uint32_t qty = 0;
+  for(auto it = opposite.rbegin(); it != opposite.rend() && qty < want; ++it) {
+    if(buy ? it->px > px : it->px < px)
+      break;
+    qty += it->qty;
+  }
+  return qty;
+}
+
+void
+OrderBook::add(oid_t oid) {
+  OUCHOrder& order = _store[oid];
+  bool buy = is_buy(order.side);
+  Levels& levels = buy ? _bids : _asks;
+
+  auto it = find_level(levels, buy, order.px);
+  if(it == levels.end() || it->px != order.px)
+    it = levels.insert(it, PriceLevel{order.px, 0, 0, INVALID_OID, INVALID_OID});
+
+  PriceLevel& level = *it;
+  order.prev = level.tail;
+  order.next = INVALID_OID;
+  if(level.tail != INVALID_OID)
+    _store[level.tail].next = oid;
+  else
+    level.head = oid;
+  level.tail = oid;
+  level.qty += order.leaves();
+  level.count++;
+
+  order.state = OrderState::OPEN;
+}
+
+bool
+OrderBook::remove(oid_t oid) {
+  OUCHOrder& order = _store[oid];
+  bool buy = is_buy(order.side);
+  Levels& levels = buy ? _bids : _asks;
+
+  auto it = find_level(levels, buy, order.px);
+  if(it == levels.end() || it->px != order.px)
+    return false;
+
+  unlink(*it, order);
+  if(!it->count)
+    levels.erase(it);
+  return true;
+}
+
+bool
+OrderBook::reduce(oid_t oid, uint32_t leaves) {
+  OUCHOrder& order = _store[oid];
+  if(!leaves)
+    return remove(oid);
+
+  bool buy = is_buy(order.side);
+  Levels& levels = buy ? _bids : _asks;
+
+  auto it = find_level(levels, buy, order.px);
+  if(it == levels.end() || it->px != order.px)
+    return false;
+
+  it->qty -= order.leaves() - leaves;
+  order.qty = order.filled_qty + leaves;
+  return true;
+}
+
+bool
+OrderBook::execute(oid_t oid, uint32_t qty) {
+  OUCHOrder& order = _store[oid];
+  bool buy = is_buy(order.side);
+  Levels& levels = buy ? _bids : _asks;
+
+  auto it = find_level(levels, buy, order.px);
+  if(it == levels.end() || it->px != order.px)
+    return false;
+
+  if(qty < order.leaves()) {
+    it->qty -= qty;
+    order.filled_qty += qty;
+    return true;
+  }
+
+  qty = order.leaves();
+  unlink(*it, order);
+  if(!it->count)
+    levels.erase(it);
+  order.filled_qty += qty;
+  order.state = OrderState::FILLED;
+  return true;
+}
+
+void
+OrderBook::unlink(PriceLevel& level, OUCHOrder& order) {
+  if(order.prev != INVALID_OID)
+    _store[order.prev].next = order.next;
+  else
+    level.head = order.next;
+
+  if(order.next != INVALID_OID)
+    _store[order.next].prev = order.prev;
+  else
+    level.tail = order.prev;
+
+  order.prev = order.next = INVALID_OID;
+  level.qty -= order.leaves();
+  level.count--;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "order_store.h"
+
+namespace OUCHSim {
+  struct Fill {
+    oid_t passive;
+    oid_t aggressive;
+    uint32_t qty;
+    uint32_t px;
+    uint64_t match_id;
+  };
+
+  typedef std::vector<Fill> FillList;
+
+  struct PriceLevel {
+    uint32_t px;
+    uint32_t qty;
+    uint32_t count;
+    oid_t head;
+    oid_t tail;
+  };
+
+  // price-time priority book for a single symbol. each side is a vector of
+  // levels sorted so that the best price is at the back; orders within a
+  // level form an intrusive fifo threaded through OUCHOrder::prev/next.
+  class OrderBook {
+  public:
+    OrderBook(OrderStore& store) : _store(store) {}
+
+    // cross order against the opposite side, appending to fills. returns
+    // the quantity left over, which the caller may rest with add().
+    uint32_t match(oid_t oid, uint64_t& match_id, FillList& fills);
+    // shares on the opposite side an order on side buy limited at px would
+    // trade with, counted up to want
+    uint32_t crossing(bool buy, uint32_t px, uint32_t want) const;
+    void add(oid_t oid);
+    bool remove(oid_t oid);
+    // shrink open quantity in place, keeping queue position
+    bool reduce(oid_t oid, uint32_t leaves);
+    // fill qty of a resting order with no counterparty in the book; one
+    // left with nothing open is taken out, FILLED
+    bool execute(oid_t oid, uint32_t qty);
+
+    const PriceLevel* best_bid() const { return _bids.empty() ? nullptr : &_bids.back(); }
+    const PriceLevel* best_ask() const { return _asks.empty() ? nullptr : &_asks.back(); }
+    size_t bid_levels() const          { return _bids.size(); }
+    size_t ask_levels() const          { return _asks.size(); }
+
+    static bool is_buy(char side);
+
+  private:
+    typedef std::vector<PriceLevel> Levels;
+
+    Levels::iterator find_level(Levels& levels, bool buy, uint32_t px);
+    void unlink(PriceLevel& level, OUCHOrder& order);
+
+    OrderStore& _store;
+    Levels _bids;
+    Levels _asks;
+  };
+}
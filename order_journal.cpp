@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "order_journal.h"
+
+using namespace OUCHSim;
+using namespace std;
+
+static const char journal_magic[8] = {'O', 'U', 'C', 'H', 'J', 'N', 'L', '1'};
+static constexpr uint32_t journal_version = 4;
+
+static runtime_error
+journal_error(const string& path, const char* what) {
+  return runtime_error(path + ": " + what + ": " + strerror(errno));
+}
+
+static_assert(sizeof(OrderJournal::Header) + OrderJournal::max_users * OrderJournal::username_len <= OrderJournal::header_size,
+              "the username table fits the header");
+
+OrderJournal::OrderJournal(const string& path, uint32_t shard, uint32_t shards, size_t records)
+  : _path(path), _capacity(records) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    throw journal_error(path, "open");
+
+  size_t len = header_size + records * sizeof(JournalRecord);
+  if(ftruncate(fd, len) < 0) {
+    ::close(fd);
+    throw journal_error(path, "ftruncate");
+  }
+  // reserve the blocks up front; on filesystems without fallocate the file
+  // stays sparse, which only costs a block allocation on first touch
+  posix_fallocate(fd, 0, len);
+
+  _fd = fd;
+  map(fd, len, true);
+
+  Header* h = reinterpret_cast<Header*>(_base);
+  memcpy(h->magic, journal_magic, sizeof(h->magic));
+  h->version = journal_version;
+  h->record_size = sizeof(JournalRecord);
+  h->shard = shard;
+  h->shards = shards;
+  h->capacity = records;
+}
+
+OrderJournal::~OrderJournal() {
+  if(_base)
+    munmap(_base, _len);
+  if(_fd >= 0)
+    ::close(_fd);
+}
+
+unique_ptr<OrderJournal>
+OrderJournal::open(const string& path, uint32_t shard, uint32_t shards) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0) {
+    if(errno == ENOENT)
+      return nullptr;
+    throw journal_error(path, "open");
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    ::close(fd);
+    throw journal_error(path, "fstat");
+  }
+  if(size_t(st.st_size) < header_size) {
+    ::close(fd);
+    throw runtime_error(path + ": short journal");
+  }
+
+  unique_ptr<OrderJournal> j(new OrderJournal());
+  j->_path = path;
+  j->map(fd, st.st_size, false);
+  ::close(fd);
+
+  const Header* h = reinterpret_cast<const Header*>(j->_base);
+  static const char abandoned[sizeof(h->magic)] = {};
+  if(!memcmp(h->magic, abandoned, sizeof(h->magic)))
+    throw runtime_error(path + ": journal abandoned after it missed a transition, its orders can't be recovered;"
+                        " move it aside to start without them");
+  if(memcmp(h->magic, journal_magic, sizeof(h->magic)) || h->version != journal_version ||
+     h->record_size != sizeof(JournalRecord))
+    throw runtime_error(path + ": not a version " + to_string(journal_version) + " order journal");
+  if(h->shard != shard || h->shards != shards)
+    throw runtime_error(path + ": written for shard " + to_string(h->shard) + " of " + to_string(h->shards) +
+                        ", restart with the same thread count");
+
+  if(h->users > max_users)
+    throw runtime_error(path + ": bad username count " + to_string(h->users));
+  for(uint32_t user=1; user<=h->users; user++)
+    j->_user_ids.emplace(j->username(user), user);
+
+  j->_capacity = min<size_t>(h->capacity, (j->_len - header_size) / sizeof(JournalRecord));
+  j->_next = j->_capacity;
+  madvise(j->_base, j->_len, MADV_SEQUENTIAL | MADV_WILLNEED);
+  return j;
+}
+
+void
+OrderJournal::map(int fd, size_t len, bool writable) {
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* p = mmap(nullptr, len, prot, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    throw journal_error(_path, "mmap");
+
+  _base = static_cast<char*>(p);
+  _len = len;
+  _records = reinterpret_cast<JournalRecord*>(_base + header_size);
+}
+
+// doubles the file and remaps it, moving the mapping if it has to. the
+// blocks are reserved first, so that a full disk fails here rather than
+// as a fault on a later append.
+bool
+OrderJournal::grow() {
+  size_t records = _capacity * 2;
+  size_t len = header_size + records * sizeof(JournalRecord);
+  if(ftruncate(_fd, len) < 0)
+    return false;
+  int err = posix_fallocate(_fd, _len, len - _len);
+  if(err && err != EOPNOTSUPP) {
+    errno = err;
+    return false;
+  }
+
+  void* p = mremap(_base, _len, len, MREMAP_MAYMOVE);
+  if(p == MAP_FAILED)
+    return false;
+  _base = static_cast<char*>(p);
+  _len = len;
+  _records = reinterpret_cast<JournalRecord*>(_base + header_size);
+  _capacity = records;
+  header()->capacity = records;
+  return true;
+}
+
+void
+OrderJournal::abandon() {
+  memset(header()->magic, 0, sizeof(header()->magic));
+}
+
+// the name is written before the count, so a crash never leaves a counted
+// slot unwritten
+uint16_t
+OrderJournal::user_id(const string& username) {
+  if(username.empty())
+    return 0;
+  auto it = _user_ids.find(username);
+  if(it != _user_ids.end())
+    return it->second;
+
+  Header* h = header();
+  if(h->users == max_users || username.size() > username_len)
+    return 0;
+  uint16_t user = h->users + 1;
+  memset(username_slot(user), 0, username_len);
+  memcpy(username_slot(user), username.data(), username.size());
+  h->users = user;
+  _user_ids.emplace(username, user);
+  return user;
+}
+
+string
+OrderJournal::username(uint16_t user) const {
+  if(!user || user > header()->users)
+    return string();
+  const char* slot = username_slot(user);
+  return string(slot, strnlen(slot, username_len));
+}
+
+void
+OrderJournal::copy_users(const OrderJournal& from) {
+  for(uint32_t user=1; user<=from.header()->users; user++)
+    user_id(from.username(user));
+}
+
+// the mapping survives the rename, so appends carry on into the new name
+void
+OrderJournal::rename(const string& path) {
+  if(::rename(_path.c_str(), path.c_str()) < 0)
+    throw journal_error(_path, "rename");
+  _path = path;
+}
+
+// the inverse of write(), less the state and book links
+void
+OrderJournal::load(const JournalRecord& rec, OUCHOrder& order) {
+  order.side = rec.side;
+  order.display = rec.display;
+  order.capacity = rec.capacity;
+  order.iso = rec.iso;
+  order.cross_type = rec.cross_type;
+  order.user = rec.user;
+  order.qty = rec.qty;
+  order.filled_qty = rec.filled_qty;
+  order.px = rec.px;
+  order.tif = rec.tif;
+  order.minqty = rec.minqty;
+  memcpy(order.token, rec.token, sizeof(order.token));
+  memcpy(order.symbol, rec.symbol, sizeof(order.symbol));
+  memcpy(order.mpid, rec.mpid, sizeof(order.mpid));
+}
+
+void
+OrderJournal::write(JournalRecord& rec, const OUCHOrder& order) {
+  rec.side = order.side;
+  rec.display = order.display;
+  rec.capacity = order.capacity;
+  rec.iso = order.iso;
+  rec.cross_type = order.cross_type;
+  rec.user = order.user;
+  rec.oid = order.oid;
+  rec.qty = order.qty;
+  rec.filled_qty = order.filled_qty;
+  rec.px = order.px;
+  rec.tif = order.tif;
+  rec.minqty = order.minqty;
+  memcpy(rec.token, order.token, sizeof(rec.token));
+  memcpy(rec.symbol, order.symbol, sizeof(rec.symbol));
+  memcpy(rec.mpid, order.mpid, sizeof(rec.mpid));
+  __atomic_store_n(&rec.state, uint8_t(order.state.index()), __ATOMIC_RELEASE);
+}
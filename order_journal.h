@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "ouch_order.h"
+
+namespace OUCHSim {
+  // one journal record per order state transition, carrying the whole order
+  // image after the transition so that replay is a matter of applying
+  // images in order. state is written last and is never INITIAL, so the
+  // first record with state 0 marks the end of a journal. user names the
+  // owning session in the journal's table of usernames, 0 for none.
+  struct JournalRecord {
+    uint8_t state;
+    char side;
+    char display;
+    char capacity;
+    char iso;
+    char cross_type;
+    uint16_t user;
+    oid_t oid;
+    uint32_t qty;
+    uint32_t filled_qty;
+    uint32_t px;
+    uint32_t tif;
+    uint32_t minqty;
+    char token[14];
+    char symbol[8];
+    char mpid[4];
+    char pad2[2];
+  } __attribute__((packed));
+
+  static_assert(sizeof(JournalRecord) == 64, "journal records are one cache line");
+
+  // append-only journal for one book shard, in a preallocated file mapped
+  // shared. appends are plain stores into the page cache with no msync or
+  // fsync, so a crashed process loses nothing but a lost machine may lose
+  // the tail. appends come from the shard's owner under the shard lock.
+  // a full journal doubles its file and mapping in place.
+  //
+  // the header also holds the usernames of the sessions whose orders the
+  // journal records, so that recovered orders can go back to them, and
+  // the shard's next match number. the table has room for every id a
+  // record can name, well past the sessions a simulator takes.
+  class OrderJournal {
+  public:
+    static constexpr size_t header_size = size_t(1) << 20;
+    static constexpr size_t username_len = 8;
+    static constexpr uint16_t max_users = UINT16_MAX;
+    static constexpr size_t default_records = size_t(1) << 24;
+
+    // create a new, empty journal at path, replacing any file there
+    OrderJournal(const std::string& path, uint32_t shard, uint32_t shards, size_t records);
+    ~OrderJournal();
+    OrderJournal(const OrderJournal&) = delete;
+    OrderJournal& operator=(const OrderJournal&) = delete;
+
+    // map an existing journal for replay, nullptr if there is none
+    static std::unique_ptr<OrderJournal> open(const std::string& path, uint32_t shard, uint32_t shards);
+
+    template <typename F>
+    size_t
+    replay(F&& apply) const {
+      size_t n = 0;
+      while(n < _capacity && _records[n].state) {
+        apply(_records[n]);
+        n++;
+      }
+      return n;
+    }
+
+    // false if the journal is full and can't grow; the transition is not
+    // recorded, and errno says why
+    bool
+    append(const OUCHOrder& order) {
+      if(_next == _capacity && !grow())
+        return false;
+      write(_records[_next++], order);
+      return true;
+    }
+
+    // marks a journal that missed a transition as unusable, so that the
+    // next start refuses to recover from it rather than replay a stale book
+    void abandon();
+    void rename(const std::string& path);
+    static void load(const JournalRecord& rec, OUCHOrder& order);
+
+    // a username's id, added to the table the first time it's seen. 0 for
+    // no username, or for one that can't be added: too long, or the table
+    // is full.
+    uint16_t user_id(const std::string& username);
+    std::string username(uint16_t user) const;
+    // carries a replayed journal's usernames over, keeping their ids
+    void copy_users(const OrderJournal& from);
+
+    // the shard's next match number, so a restart doesn't issue ones the
+    // day has already seen; 0 if never set
+    void set_next_match_id(uint64_t id) { header()->next_match_id = id; }
+    uint64_t next_match_id() const      { return header()->next_match_id; }
+
+    size_t size() const     { return _next; }
+    size_t capacity() const { return _capacity; }
+    const std::string& path() const { return _path; }
+
+    struct Header {
+      char magic[8];
+      uint32_t version;
+      uint32_t record_size;
+      uint32_t shard;
+      uint32_t shards;
+      uint64_t capacity;
+      uint64_t next_match_id;
+      uint32_t users;
+    };
+
+  private:
+
+    OrderJournal() {}
+    void map(int fd, size_t len, bool writable);
+    bool grow();
+    static void write(JournalRecord& rec, const OUCHOrder& order);
+    Header* header() const { return reinterpret_cast<Header*>(_base); }
+    char* username_slot(uint16_t user) const { return _base + sizeof(Header) + (user - 1) * username_len; }
+
+    std::string _path;
+    int _fd = -1;
+    char* _base = nullptr;
+    size_t _len = 0;
+    JournalRecord* _records = nullptr;
+    size_t _capacity = 0;
+    size_t _next = 0;
+    std::unordered_map<std::string, uint16_t> _user_ids;
+  };
+}
@@ -0,0 +1,99 @@
+#include <algorithm>
+
+#include "order_store.h"
+
+using namespace OUCHSim;
+using namespace std;
+
+oid_t
+OrderStore::alloc() {
+  uint32_t index;
+  if(_free_head != no_slot) {
+    index = _free_head;
+    _free_head = slot(index).next_free;
+  } else {
+    if(_next_index == no_slot)
+      return INVALID_OID;
+    if((_next_index >> chunk_bits) == _chunks.size())
+      _chunks.emplace_back(new Slot[chunk_size]);
+    index = _next_index++;
+  }
+
+  Slot& s = slot(index);
+  s.order = OUCHOrder();
+  s.next_free = no_slot;
+
+  oid_t oid = make_oid(index, s.generation);
+  s.order.oid = oid;
+
+  if(++_occupancy > _high_water)
+    _high_water = _occupancy;
+  return oid;
+}
+
+void
+OrderStore::release(oid_t oid) {
+  if(!get(oid))
+    return;
+
+  uint32_t index = index_of(oid);
+  Slot& s = slot(index);
+  s.generation = (s.generation + 1) & generation_mask;
+  s.next_free = _free_head;
+  _free_head = index;
+  _occupancy--;
+}
+
+OUCHOrder*
+OrderStore::get(oid_t oid) {
+  if(oid < 0)
+    return nullptr;
+
+  uint32_t index = index_of(oid);
+  if(index >= _next_index || store_of(oid) != _store_id)
+    return nullptr;
+
+  Slot& s = slot(index);
+  if(s.generation != generation_of(oid))
+    return nullptr;
+  return &s.order;
+}
+
+OUCHOrder*
+OrderStore::restore(oid_t oid) {
+  if(oid < 0 || store_of(oid) != _store_id || index_of(oid) == no_slot)
+    return nullptr;
+
+  uint32_t index = index_of(oid);
+  while(_next_index <= index) {
+    if((_next_index >> chunk_bits) == _chunks.size())
+      _chunks.emplace_back(new Slot[chunk_size]);
+    slot(_next_index).order.oid = INVALID_OID;
+    _next_index++;
+  }
+
+  Slot& s = slot(index);
+  s.order = OUCHOrder();
+  s.order.oid = oid;
+  s.generation = generation_of(oid);
+  return &s.order;
+}
+
+// a slot is live if its order still carries the slot's generation; release()
+// bumps the generation, and slots never named by the journal have no oid
+void
+OrderStore::finish_restore() {
+  _free_head = no_slot;
+  _occupancy = 0;
+  for(uint32_t i=_next_index; i-- > 0; ) {
+    Slot& s = slot(i);
+    if(oid_t(s.order.oid) != INVALID_OID && generation_of(s.order.oid) == s.generation) {
+      s.next_free = no_slot;
+      _occupancy++;
+    } else {
+      s.next_free = _free_head;
+      _free_head = i;
+    }
+  }
+  _high_water = max(_high_water, _occupancy);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ouch_order.h"
+
+namespace OUCHSim {
+  // chunked slab of orders. chunks are never moved or freed, so references
+  // to live orders stay valid as the store grows. slots of retired orders
+  // are recycled through a free list, and every oid carries the generation
+  // of its slot so that stale oids can be detected by get().
+  //
+  // oid layout: bits 0-31 slot index, bits 32-39 store id, bits 40-62 slot
+  // generation. the store id lets a partitioned simulator route an oid back
+  // to the store that issued it.
+  class OrderStore {
+  public:
+    static constexpr size_t chunk_bits = 16;
+    static constexpr size_t chunk_size = size_t(1) << chunk_bits;
+    static constexpr uint32_t max_stores = 256;
+
+    OrderStore(uint32_t store_id = 0) : _store_id(store_id) {}
+
+    oid_t alloc();
+    void release(oid_t oid);
+    OUCHOrder* get(oid_t oid);
+    OUCHOrder& operator[](oid_t oid) { return slot(index_of(oid)).order; }
+
+    // recovery: claim the slot named by a journaled oid, growing the store
+    // as needed. the free list and counters are stale until finish_restore().
+    OUCHOrder* restore(oid_t oid);
+    void finish_restore();
+
+    size_t occupancy() const  { return _occupancy; }
+    size_t high_water() const { return _high_water; }
+    size_t capacity() const   { return _chunks.size() * chunk_size; }
+
+    uint32_t store_id() const { return _store_id; }
+
+    static uint32_t index_of(oid_t oid)      { return uint32_t(oid); }
+    static uint32_t store_of(oid_t oid)      { return uint32_t(oid >> 32) & (max_stores - 1); }
+    static uint32_t generation_of(oid_t oid) { return uint32_t(oid >> 40); }
+
+  private:
+    static constexpr uint32_t generation_mask = 0x7fffff;
+    static constexpr uint32_t no_slot = UINT32_MAX;
+
+    struct Slot {
+      OUCHOrder order;
+      uint32_t generation = 0;
+      uint32_t next_free = no_slot;
+    };
+
+    Slot& slot(uint32_t index) { return _chunks[index >> chunk_bits][index & (chunk_size - 1)]; }
+    oid_t make_oid(uint32_t index, uint32_t generation) const {
+      return (oid_t(generation) << 40) | (oid_t(_store_id) << 32) | index;
+    }
+
+    uint32_t _store_id;
+    std::vector<std::unique_ptr<Slot[]>> _chunks;
+    uint32_t _free_head = no_slot;
+    uint32_t _next_index = 0;
+    size_t _occupancy = 0;
+    size_t _high_water = 0;
+  };
+}
@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ouch_simulator.h"
+#include "itch_structs.h"
+#include "itch_reader.h"
+#include "market_book.h"
+#include "symbol_directory.h"
+#include "tsc_clock.h"
+
+// microbenchmarks for the message hot path. sessions are detached, except
+// for the loopback round trip, which also counts heap allocations per
+// message, and the idle sessions, which measure memory per connection.
+// build with BUILDMODE=opt for meaningful numbers.
+
+using namespace std;
+using namespace elf;
+using namespace OUCHSim;
+
+// malloc and friends are interposed to count allocations made by the bench
+// thread while counting is on, whichever allocator interface asio or the
+// simulator goes through
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n, size_t size);
+  void* __libc_realloc(void* p, size_t size);
+  void* __libc_memalign(size_t align, size_t size);
+  void __libc_free(void* p);
+}
+
+static thread_local bool __count_allocs = false;
+static thread_local uint64_t __allocs = 0;
+
+extern "C" {
+  void* malloc(size_t size)                { __allocs += __count_allocs; return __libc_malloc(size); }
+  void* calloc(size_t n, size_t size)      { __allocs += __count_allocs; return __libc_calloc(n, size); }
+  void* realloc(void* p, size_t size)      { __allocs += __count_allocs; return __libc_realloc(p, size); }
+  void* memalign(size_t align, size_t size) { __allocs += __count_allocs; return __libc_memalign(align, size); }
+  void* aligned_alloc(size_t align, size_t size) { return memalign(align, size); }
+  int
+  posix_memalign(void** p, size_t align, size_t size) {
+    *p = memalign(align, size);
+    return *p ? 0 : ENOMEM;
+  }
+  void free(void* p)                       { __libc_free(p); }
+}
+
+const char*
+ouch_simulator_version() {
+#ifdef VERSION
+  return VERSION;
+#else
+  return "unknown";
+#endif
+}
+
+namespace {
+  struct BenchResult {
+    string name;
+    uint64_t messages;
+    uint64_t ns;
+    uint64_t ticks;
+  };
+
+  vector<BenchResult> __results;
+
+  void
+  run_bench(const string& name, uint64_t messages, const function<void()>& body) {
+    auto t0 = chrono::steady_clock::now();
+    uint64_t c0 = TSCClock::rdtsc();
+    body();
+    uint64_t c1 = TSCClock::rdtsc();
+    auto t1 = chrono::steady_clock::now();
+
+    uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count();
+    __results.push_back(BenchResult{name, messages, ns, c1 - c0});
+    printf("%-40s %12lu msgs %10.1f ns/msg %10.1f cycles/msg\n", name.c_str(), messages,
+           double(ns) / messages, double(c1 - c0) / messages);
+    fflush(stdout);
+  }
+
+  // alternating new order / full cancel on the same token keeps the book
+  // and the token index at a steady size
+  vector<char>
+  make_stream(size_t pairs, uint64_t first_token) {
+    vector<char> stream;
+    stream.reserve(pairs * (sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder)));
+
+    for(size_t i=0; i<pairs; i++) {
+      char token[15];
+      snprintf(token, sizeof(token), "B%013lu", first_token + i);
+
+      OUCH42::NewOrder order;
+      memcpy(order.token, token, sizeof(order.token));
+      bool buy = i & 1;
+      order.side = buy ? OUCH42::Constants::SideBuy : OUCH42::Constants::SideSell;
+      order.qty = 100;
+      OUCH::set_alpha_field(i % 4 ? "BNCH" : "BNCH2", order.symbol, sizeof(order.symbol));
+      order.px = buy ? 990000 - (i % 16) * 100 : 1010000 + (i % 16) * 100;
+      order.tif = 99999;
+      OUCH::set_alpha_field("BNCH", order.mpid, sizeof(order.mpid));
+      order.display = 'Y';
+      order.capacity = OUCH42::Constants::Agency;
+      order.iso = OUCH42::Constants::ISONonEligible;
+      order.cross_type = OUCH42::Constants::CrossNone;
+      order.customer_type = OUCH42::Constants::NonRetail;
+
+      OUCH42::CancelOrder cxl;
+      memcpy(cxl.token, token, sizeof(cxl.token));
+
+      const char* p = reinterpret_cast<const char*>(&order);
+      stream.insert(stream.end(), p, p + sizeof(order));
+      p = reinterpret_cast<const char*>(&cxl);
+      stream.insert(stream.end(), p, p + sizeof(cxl));
+    }
+    return stream;
+  }
+
+  uint64_t
+  count_messages(const vector<char>& stream) {
+    return stream.size() / (sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder)) * 2;
+  }
+
+  // deliver stream into the session in chunks of at most chunk bytes, one
+  // simulated read per chunk. chunk 0 delivers exactly one message per read.
+  void
+  feed(OUCHConnection& conn, const vector<char>& stream, size_t chunk) {
+    size_t pos = 0;
+    while(pos < stream.size()) {
+      size_t len = chunk ? min(chunk, stream.size() - pos)
+        : stream[pos] == OUCH42::MessageType::NewOrder ? sizeof(OUCH42::NewOrder) : sizeof(OUCH42::CancelOrder);
+      conn._recv_buffer.prepare_write(len);
+      memcpy(conn._recv_buffer.write_head(), stream.data() + pos, len);
+      conn._recv_buffer.mark_written(len);
+      conn.consume_buffer(conn._recv_buffer);
+      conn._worker->flush_pending();
+      pos += len;
+    }
+  }
+
+  void
+  bench_rwbuffer(const vector<char>& stream) {
+    const size_t pair = sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder);
+    const size_t rounds = 200;
+    RWBuffer buffer(128*1024);
+    size_t fit = buffer._len / pair * pair;
+
+    run_bench("rwbuffer try_consume_struct", rounds * (fit / pair) * 2, [&] {
+      uint64_t sum = 0;
+      for(size_t r=0; r<rounds; r++) {
+        buffer.clear();
+        memcpy(buffer.write_head(), stream.data(), fit);
+        buffer.mark_written(fit);
+        while(auto order = buffer.try_consume_struct<OUCH42::NewOrder>()) {
+          sum += order->qty;
+          auto cxl = buffer.try_consume_struct<OUCH42::CancelOrder>();
+          sum += cxl->qty;
+        }
+      }
+      if(sum == 1)
+        printf("\n");
+    });
+
+    for(size_t tail : {size_t(32), size_t(1024), size_t(16*1024)}) {
+      const size_t calls = 100000;
+      run_bench("rwbuffer try_compact tail=" + to_string(tail), calls, [&] {
+        for(size_t i=0; i<calls; i++) {
+          buffer.clear();
+          buffer.mark_written(buffer._len);
+          buffer.mark_read(buffer._len - tail);
+          buffer.try_compact();
+        }
+      });
+    }
+  }
+
+  // network sized reads into a buffer that is drained a message at a time,
+  // leaving partial messages behind; RWBuffer compacts whenever its write
+  // side reaches the end, RingBuffer never does
+  template <typename Buffer>
+  void
+  bench_stream(const string& name, const vector<char>& stream) {
+    const size_t rounds = 20;
+    Buffer buffer(128*1024);
+
+    run_bench(name, rounds * count_messages(stream), [&] {
+      uint64_t sum = 0;
+      for(size_t r=0; r<rounds; r++) {
+        for(size_t pos=0; pos<stream.size(); ) {
+          size_t len = min(network_recv_size, stream.size() - pos);
+          buffer.prepare_write(len);
+          memcpy(buffer.write_head(), stream.data() + pos, len);
+          buffer.mark_written(len);
+          pos += len;
+
+          while(buffer.read_avail()) {
+            size_t msg_len = OUCH42::inbound_message_size(*buffer.read_head());
+            if(buffer.read_avail() < msg_len)
+              break;
+            sum += buffer.read_head()[1];
+            buffer.mark_read(msg_len);
+          }
+        }
+      }
+      if(sum == 1)
+        printf("\n");
+    });
+  }
+
+  void
+  bench_connection(OUCHSimulator& sim, const vector<char>& stream) {
+    IOWorker* worker = sim.worker(0);
+    uint64_t n = count_messages(stream);
+
+    struct Case {
+      const char* name;
+      size_t chunk;
+    };
+    const Case cases[] = {
+      {"consume_buffer single messages", 0},
+      {"consume_buffer tcp fragments (13 B)", 13},
+      {"consume_buffer 64 KB bursts", 64*1024},
+    };
+
+    int id = 0;
+    for(const Case& c : cases) {
+      OUCHConnection* conn = worker->new_connection();
+      conn->start_detached("bench" + to_string(id++));
+      feed(*conn, stream, c.chunk);
+      run_bench(c.name, n, [&] { feed(*conn, stream, c.chunk); });
+    }
+  }
+
+  // a session on a real loopback socket, fed through the asio read path in
+  // writes of 64 order/cancel pairs. the second pass over the stream is
+  // timed and its heap allocations counted.
+  void
+  bench_socket(OUCHSimulator& sim, const vector<char>& stream, const string& label) {
+    using namespace boost::asio;
+    IOWorker* worker = sim.worker(0);
+    io_service& io = *worker->_ioservice;
+
+    ip::tcp::acceptor acceptor(io, ip::tcp::endpoint(ip::address_v4::loopback(), 0));
+    ip::tcp::socket client(io);
+    client.connect(acceptor.local_endpoint());
+    OUCHConnection* conn = worker->new_connection();
+    acceptor.accept(*conn->_socket);
+    conn->start();
+
+    const size_t pair = sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder);
+    const size_t reply = sizeof(OUCH42::OrderAck) + sizeof(OUCH42::OrderCanceled);
+    const size_t chunk_pairs = 64;
+    vector<char> replies(chunk_pairs * reply);
+
+    auto pass = [&] {
+      for(size_t pos=0; pos<stream.size(); pos+=chunk_pairs * pair) {
+        size_t len = min(chunk_pairs * pair, stream.size() - pos);
+        size_t expect = len / pair * reply;
+        write(client, buffer(stream.data() + pos, len));
+        while(client.available() < expect)
+          io.poll();
+        read(client, buffer(replies.data(), expect));
+      }
+    };
+
+    pass();
+    __allocs = 0;
+    run_bench(label + " (64 pair writes)", count_messages(stream), [&] {
+      __count_allocs = true;
+      pass();
+      __count_allocs = false;
+    });
+    printf("%-40s %12lu allocs %10.3f allocs/msg\n", (label + " heap").c_str(), __allocs,
+           double(__allocs) / count_messages(stream));
+  }
+
+  // the trace recorder: a record per message, as a session fed one message
+  // per read would make, then the loopback round trip with worker 0 tracing
+  void
+  bench_trace(OUCHSimulator& sim, const vector<char>& stream) {
+    const string path = "ouch_bench.trace";
+    IOWorker* worker = sim.worker(0);
+    TraceRecorder recorder(path, 0);
+    TraceRing* ring = recorder.add_ring();
+    recorder.start();
+
+    uint64_t n = count_messages(stream);
+    run_bench("trace record per message", n, [&] {
+      size_t pos = 0;
+      while(pos < stream.size()) {
+        size_t len = stream[pos] == OUCH42::MessageType::NewOrder ? sizeof(OUCH42::NewOrder) : sizeof(OUCH42::CancelOrder);
+        ring->record(TraceKind::In, 1, TSCClock::rdtsc(), stream.data() + pos, len);
+        pos += len;
+      }
+    });
+
+    worker->_trace = recorder.add_ring();
+    bench_socket(sim, stream, "traced round trip");
+    worker->_trace = nullptr;
+
+    recorder.stop();
+    printf("%-40s %12lu bytes %10lu dropped\n", "trace file", recorder.bytes(), recorder.dropped());
+    unlink(path.c_str());
+  }
+
+  size_t
+  heap_in_use() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+  }
+
+  size_t
+  resident_bytes() {
+    size_t pages = 0, resident = 0;
+    if(FILE* f = fopen("/proc/self/statm", "r")) {
+      if(fscanf(f, "%zu %zu", &pages, &resident) != 2)
+        resident = 0;
+      fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+
+  // sessions connected over loopback whose clients send nothing: heap and
+  // resident memory per session, then how many are left once the clients
+  // hang up and the worker has reclaimed them
+  void
+  bench_idle_sessions(OUCHSimulator& sim, size_t sessions) {
+    using namespace boost::asio;
+    IOWorker* worker = sim.worker(0);
+    io_service& io = *worker->_ioservice;
+
+    // two descriptors a session
+    rlimit nofile;
+    if(getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY)
+      sessions = min(sessions, size_t(nofile.rlim_cur - 64) / 2);
+
+    ip::tcp::acceptor acceptor(io, ip::tcp::endpoint(ip::address_v4::loopback(), 0));
+    ip::tcp::endpoint endpoint = acceptor.local_endpoint();
+    vector<int> clients;
+    clients.reserve(sessions);
+    // let earlier benches' sessions finish closing
+    for(int i=0; i<4; i++)
+      io.poll();
+    size_t existing = worker->_conns.size();
+
+    size_t heap0 = heap_in_use(), rss0 = resident_bytes();
+    for(size_t i=0; i<sessions; i++) {
+      int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if(fd < 0 || ::connect(fd, endpoint.data(), endpoint.size()) < 0) {
+        printf("idle sessions: connect: %s\n", strerror(errno));
+        if(fd >= 0)
+          ::close(fd);
+        break;
+      }
+      clients.push_back(fd);
+      OUCHConnection* conn = worker->new_connection();
+      acceptor.accept(*conn->_socket);
+      conn->start();
+    }
+    io.poll();
+    size_t heap1 = heap_in_use(), rss1 = resident_bytes();
+
+    size_t n = max(clients.size(), size_t(1));
+    printf("%-40s %12zu sessions %10.0f heap B/session %10.0f rss B/session\n", "idle sessions", clients.size(),
+           double(heap1 - heap0) / n, double(rss1 - rss0) / n);
+
+    for(int fd : clients)
+      ::close(fd);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while(worker->_conns.size() > existing && std::chrono::steady_clock::now() < deadline)
+      io.poll();
+    printf("%-40s %12zu sessions %10zu left %10zu slab slots\n", "idle sessions closed", clients.size(),
+           worker->_conns.size() - existing, worker->_slab.capacity());
+  }
+
+  void
+  bench_send_ack(OUCHSimulator& sim, const vector<char>& stream) {
+    OUCHConnection* conn = sim.worker(0)->new_connection();
+    conn->start_detached("bench_ack");
+    auto order = reinterpret_cast<const OUCH42::NewOrder*>(stream.data());
+
+    const uint64_t n = 2000000;
+    run_bench("send_ack serialization", n, [&] {
+      for(uint64_t i=0; i<n; i++) {
+        conn->send_ack(order, i);
+        if(conn->_send_buffer.write_avail() < sizeof(OUCH42::OrderAck))
+          conn->_send_buffer.clear();
+      }
+      conn->_worker->flush_pending();
+    });
+  }
+
+  // resting orders in a symbol the fill model fills in up to two
+  // executions, due at once: scheduling as the orders rest, then the
+  // scheduled fills fired by worker 0's timer. both count heap allocations.
+  void
+  bench_fill_model(OUCHSimulator& sim, size_t orders) {
+    IOWorker* worker = sim.worker(0);
+    OUCHConnection* conn = worker->new_connection();
+    conn->start_detached("bench_fills");
+    vector<char> stream = make_stream(orders, 700000000);
+
+    const size_t pair = sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder);
+    for(size_t i=0; i<orders; i++)
+      OUCH::set_alpha_field("FILL", reinterpret_cast<OUCH42::NewOrder*>(&stream[i * pair])->symbol, 8);
+
+    __allocs = 0;
+    run_bench("schedule model fills", orders, [&] {
+      __count_allocs = true;
+      for(size_t i=0; i<orders; i++) {
+        sim.submit_order(conn, reinterpret_cast<const OUCH42::NewOrder*>(stream.data() + i * pair));
+        if(conn->_send_buffer.write_avail() < 1024)
+          conn->_send_buffer.clear();
+      }
+      __count_allocs = false;
+      conn->_worker->flush_pending();
+    });
+    printf("%-40s %12zu pending %10.3f allocs/order\n", "scheduled", worker->_timers.size(), double(__allocs) / orders);
+
+    boost::asio::io_service& io = *worker->_ioservice;
+    uint64_t fills = worker->_model_fills;
+    __allocs = 0;
+    auto t0 = chrono::steady_clock::now();
+    __count_allocs = true;
+    while(!worker->_timers.empty())
+      io.run_one();
+    __count_allocs = false;
+    auto t1 = chrono::steady_clock::now();
+    fills = worker->_model_fills - fills;
+
+    printf("%-40s %12lu fills %10.1f ns/fill %10.3f allocs/fill\n", "model fills fired", fills,
+           double(chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count()) / fills, double(__allocs) / fills);
+  }
+
+  // the wheel on its own, with timers spread far enough out to reach every
+  // level: scheduling, canceling half, and turning the wheel through to
+  // fire the rest. the second round runs on the first's nodes. timers that
+  // fire at any tick but their own are counted as misfired.
+  void
+  bench_timing_wheel(size_t timers) {
+    TimingWheel<uint64_t> wheel;
+    vector<TimingWheel<uint64_t>::Handle> handles(timers);
+    vector<uint64_t> due(timers);
+    const uint64_t span = uint64_t(1) << 26;
+    std::mt19937_64 rng(1);
+    for(uint64_t& d : due)
+      d = 1 + rng() % span;
+
+    for(int round=0; round<2; round++) {
+      uint64_t base = wheel.now();
+      __allocs = 0;
+      run_bench(round ? "timing wheel schedule (reused)" : "timing wheel schedule", timers, [&] {
+        __count_allocs = true;
+        for(size_t i=0; i<timers; i++)
+          handles[i] = wheel.schedule(base + due[i], i);
+        __count_allocs = false;
+      });
+      uint64_t schedule_allocs = __allocs;
+
+      run_bench("timing wheel cancel", timers / 2, [&] {
+        for(size_t i=0; i<timers; i+=2)
+          wheel.cancel(handles[i]);
+      });
+
+      size_t fired = 0, misfired = 0;
+      run_bench("timing wheel expire", timers - timers / 2, [&] {
+        fired = wheel.advance(base + span, [&](uint64_t i) { misfired += wheel.now() != base + due[i]; });
+      });
+      printf("%-40s %12zu fired %10zu misfired %10.3f allocs/timer\n", "timing wheel", fired, misfired,
+             double(schedule_allocs) / timers);
+    }
+  }
+
+  // resting orders replaced with fewer shares at the same price, which is
+  // done in place, then replaced at a new price, which enters them again
+  void
+  bench_replace(OUCHSimulator& sim, size_t orders) {
+    OUCHConnection* conn = sim.worker(0)->new_connection();
+    conn->start_detached("bench_replace");
+    vector<char> stream = make_stream(orders, 700000000);
+
+    const size_t pair = sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder);
+    for(size_t i=0; i<orders; i++) {
+      sim.submit_order(conn, reinterpret_cast<const OUCH42::NewOrder*>(stream.data() + i * pair));
+      if(conn->_send_buffer.write_avail() < 1024)
+        conn->_send_buffer.clear();
+    }
+    conn->_worker->flush_pending();
+
+    vector<OUCH42::ReplaceOrder> reduce(orders), reprice(orders);
+    for(size_t i=0; i<orders; i++) {
+      auto order = reinterpret_cast<const OUCH42::NewOrder*>(stream.data() + i * pair);
+      bool buy = order->side == OUCH42::Constants::SideBuy;
+      for(auto* replace : {&reduce[i], &reprice[i]}) {
+        replace->qty = 90;
+        replace->px = order->px;
+        replace->tif = order->tif;
+        replace->display = order->display;
+        replace->iso = order->iso;
+      }
+      char token[24];
+      memcpy(reduce[i].existing_token, order->token, sizeof(order->token));
+      snprintf(token, sizeof(token), "P%013lu", i);
+      memcpy(reduce[i].token, token, sizeof(reduce[i].token));
+      memcpy(reprice[i].existing_token, token, sizeof(reprice[i].existing_token));
+      snprintf(token, sizeof(token), "Q%013lu", i);
+      memcpy(reprice[i].token, token, sizeof(reprice[i].token));
+      reprice[i].px = buy ? order->px - 100 : order->px + 100;
+    }
+
+    for(auto* round : {&reduce, &reprice}) {
+      __allocs = 0;
+      run_bench(round == &reduce ? "replace_order (in place)" : "replace_order (new price)", orders, [&] {
+        __count_allocs = true;
+        for(const OUCH42::ReplaceOrder& replace : *round) {
+          conn->handle_replace(&replace);
+          if(conn->_send_buffer.write_avail() < 1024)
+            conn->_send_buffer.clear();
+        }
+        __count_allocs = false;
+        conn->_worker->flush_pending();
+      });
+      printf("%-40s %12zu tokens %10.3f allocs/replace\n", "replace", conn->_tokens.size(), double(__allocs) / orders);
+    }
+  }
+
+  // resting orders with a time in force of a second: scheduling their
+  // expiry as they rest, then all of them canceled by worker 0 in one batch
+  void
+  bench_expiry(OUCHSimulator& sim, size_t orders) {
+    IOWorker* worker = sim.worker(0);
+    OUCHConnection* conn = worker->new_connection();
+    conn->start_detached("bench_expiry");
+    vector<char> stream = make_stream(orders, 800000000);
+
+    const size_t pair = sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder);
+    for(size_t i=0; i<orders; i++)
+      reinterpret_cast<OUCH42::NewOrder*>(&stream[i * pair])->tif = 1;
+
+    __allocs = 0;
+    run_bench("submit_order (expiring)", orders, [&] {
+      __count_allocs = true;
+      for(size_t i=0; i<orders; i++) {
+        sim.submit_order(conn, reinterpret_cast<const OUCH42::NewOrder*>(stream.data() + i * pair));
+        if(conn->_send_buffer.write_avail() < 1024)
+          conn->_send_buffer.clear();
+      }
+      __count_allocs = false;
+      conn->_worker->flush_pending();
+    });
+    printf("%-40s %12zu pending %10.3f allocs/order\n", "expiry scheduled", worker->_timers.size(), double(__allocs) / orders);
+
+    this_thread::sleep_for(chrono::milliseconds(1100));
+    uint64_t expired = worker->_expired;
+    __allocs = 0;
+    run_bench("orders expired", orders, [&] {
+      __count_allocs = true;
+      worker->run_timers();
+      __count_allocs = false;
+    });
+    printf("%-40s %12lu expired %10.3f allocs/order\n", "expiry", worker->_expired - expired, double(__allocs) / orders);
+  }
+
+  template <typename T>
+  T*
+  append_itch(vector<char>& feed, uint16_t locate, uint64_t ns) {
+    size_t at = feed.size();
+    feed.resize(at + 2 + sizeof(T));
+    feed[at] = 0;
+    feed[at + 1] = char(sizeof(T));
+    T* msg = new (&feed[at + 2]) T();
+    msg->header.type = T::msg_type;
+    msg->header.locate = locate;
+    msg->header.tracking = 0;
+    for(int i=0; i<6; i++)
+      msg->header.timestamp[i] = uint8_t(ns >> (40 - 8 * i));
+    return msg;
+  }
+
+  // a day of TotalView-ITCH in miniature: a directory of stocks, then
+  // adds, deletes, replaces, executions and partial cancels in roughly a
+  // real feed's proportions, within 50 ticks of each stock's price, holding
+  // some 200k orders open
+  vector<char>
+  make_itch(size_t messages, uint16_t stocks) {
+    struct Live {
+      uint64_t ref;
+      uint16_t locate;
+      uint32_t shares;
+    };
+
+    vector<char> feed;
+    feed.reserve(messages * 40 + stocks * 41);
+    std::mt19937_64 rng(7);
+    uint64_t ns = 4 * 3600 * 1000000000ULL;
+    for(uint16_t locate=1; locate<=stocks; locate++) {
+      auto dir = append_itch<ITCH50::StockDirectory>(feed, locate, ns);
+      char stock[9];
+      snprintf(stock, sizeof(stock), "S%-7u", unsigned(locate));
+      memcpy(dir->stock, stock, sizeof(dir->stock));
+    }
+
+    vector<Live> live;
+    uint64_t next_ref = 1;
+    for(size_t n=0; n<messages; n++) {
+      ns += rng() % 2000;
+      unsigned pick = rng() % 100;
+      if(live.empty() || pick < (live.size() < 200000 ? 55u : 40u)) {
+        uint16_t locate = 1 + rng() % stocks;
+        bool buy = rng() & 1;
+        uint32_t px = 1000000 + locate * 100 + (buy ? -1 : 1) * int(1 + rng() % 50) * 100;
+        auto add = append_itch<ITCH50::AddOrder>(feed, locate, ns);
+        add->ref = next_ref;
+        add->side = buy ? 'B' : 'S';
+        add->shares = 100 * (1 + rng() % 5);
+        memset(add->stock, ' ', sizeof(add->stock));
+        add->px = px;
+        live.push_back(Live{next_ref++, locate, add->shares});
+        continue;
+      }
+
+      size_t i = rng() % live.size();
+      Live& order = live[i];
+      pick = rng() % 100;
+      if(pick < 70) {
+        append_itch<ITCH50::OrderDelete>(feed, order.locate, ns)->ref = order.ref;
+        order.shares = 0;
+      } else if(pick < 85) {
+        auto replace = append_itch<ITCH50::OrderReplace>(feed, order.locate, ns);
+        replace->ref = order.ref;
+        replace->new_ref = next_ref;
+        replace->shares = order.shares;
+        replace->px = 1000000 + order.locate * 100 + int(rng() % 101 - 50) * 100;
+        order.ref = next_ref++;
+      } else {
+        uint32_t shares = std::min<uint32_t>(order.shares, 100);
+        if(pick < 95) {
+          auto exec = append_itch<ITCH50::OrderExecuted>(feed, order.locate, ns);
+          exec->ref = order.ref;
+          exec->shares = shares;
+          exec->match = n;
+        } else {
+          auto cxl = append_itch<ITCH50::OrderCancel>(feed, order.locate, ns);
+          cxl->ref = order.ref;
+          cxl->shares = shares;
+        }
+        order.shares -= shares;
+      }
+      if(!order.shares) {
+        order = live.back();
+        live.pop_back();
+      }
+    }
+    return feed;
+  }
+
+  // book building from the feed in memory, then the same feed replayed
+  // from a plain and a gzip file through ItchReader
+  void
+  bench_itch(size_t messages) {
+    const uint16_t stocks = 1000;
+    vector<char> feed = make_itch(messages, stocks);
+    size_t count = messages + stocks;
+
+    {
+      ItchBooks books;
+      run_bench("itch book build", count, [&] {
+        for(size_t at=0; at<feed.size(); ) {
+          size_t len = uint8_t(feed[at]) << 8 | uint8_t(feed[at + 1]);
+          books.apply(&feed[at + 2], len);
+          at += 2 + len;
+        }
+      });
+      printf("%-40s %12zu orders %10lu unknown refs\n", "itch books", books.orders(), books.unknown_refs());
+    }
+
+    const string plain = "ouch_bench.itch";
+    const string compressed = "ouch_bench.itch.gz";
+    if(FILE* f = fopen(plain.c_str(), "w")) {
+      fwrite(feed.data(), 1, feed.size(), f);
+      fclose(f);
+    }
+    if(gzFile gz = gzopen(compressed.c_str(), "wb")) {
+      gzwrite(gz, feed.data(), feed.size());
+      gzclose(gz);
+    }
+
+    for(const string& path : {plain, compressed}) {
+      ItchReader reader(path);
+      ItchBooks books;
+      run_bench(reader.compressed() ? "itch replay (gzip file)" : "itch replay (plain file)", count, [&] {
+        reader.read([&](const char* msg, size_t len) {
+          books.apply(msg, len);
+          return true;
+        });
+      });
+      printf("%-40s %12lu msgs %10zu file bytes\n", "itch file", reader.messages(), reader.file_bytes());
+      unlink(path.c_str());
+    }
+  }
+
+  // symbol to id through the directory's perfect hash and through an
+  // unordered_map, for a listed symbol picked at random
+  void
+  bench_symbols(size_t lookups) {
+    const size_t count = 8000;
+    string list;
+    for(size_t i=0; i<count; i++)
+      list += "S" + to_string(i) + "\n";
+
+    SymbolDirectory directory;
+    istringstream in(list);
+    run_bench("symbol directory build", count, [&] { directory.parse(in, "bench"); });
+
+    unordered_map<uint64_t, uint32_t> map;
+    for(uint32_t id=0; id<count; id++) {
+      uint64_t key;
+      memcpy(&key, directory.symbol(id), sizeof(key));
+      map.emplace(key, id);
+    }
+
+    std::mt19937_64 rng(1);
+    vector<const char*> symbols(lookups);
+    for(const char*& symbol : symbols)
+      symbol = directory.symbol(rng() % count);
+
+    uint64_t sum = 0;
+    run_bench("symbol directory find", lookups, [&] {
+      for(const char* symbol : symbols)
+        sum += directory.find(symbol);
+    });
+    run_bench("symbol unordered_map find", lookups, [&] {
+      for(const char* symbol : symbols) {
+        uint64_t key;
+        memcpy(&key, symbol, sizeof(key));
+        sum += map.find(key)->second;
+      }
+    });
+    printf("%-40s %12zu symbols %10zu slots %10lu sum\n", "symbol directory", directory.size(), directory.table_size(), sum);
+  }
+
+  void
+  bench_submit(OUCHSimulator& sim, size_t orders) {
+    OUCHConnection* conn = sim.worker(0)->new_connection();
+    conn->start_detached("bench_submit");
+    vector<char> stream = make_stream(orders, 900000000);
+
+    const size_t pair = sizeof(OUCH42::NewOrder) + sizeof(OUCH42::CancelOrder);
+    run_bench("submit_order (resting, no cross)", orders, [&] {
+      for(size_t i=0; i<orders; i++) {
+        auto order = reinterpret_cast<const OUCH42::NewOrder*>(stream.data() + i * pair);
+        sim.submit_order(conn, order);
+        if(conn->_send_buffer.write_avail() < 1024)
+          conn->_send_buffer.clear();
+      }
+      conn->_worker->flush_pending();
+    });
+  }
+}
+
+int
+main(int argc, char** argv) {
+  size_t pairs = argc > 1 ? stoul(argv[1]) : 500000;
+
+  // orders in FILL are filled by the model in one or two executions
+  const string fill_model = "ouch_bench.fills";
+  if(FILE* f = fopen(fill_model.c_str(), "w")) {
+    fprintf(f, "FILL fill_prob=1 partial_prob=0.5 max_fills=2 lot=10\n");
+    fclose(f);
+  }
+
+  SimulatorConfig config;
+  config.port = 0;
+  config.stats_interval = 0;
+  config.fill_model = fill_model;
+
+  OUCHSimulator sim;
+  sim.init(config);
+  sim.worker(0)->enter();
+  unlink(fill_model.c_str());
+
+  vector<char> stream = make_stream(pairs, 0);
+  printf("stream pairs=%zu bytes=%zu\n", pairs, stream.size());
+
+  bench_rwbuffer(stream);
+  bench_stream<RWBuffer>("rwbuffer 1500 B reads", stream);
+  bench_stream<RingBuffer>("ringbuffer 1500 B reads", stream);
+  bench_connection(sim, stream);
+  bench_socket(sim, stream, "loopback round trip");
+  bench_trace(sim, stream);
+  bench_idle_sessions(sim, 5000);
+  bench_send_ack(sim, stream);
+  bench_submit(sim, pairs);
+  bench_fill_model(sim, pairs);
+  bench_timing_wheel(2 * pairs);
+  bench_expiry(sim, pairs);
+  bench_replace(sim, pairs);
+  bench_itch(20 * pairs);
+  bench_symbols(4 * pairs);
+
+  sim.shutdown();
+  elf::tsc_clock().stop();
+  return 0;
+}
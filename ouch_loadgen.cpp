@@ -0,0 +1,786 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <args.hxx>
+
+#include "rwbuffer.h"
+#include "ouch_structs.h"
+#include "soupbin_structs.h"
+#include "tsc_clock.h"
+#include "latency_histogram.h"
+#include "session_capture.h"
+#include "token_index.h"
+
+using namespace std;
+using namespace elf;
+using OUCHSim::TokenIndex;
+
+static atomic<bool> __running(true);
+
+const char*
+ouch_loadgen_version() {
+#ifdef VERSION
+  return VERSION;
+#else
+  return "unknown";
+#endif
+}
+
+namespace OUCHLoadGen {
+  struct LoadGenConfig {
+    string host = "127.0.0.1";
+    int port = 4722;
+    int sessions = 1;
+    double rate = 10000;
+    int duration = 10;
+    double cancel_ratio = 0.5;
+    int symbols = 100;
+    bool crossing = false;
+    uint32_t qty = 100;
+    uint64_t seed = 1;
+    // sessions log in as LG<n> and frame messages as SoupBinTCP packets
+    bool soupbin = false;
+
+    // replay: one capture per session, speed 0 sends as fast as possible
+    vector<string> replay;
+    double speed = 1.0;
+    string record;
+  };
+
+  // send times are kept in a ring per session indexed by order sequence
+  // number, sized for the orders the session sends in the test up to
+  // max_ring; a response older than the ring is not measured
+  static constexpr size_t min_ring = 1024;
+  static constexpr size_t max_ring = size_t(1) << 20;
+
+  struct Session {
+    int fd = -1;
+    int id = 0;
+    RWBuffer recv_buffer;
+    RWBuffer send_buffer;
+    uint64_t next_seq = 0;
+    size_t ring_mask = 0;
+    vector<uint64_t> order_sent;
+    vector<uint64_t> cancel_sent;
+    vector<uint64_t> live;
+
+    // replay sessions map the captured tokens to sequence numbers
+    TokenIndex tokens;
+    CaptureBlock* block = nullptr;
+    bool replay_done = false;
+    unique_ptr<CaptureWriter> capture;
+  };
+
+  struct Counters {
+    uint64_t orders = 0;
+    uint64_t cancels = 0;
+    uint64_t acks = 0;
+    uint64_t canceled = 0;
+    uint64_t executions = 0;
+    uint64_t rejects = 0;
+    uint64_t other = 0;
+    uint64_t other_sent = 0;
+    uint64_t stalls = 0;
+  };
+
+  class LoadGen {
+  public:
+    void init(const LoadGenConfig& config);
+    void run();
+    void run_replay();
+    void report(double secs) const;
+
+  private:
+    void connect_session(Session& s);
+    void login(Session& s);
+    void heartbeat();
+    template <typename T> T* produce(Session& s);
+    char* produce_bytes(Session& s, size_t len);
+    void send_one(uint64_t intended);
+    void send_order(Session& s, uint64_t intended);
+    void send_cancel(Session& s, uint64_t intended);
+    void replay_session(Session& s, uint64_t now, uint64_t start, uint64_t base, double scale);
+    void send_record(Session& s, const CaptureRecord& rec, uint64_t intended);
+    bool response_seq(Session& s, const char* token, uint64_t& seq);
+    void flush(Session& s);
+    void read_session(Session& s);
+    void consume(Session& s, uint64_t now);
+    size_t handle_response(Session& s, const char* msg, size_t avail, uint64_t now);
+    void poll_sessions(int timeout_ms);
+    void make_token(char* token, const Session& s, uint64_t seq) const;
+    static uint64_t token_seq(const char* token);
+    void progress(double secs, const Counters& last) const;
+
+    LoadGenConfig _config;
+    vector<Session> _sessions;
+    vector<string> _symbols;
+    size_t _next_session = 0;
+    int _epfd = -1;
+    mt19937_64 _rng;
+    Counters _counters;
+    LatencyHistogram _ack_rtt;
+    LatencyHistogram _cancel_rtt;
+    CapturePipeline _pipeline;
+  };
+}
+
+using namespace OUCHLoadGen;
+
+void
+LoadGen::init(const LoadGenConfig& config) {
+  _config = config;
+  _rng.seed(config.seed);
+
+  for(int i=0; i<config.symbols; i++) {
+    char sym[16];
+    snprintf(sym, sizeof(sym), "LG%04d", i);
+    _symbols.push_back(sym);
+  }
+
+  _epfd = epoll_create1(0);
+  if(_epfd < 0)
+    throw runtime_error(string("epoll_create1: ") + strerror(errno));
+
+  if(!config.replay.empty())
+    _config.sessions = config.replay.size();
+
+  // a replay's length isn't known up front
+  size_t ring = max_ring;
+  if(config.replay.empty()) {
+    double per_session = _config.rate * max(_config.duration, 0) / _config.sessions;
+    ring = min_ring;
+    while(ring < per_session && ring < max_ring)
+      ring <<= 1;
+  }
+
+  _sessions.resize(_config.sessions);
+  for(int i=0; i<_config.sessions; i++) {
+    Session& s = _sessions[i];
+    s.id = i;
+    s.recv_buffer.init(256*1024);
+    s.send_buffer.init(256*1024);
+    s.ring_mask = ring - 1;
+    s.order_sent.resize(ring);
+    s.cancel_sent.resize(ring);
+    if(!config.record.empty())
+      s.capture.reset(new CaptureWriter(config.record + "." + to_string(i) + ".gz"));
+    connect_session(s);
+  }
+
+  if(!config.replay.empty())
+    _pipeline.start(config.replay);
+}
+
+void
+LoadGen::connect_session(Session& s) {
+  struct addrinfo hints, *res = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  int rc = getaddrinfo(_config.host.c_str(), to_string(_config.port).c_str(), &hints, &res);
+  if(rc)
+    throw runtime_error(string("getaddrinfo: ") + gai_strerror(rc));
+
+  s.fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if(s.fd < 0 || connect(s.fd, res->ai_addr, res->ai_addrlen) < 0) {
+    freeaddrinfo(res);
+    throw runtime_error(string("connect: ") + strerror(errno));
+  }
+  freeaddrinfo(res);
+
+  int one = 1;
+  setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if(_config.soupbin)
+    login(s);
+  fcntl(s.fd, F_SETFL, fcntl(s.fd, F_GETFL) | O_NONBLOCK);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &s;
+  epoll_ctl(_epfd, EPOLL_CTL_ADD, s.fd, &ev);
+}
+
+// blocking login before the socket goes non-blocking; no replay is asked for
+void
+LoadGen::login(Session& s) {
+  char username[16];
+  snprintf(username, sizeof(username), "LG%04d", s.id % 10000);
+
+  SoupBin::LoginRequest req;
+  OUCH::set_alpha_field(username, req.username, sizeof(req.username));
+  OUCH::set_alpha_field("", req.password, sizeof(req.password));
+  OUCH::set_alpha_field("", req.session, sizeof(req.session));
+  SoupBin::set_numeric_field(0, req.sequence, sizeof(req.sequence));
+  if(::send(s.fd, &req, sizeof(req), MSG_NOSIGNAL) != ssize_t(sizeof(req)))
+    throw runtime_error(string("login send: ") + strerror(errno));
+
+  SoupBin::Header header;
+  if(::recv(s.fd, &header, sizeof(header), MSG_WAITALL) != ssize_t(sizeof(header)))
+    throw runtime_error("session " + to_string(s.id) + " closed during login");
+
+  char payload[64];
+  size_t len = header.len - 1;
+  if(len > sizeof(payload) || (len && ::recv(s.fd, payload, len, MSG_WAITALL) != ssize_t(len)))
+    throw runtime_error("session " + to_string(s.id) + " bad login response");
+  if(header.type != SoupBin::PacketType::LoginAccepted)
+    throw runtime_error("session " + to_string(s.id) + " login rejected: " + string(payload, len));
+}
+
+// clients heartbeat once a second regardless of traffic
+void
+LoadGen::heartbeat() {
+  if(!_config.soupbin)
+    return;
+
+  for(Session& s : _sessions) {
+    SoupBin::set_header(produce_bytes(s, sizeof(SoupBin::Header)), SoupBin::PacketType::ClientHeartbeat, 0);
+    flush(s);
+  }
+}
+
+// token is session (3 digits) followed by the order sequence (11 digits)
+void
+LoadGen::make_token(char* token, const Session& s, uint64_t seq) const {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%03d%011llu", s.id % 1000, (unsigned long long)(seq % 100000000000ULL));
+  memcpy(token, buf, 14);
+}
+
+uint64_t
+LoadGen::token_seq(const char* token) {
+  uint64_t seq = 0;
+  for(int i=3; i<14; i++)
+    seq = seq * 10 + (token[i] - '0');
+  return seq;
+}
+
+// keep reading while waiting for send space: the simulator may itself be
+// blocked writing responses to us
+template <typename T>
+T*
+LoadGen::produce(Session& s) {
+  size_t framing = _config.soupbin ? sizeof(SoupBin::Header) : 0;
+  char* p = produce_bytes(s, framing + sizeof(T));
+  if(framing)
+    SoupBin::set_header(p, SoupBin::PacketType::UnsequencedData, sizeof(T));
+  return new (p + framing) T();
+}
+
+char*
+LoadGen::produce_bytes(Session& s, size_t len) {
+  while(!s.send_buffer.prepare_write(len)) {
+    flush(s);
+    read_session(s);
+  }
+  char* p = s.send_buffer.write_head();
+  s.send_buffer.mark_written(len);
+  return p;
+}
+
+void
+LoadGen::send_order(Session& s, uint64_t intended) {
+  auto order = produce<OUCH42::NewOrder>(s);
+  uint64_t seq = s.next_seq++;
+  make_token(order->token, s, seq);
+
+  bool buy = _rng() & 1;
+  uint32_t ticks = 1 + _rng() % 10;
+  const uint32_t mid = 1000000;
+  order->side = buy ? OUCH42::Constants::SideBuy : OUCH42::Constants::SideSell;
+  if(_config.crossing)
+    order->px = mid - 1000 + (_rng() % 21) * 100;
+  else
+    order->px = buy ? mid - ticks * 100 : mid + ticks * 100;
+  order->qty = _config.qty;
+  OUCH::set_alpha_field(_symbols[_rng() % _symbols.size()], order->symbol, sizeof(order->symbol));
+  order->tif = 99999;
+  OUCH::set_alpha_field("LOAD", order->mpid, sizeof(order->mpid));
+  order->display = 'Y';
+  order->capacity = OUCH42::Constants::Agency;
+  order->iso = OUCH42::Constants::ISONonEligible;
+  order->cross_type = OUCH42::Constants::CrossNone;
+  order->customer_type = OUCH42::Constants::NonRetail;
+  if(s.capture)
+    s.capture->write(tsc_clock().nanos_since_midnight(), reinterpret_cast<const char*>(order), sizeof(*order));
+
+  s.order_sent[seq & s.ring_mask] = intended;
+  _counters.orders++;
+}
+
+void
+LoadGen::send_cancel(Session& s, uint64_t intended) {
+  size_t i = _rng() % s.live.size();
+  uint64_t seq = s.live[i];
+  s.live[i] = s.live.back();
+  s.live.pop_back();
+
+  auto cxl = produce<OUCH42::CancelOrder>(s);
+  make_token(cxl->token, s, seq);
+  cxl->qty = 0;
+  if(s.capture)
+    s.capture->write(tsc_clock().nanos_since_midnight(), reinterpret_cast<const char*>(cxl), sizeof(*cxl));
+
+  s.cancel_sent[seq & s.ring_mask] = intended;
+  _counters.cancels++;
+}
+
+// captured messages go out verbatim; orders and cancels are also noted
+// against their token so the responses can be timed, and a replacement
+// token against the order it replaces
+void
+LoadGen::send_record(Session& s, const CaptureRecord& rec, uint64_t intended) {
+  size_t framing = _config.soupbin ? sizeof(SoupBin::Header) : 0;
+  char* p = produce_bytes(s, framing + rec.len);
+  if(framing)
+    SoupBin::set_header(p, SoupBin::PacketType::UnsequencedData, rec.len);
+  memcpy(p + framing, rec.data, rec.len);
+  if(s.capture)
+    s.capture->write(rec.timestamp, rec.data, rec.len);
+
+  if(rec.data[0] == OUCH42::MessageType::NewOrder && rec.len >= sizeof(OUCH42::NewOrder)) {
+    auto order = reinterpret_cast<const OUCH42::NewOrder*>(rec.data);
+    uint64_t seq = s.next_seq++;
+    s.tokens.insert(order->token, seq);
+    s.order_sent[seq & s.ring_mask] = intended;
+    _counters.orders++;
+  } else if(rec.data[0] == OUCH42::MessageType::CancelOrder && rec.len >= sizeof(OUCH42::CancelOrder)) {
+    auto cxl = reinterpret_cast<const OUCH42::CancelOrder*>(rec.data);
+    OUCHSim::oid_t seq = s.tokens.find(cxl->token);
+    if(seq != OUCHSim::INVALID_OID)
+      s.cancel_sent[seq & s.ring_mask] = intended;
+    _counters.cancels++;
+  } else if(rec.data[0] == OUCH42::MessageType::ReplaceOrder && rec.len >= sizeof(OUCH42::ReplaceOrder)) {
+    auto replace = reinterpret_cast<const OUCH42::ReplaceOrder*>(rec.data);
+    OUCHSim::oid_t seq = s.tokens.find(replace->existing_token);
+    if(seq != OUCHSim::INVALID_OID)
+      s.tokens.insert(replace->token, seq);
+    _counters.other_sent++;
+  } else {
+    _counters.other_sent++;
+  }
+}
+
+// send every record that is due. a capture's timestamps are mapped onto the
+// tsc relative to the earliest record across all sessions and scaled by the
+// replay speed; with no scale records are due as soon as they are decoded.
+void
+LoadGen::replay_session(Session& s, uint64_t now, uint64_t start, uint64_t base, double scale) {
+  CaptureRecord rec;
+  for(int batch=0; batch < 4096; batch++) {
+    if(!s.block || !s.block->peek(rec)) {
+      if(s.block)
+        _pipeline.release(s.block);
+      s.block = _pipeline.try_pop(s.id);
+      if(!s.block) {
+        if(_pipeline.done(s.id))
+          s.replay_done = true;
+        else
+          _counters.stalls++;
+        return;
+      }
+      continue;
+    }
+
+    uint64_t intended = now;
+    if(scale) {
+      intended = start + uint64_t((rec.timestamp > base ? rec.timestamp - base : 0) * scale);
+      if(intended > now)
+        return;
+    }
+
+    if(rec.len)
+      send_record(s, rec, intended);
+    s.block->next(rec);
+  }
+}
+
+void
+LoadGen::send_one(uint64_t intended) {
+  Session& s = _sessions[_next_session++ % _sessions.size()];
+  bool cancel = !s.live.empty() && uniform_real_distribution<double>(0, 1)(_rng) < _config.cancel_ratio;
+  if(cancel)
+    send_cancel(s, intended);
+  else
+    send_order(s, intended);
+}
+
+void
+LoadGen::flush(Session& s) {
+  while(s.send_buffer.read_avail()) {
+    ssize_t n = ::send(s.fd, s.send_buffer.read_head(), s.send_buffer.read_avail(), MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      throw runtime_error(string("send: ") + strerror(errno));
+    }
+    s.send_buffer.mark_read(n);
+  }
+  s.send_buffer.clear();
+}
+
+void
+LoadGen::read_session(Session& s) {
+  while(true) {
+    if(!s.recv_buffer.prepare_write(network_recv_size))
+      throw runtime_error("recv buffer overflow");
+
+    ssize_t n = ::recv(s.fd, s.recv_buffer.write_head(), s.recv_buffer.write_avail(), 0);
+    if(n < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      throw runtime_error(string("recv: ") + strerror(errno));
+    }
+    if(n == 0)
+      throw runtime_error("session " + to_string(s.id) + " disconnected");
+
+    s.recv_buffer.mark_written(n);
+    consume(s, TSCClock::rdtsc());
+  }
+}
+
+bool
+LoadGen::response_seq(Session& s, const char* token, uint64_t& seq) {
+  if(_config.replay.empty()) {
+    seq = token_seq(token);
+    return true;
+  }
+
+  OUCHSim::oid_t oid = s.tokens.find(token);
+  seq = oid;
+  return oid != OUCHSim::INVALID_OID;
+}
+
+void
+LoadGen::consume(Session& s, uint64_t now) {
+  RWBuffer& buffer = s.recv_buffer;
+  if(!_config.soupbin) {
+    while(buffer.read_avail()) {
+      size_t len = handle_response(s, buffer.read_head(), buffer.read_avail(), now);
+      if(!len)
+        break;
+      buffer.mark_read(len);
+    }
+    return;
+  }
+
+  while(buffer.read_avail() >= sizeof(SoupBin::Header)) {
+    auto header = reinterpret_cast<const SoupBin::Header*>(buffer.read_head());
+    size_t len = header->len;
+    if(buffer.read_avail() < sizeof(header->len) + len)
+      break;
+
+    if(header->type == SoupBin::PacketType::SequencedData && len > 1)
+      handle_response(s, buffer.read_head() + sizeof(SoupBin::Header), len - 1, now);
+    else if(header->type == SoupBin::PacketType::EndOfSession)
+      throw runtime_error("session " + to_string(s.id) + " ended by the server");
+
+    buffer.mark_read(sizeof(header->len) + len);
+  }
+}
+
+// returns the message length, 0 if avail is short of a whole message
+size_t
+LoadGen::handle_response(Session& s, const char* msg, size_t avail, uint64_t now) {
+  char msgtype = *msg;
+  size_t len = OUCH42::message_size(msgtype);
+  if(!len)
+    throw runtime_error(string("unknown message type ") + msgtype);
+  if(avail < len)
+    return 0;
+
+  switch(msgtype) {
+  case OUCH42::MessageType::OrderAck:
+    {
+      auto ack = reinterpret_cast<const OUCH42::OrderAck*>(msg);
+      uint64_t seq;
+      if(response_seq(s, ack->token, seq)) {
+        _ack_rtt.record(now - s.order_sent[seq & s.ring_mask]);
+        if(_config.replay.empty())
+          s.live.push_back(seq);
+      }
+      _counters.acks++;
+      break;
+    }
+
+  case OUCH42::MessageType::OrderCanceled:
+    {
+      auto cxl = reinterpret_cast<const OUCH42::OrderCanceled*>(msg);
+      uint64_t seq;
+      if(response_seq(s, cxl->token, seq) && cxl->reason == OUCH42::CancelReason::UserRequested)
+        _cancel_rtt.record(now - s.cancel_sent[seq & s.ring_mask]);
+      _counters.canceled++;
+      break;
+    }
+
+  case OUCH42::MessageType::OrderExecuted:
+    _counters.executions++;
+    break;
+
+  case OUCH42::MessageType::OrderRejected:
+    _counters.rejects++;
+    break;
+
+  default:
+    _counters.other++;
+    break;
+  }
+
+  return len;
+}
+
+void
+LoadGen::poll_sessions(int timeout_ms) {
+  struct epoll_event events[64];
+  int n = epoll_wait(_epfd, events, 64, timeout_ms);
+  for(int i=0; i<n; i++)
+    read_session(*reinterpret_cast<Session*>(events[i].data.ptr));
+}
+
+void
+LoadGen::progress(double secs, const Counters& last) const {
+  printf("%8.1fs orders=%lu cancels=%lu acks=%lu canceled=%lu execs=%lu rejects=%lu msgs/s=%lu\n", secs,
+         _counters.orders - last.orders, _counters.cancels - last.cancels,
+         _counters.acks - last.acks, _counters.canceled - last.canceled,
+         _counters.executions - last.executions, _counters.rejects - last.rejects,
+         (_counters.orders + _counters.cancels) - (last.orders + last.cancels));
+  fflush(stdout);
+}
+
+// open loop: messages are scheduled at fixed intervals regardless of
+// responses, and rtt is measured from the scheduled time so that falling
+// behind shows up in the latency rather than being hidden by it
+void
+LoadGen::run() {
+  if(!_config.replay.empty()) {
+    run_replay();
+    return;
+  }
+
+  TSCClock& clock = tsc_clock();
+  double ticks_per_ns = 1.0 / clock.ns_per_tick();
+  uint64_t interval = uint64_t(1e9 / _config.rate * ticks_per_ns);
+  uint64_t second = uint64_t(1e9 * ticks_per_ns);
+  if(!interval)
+    interval = 1;
+
+  uint64_t start = TSCClock::rdtsc();
+  uint64_t end = start + _config.duration * second;
+  uint64_t next = start;
+  uint64_t next_report = start + second;
+  Counters last;
+
+  while(__running) {
+    uint64_t now = TSCClock::rdtsc();
+    if(now >= end)
+      break;
+
+    for(int batch=0; next <= now && batch < 4096; batch++) {
+      send_one(next);
+      next += interval;
+    }
+
+    for(Session& s : _sessions) {
+      if(s.send_buffer.read_avail())
+        flush(s);
+    }
+
+    poll_sessions(0);
+
+    if(now >= next_report) {
+      progress(double(now - start) / second, last);
+      last = _counters;
+      next_report += second;
+      heartbeat();
+    }
+  }
+
+  double secs = double(TSCClock::rdtsc() - start) / second;
+
+  // collect stragglers
+  uint64_t drain_end = TSCClock::rdtsc() + second;
+  while(__running && TSCClock::rdtsc() < drain_end)
+    poll_sessions(10);
+
+  report(secs);
+}
+
+void
+LoadGen::run_replay() {
+  TSCClock& clock = tsc_clock();
+  double ticks_per_ns = 1.0 / clock.ns_per_tick();
+  uint64_t second = uint64_t(1e9 * ticks_per_ns);
+  double scale = _config.speed > 0 ? ticks_per_ns / _config.speed : 0;
+
+  // captures share a clock, so every session is paced from the earliest
+  // record in any of them
+  uint64_t base = UINT64_MAX;
+  for(Session& s : _sessions) {
+    CaptureRecord rec;
+    s.block = _pipeline.wait_pop(s.id);
+    if(s.block && s.block->peek(rec))
+      base = min(base, rec.timestamp);
+  }
+
+  uint64_t start = TSCClock::rdtsc();
+  uint64_t next_report = start + second;
+  Counters last;
+  bool active = true;
+
+  while(__running && active) {
+    uint64_t now = TSCClock::rdtsc();
+    active = false;
+    for(Session& s : _sessions) {
+      if(s.replay_done)
+        continue;
+      replay_session(s, now, start, base, scale);
+      active |= !s.replay_done;
+    }
+
+    for(Session& s : _sessions) {
+      if(s.send_buffer.read_avail())
+        flush(s);
+    }
+
+    poll_sessions(0);
+
+    if(now >= next_report) {
+      progress(double(now - start) / second, last);
+      last = _counters;
+      next_report += second;
+      heartbeat();
+    }
+  }
+
+  double secs = double(TSCClock::rdtsc() - start) / second;
+
+  for(Session& s : _sessions) {
+    while(__running && s.send_buffer.read_avail()) {
+      flush(s);
+      read_session(s);
+    }
+  }
+
+  uint64_t drain_end = TSCClock::rdtsc() + second;
+  while(__running && TSCClock::rdtsc() < drain_end)
+    poll_sessions(10);
+
+  _pipeline.stop();
+  report(secs);
+}
+
+void
+LoadGen::report(double secs) const {
+  TSCClock& clock = tsc_clock();
+  uint64_t sent = _counters.orders + _counters.cancels;
+
+  if(_config.replay.empty()) {
+    printf("sessions=%d duration=%.2fs sent=%lu sustained=%.0f msgs/s target=%.0f msgs/s\n",
+           _config.sessions, secs, sent, sent / secs, _config.rate);
+  } else {
+    sent += _counters.other_sent;
+    printf("sessions=%d duration=%.2fs sent=%lu sustained=%.0f msgs/s speed=%.1fx decoded=%lu bytes stalls=%lu\n",
+           _config.sessions, secs, sent, sent / secs, _config.speed, _pipeline.bytes(), _counters.stalls);
+  }
+  printf("orders=%lu cancels=%lu acks=%lu canceled=%lu execs=%lu rejects=%lu other=%lu\n",
+         _counters.orders, _counters.cancels, _counters.acks, _counters.canceled,
+         _counters.executions, _counters.rejects, _counters.other);
+
+  const pair<const char*, const LatencyHistogram*> hists[] = {{"ack", &_ack_rtt}, {"cancel", &_cancel_rtt}};
+  for(auto& h : hists) {
+    printf("%-6s rtt count=%lu min=%luns p50=%luns p90=%luns p99=%luns p99.9=%luns p99.99=%luns max=%luns\n",
+           h.first, h.second->count(),
+           clock.ticks_to_ns(h.second->min()), clock.ticks_to_ns(h.second->percentile(50)),
+           clock.ticks_to_ns(h.second->percentile(90)), clock.ticks_to_ns(h.second->percentile(99)),
+           clock.ticks_to_ns(h.second->percentile(99.9)), clock.ticks_to_ns(h.second->percentile(99.99)),
+           clock.ticks_to_ns(h.second->max()));
+  }
+}
+
+void
+signal_handler(int signum) {
+  __running = false;
+}
+
+int
+main(int argc, char** argv) {
+  args::ArgumentParser parser("ouch_loadgen", "open-loop OUCH 4.2 load generator");
+  parser.helpParams.addDefault = true;
+  args::ValueFlag<string> host(parser, "host", "simulator host", {'H', "host"}, "127.0.0.1");
+  args::ValueFlag<int> port(parser, "port", "simulator port", {'p'}, 4722);
+  args::ValueFlag<int> sessions(parser, "sessions", "number of sessions", {'s', "sessions"}, 1);
+  args::ValueFlag<double> rate(parser, "rate", "total messages per second across all sessions", {'r', "rate"}, 10000);
+  args::ValueFlag<int> duration(parser, "seconds", "test duration (synthetic load)", {'d', "duration"}, 10);
+  args::ValueFlag<double> cancel_ratio(parser, "ratio", "probability a message is a cancel of a live order", {'c', "cancel-ratio"}, 0.5);
+  args::ValueFlag<int> symbols(parser, "symbols", "size of the symbol universe", {"symbols"}, 100);
+  args::ValueFlag<uint32_t> qty(parser, "qty", "order quantity", {"qty"}, 100);
+  args::ValueFlag<uint64_t> seed(parser, "seed", "random seed", {"seed"}, 1);
+  args::Flag crossing(parser, "crossing", "price orders so that they trade", {"crossing"}, false);
+  args::Flag soupbin(parser, "soupbin", "connect with SoupBinTCP", {"soupbin"}, false);
+  args::ValueFlagList<string> replay(parser, "file", "replay a session capture (gzip, bzip2 or plain), one session per file", {"replay"});
+  args::ValueFlag<double> speed(parser, "speed", "replay speed multiple of the captured pacing, 0 for as fast as possible", {"speed"}, 1.0);
+  args::ValueFlag<string> record(parser, "prefix", "write each session's messages to <prefix>.<session>.gz", {"record"});
+  args::Flag version(parser, "version", "show version", {'v', "version"});
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch(const runtime_error& e) {
+    cout << parser;
+    cout << e.what() << endl;
+    return 1;
+  }
+
+  if(version) {
+    cout << ouch_loadgen_version() << endl;
+    exit(0);
+  }
+
+  ::signal(SIGINT, signal_handler);
+  ::signal(SIGTERM, signal_handler);
+  ::signal(SIGPIPE, SIG_IGN);
+
+  LoadGenConfig config;
+  config.host = args::get(host);
+  config.port = args::get(port);
+  config.sessions = max(1, args::get(sessions));
+  config.rate = max(1.0, args::get(rate));
+  config.duration = args::get(duration);
+  config.cancel_ratio = args::get(cancel_ratio);
+  config.symbols = max(1, args::get(symbols));
+  config.qty = args::get(qty);
+  config.seed = args::get(seed);
+  config.crossing = args::get(crossing);
+  config.soupbin = args::get(soupbin);
+  config.replay = args::get(replay);
+  config.speed = max(0.0, args::get(speed));
+  config.record = args::get(record);
+
+  try {
+    tsc_clock().start();
+    LoadGen loadgen;
+    loadgen.init(config);
+    loadgen.run();
+    tsc_clock().stop();
+  } catch (const std::runtime_error& e) {
+    cout << "Error: " << e.what() << endl;
+    exit(2);
+  }
+
+  exit(0);
+}
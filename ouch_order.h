@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+#include "boost_enum.h"
+
+namespace OUCHSim {
+  typedef int64_t oid_t;
+  static const oid_t INVALID_OID = -1;
+
+  BOOST_ENUM(OrderState,
+             (INITIAL)
+             (NEW)
+             (OPEN)
+             (CANCELED)
+             (FILLED)
+             (REJECTED)
+             );
+
+  struct OUCHConnection;
+
+  // qty/px/tif/minqty are kept in host byte order
+  struct OUCHOrder {
+    OrderState state = OrderState::INITIAL;
+    char token[14];
+    char side;
+    uint32_t qty = 0;
+    uint32_t filled_qty = 0;
+    char symbol[8];
+    uint32_t px = 0;
+    uint32_t tif = 0;
+    char mpid[4];
+    char display;
+    uint64_t oid;
+    char capacity;
+    char iso;
+    uint32_t minqty = 0;
+    char cross_type;
+
+    // the owning session's username as its id in the shard's journal, 0
+    // for none; the symbol's id in its shard's per-symbol arrays, the
+    // owning session, price level queue links, and the expiry timer on the
+    // session's worker, for a time in force in seconds
+    uint16_t user = 0;
+    uint32_t symbol_id = 0;
+    OUCHConnection* conn = nullptr;
+    oid_t prev = INVALID_OID;
+    oid_t next = INVALID_OID;
+    uint64_t expiry = 0;
+
+    uint32_t leaves() const { return qty - filled_qty; }
+  };
+}
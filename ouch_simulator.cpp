@@ -1,5 +1,18 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS 1
 
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <chrono>
+#include <cstring>
 #include <vector>
 #include <functional>
 
@@ -7,6 +20,7 @@
 #include <boost/lexical_cast.hpp>
 
 #include "ouch_simulator.h"
+#include "itch_structs.h"
 
 const char* ouch_simulator_version();
 
@@ -15,10 +29,42 @@ using namespace elf;
 using namespace std;
 using namespace boost::asio;
 
-OUCHConnection::OUCHConnection(OUCHSimulator* sim, IOServiceRP iosvc) {
+// worker whose io_service the current thread is running
+static thread_local IOWorker* tls_worker = nullptr;
+
+// io_uring user_data: the connection, the operation in the low bits and,
+// for receives, the read generation in the top 16 bits
+static constexpr uint64_t uring_op_recv = 1;
+static constexpr uint64_t uring_op_send = 2;
+static constexpr uint64_t uring_op_cancel = 3;
+static constexpr uint64_t uring_op_mask = 7;
+
+static uint64_t
+uring_tag(OUCHConnection* conn, uint64_t op, uint64_t gen = 0) {
+  return reinterpret_cast<uint64_t>(conn) | op | gen << 48;
+}
+
+static OUCHConnection*
+uring_conn(uint64_t user_data) {
+  return reinterpret_cast<OUCHConnection*>(user_data & ~uring_op_mask & ((uint64_t(1) << 48) - 1));
+}
+
+// the token index starts at its smallest and grows with the session's
+// open orders
+OUCHConnection::OUCHConnection(OUCHSimulator* sim, IOWorker* worker)
+  : _tokens(16) {
+  _id = sim->next_connection_id();
+  _state = ConnectionState::Initial;
   _ouch_sim = sim;
+  _worker = worker;
   _logger = sim->get_logger();
-  _socket = new ip::tcp::socket(*iosvc);
+  _socket = new ip::tcp::socket(*worker->_ioservice);
+  _soupbin = sim->soupbin();
+  _recv_room = IOWorker::recv_read_min;
+}
+
+OUCHConnection::~OUCHConnection() {
+  delete _socket;
 }
 
 void
@@ -31,239 +77,2288 @@ OUCHConnection::start() {
   _name = _peer;
 
   LOG_INFO(_logger, "{}: new connection fd={} peer={}", _name, _socket->native_handle(), _peer);
+  trace_name();
+
+  if(_ouch_sim->busy_poll()) {
+    int usec = _ouch_sim->busy_poll_usec();
+    if(::setsockopt(_socket->native_handle(), SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+      LOG_WARNING(_logger, "{}: SO_BUSY_POLL usec={} failed: {}", _name, usec, strerror(errno));
+  }
+
+  _state = _soupbin ? ConnectionState::LoggingIn : ConnectionState::Connected;
+  _last_recv_tsc = TSCClock::rdtsc();
+  if(_soupbin)
+    arm_heartbeat(_last_send_tsc);
+  arm_read();
+}
+
+void
+OUCHConnection::arm_read() {
+  if(_worker->_uring) {
+    if(!_recv_armed)
+      _worker->submit_recv(this);
+    return;
+  }
+
+  // wait for the socket rather than read into it, so no receive buffer is
+  // held while the session is idle
+  uint64_t gen = _read_gen;
+  _socket->async_wait(socket_base::wait_read, bind_memory(_read_memory, [this, gen](const boost::system::error_code& ec) {
+    handle_readable(gen, ec);
+  }));
+}
+
+// take a receive buffer and read what is there. reads that fill the room
+// offered mean input is queueing up, and the next one asks for more.
+void
+OUCHConnection::handle_readable(uint64_t gen, const boost::system::error_code& ec) {
+  if(gen != _read_gen)
+    return;
+  if(ec) {
+    handle_read(gen, ec, 0);
+    return;
+  }
+
+  BufferPool& pool = _worker->_buffers;
+  if(!pool.reserve(_recv_buffer, _recv_room)) {
+    LOG_ERROR(_logger, "{}: recv prepare_buffer failed", _name);
+    _recv_buffer.clear();
+    pool.reserve(_recv_buffer, _recv_room);
+  }
+
+  size_t room = _recv_buffer.write_avail();
+  ssize_t n = ::recv(_socket->native_handle(), _recv_buffer.write_head(), room, MSG_DONTWAIT);
+  if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    if(!_recv_buffer.read_avail())
+      pool.release(_recv_buffer);
+    arm_read();
+    return;
+  }
+  if(n <= 0) {
+    handle_read(gen, n ? boost::system::error_code(errno, boost::system::system_category())
+                : boost::system::error_code(boost::asio::error::eof), 0);
+    return;
+  }
+
+  if(size_t(n) == room)
+    _recv_room = std::min(_recv_room * 2, IOWorker::recv_buffer_max / 2);
+  else if(size_t(n) < room / 4)
+    _recv_room = std::max(_recv_room / 2, IOWorker::recv_read_min);
+  handle_read(gen, boost::system::error_code(), n);
+}
 
-  _recv_buffer.init(128*1024);
-  _socket->async_read_some(buffer(_recv_buffer.write_head(), _recv_buffer.write_avail()),
-                           std::bind(&OUCHConnection::handle_read, this,
-                                     std::placeholders::_1,
-                                     std::placeholders::_2));
+// session without a socket: input is fed straight into _recv_buffer and
+// output is dropped at flush. used by the benchmarks.
+void
+OUCHConnection::start_detached(const string& name) {
+  _peer = _name = name;
+  _state = ConnectionState::Connected;
+  trace_name();
+  _worker->_buffers.reserve(_recv_buffer, IOWorker::recv_buffer_max);
 }
 
+// the connection is reclaimed by its worker once nothing can still be
+// running on its behalf
 void
 OUCHConnection::shutdown() {
-  try {
-    boost::system::error_code ec;
-    _socket->shutdown(socket_base::shutdown_both, ec);
-    delete _socket;
-    _socket = nullptr;
-  } catch(boost::system::system_error& e) {
-    ;
+  trace(TraceKind::Close, "", 0);
+  _state = ConnectionState::Shutdown;
+  _read_gen++;
+  _recv_armed = false;
+  if(_socket) {
+    try {
+      boost::system::error_code ec;
+      _socket->shutdown(socket_base::shutdown_both, ec);
+      delete _socket;
+      _socket = nullptr;
+    } catch(boost::system::system_error& e) {
+      ;
+    }
+  }
+  _worker->_buffers.release(_recv_buffer);
+  _worker->retire(this);
+}
+
+// a logged in soupbin session outlives its connection: output keeps going
+// into the store for replay at the next login
+void
+OUCHConnection::disconnect() {
+  if(!_store) {
+    shutdown();
+    return;
   }
+
+  trace(TraceKind::Close, "", 0);
+  _state = ConnectionState::Disconnected;
+  _read_gen++;
+  _recv_armed = false;
+  boost::system::error_code ec;
+  _socket->shutdown(socket_base::shutdown_both, ec);
+  _socket->close(ec);
+  _worker->_buffers.release(_recv_buffer);
 }
 
 void
 OUCHConnection::send_raw(const char* buf, size_t len) {
-  if(_ouch_sim->trace_messages()) {
-    LOG_INFO(_logger, "{}: sending message size={}", _name, len);
+  if(!_flush_scheduled) {
+    _flush_scheduled = true;
+    _worker->schedule_flush(this);
+  }
+  if(!_send_buffer.prepare_write(len))
+    reserve_send();
+  _stats.msgs_out++;
+  memcpy(_send_buffer.write_head(), buf, len);
+  _send_buffer.mark_written(len);
+}
+
+// output is written into a buffer from the worker's pool, taken by the
+// first message of a flush cycle and given back once it has been sent. a
+// reader too slow to take what has queued behind its send is cut off.
+void
+OUCHConnection::reserve_send() {
+  if(_send_waiting && _worker->_uring)
+    _worker->poll_sends();
+  if(_send_buffer.read_avail())
+    flush();
+  if(_worker->_buffers.reserve(_send_buffer, IOWorker::send_buffer_size))
+    return;
+
+  LOG_WARNING(_logger, "{}: reader too slow, dropping {} unsent bytes", _name, _send_buffer.read_avail());
+  _send_buffer.clear();
+  _worker->_buffers.reserve(_send_buffer, IOWorker::send_buffer_size);
+  close_socket();
+}
+
+// unsequenced packets in _send_buffer go first, then any sequenced output
+// not yet written, gathered straight from the store. while a send is in
+// progress, output queues behind it and is sent when it completes.
+void
+OUCHConnection::flush() {
+  bool live = (_state == ConnectionState::Connected || _state == ConnectionState::LoggingIn) &&
+    _socket && _socket->is_open();
+  if(!live) {
+    _send_buffer.clear();
+    return;
+  }
+  if(_send_waiting)
+    return;
+
+  SequencedStore::Span spans[2];
+  int nspans = 0;
+  if(_store) {
+    uint64_t oldest = _store->position(_store->first_seq());
+    if(_sent_pos < oldest) {
+      LOG_WARNING(_logger, "{}: output overran the store, {} bytes lost", _name, oldest - _sent_pos);
+      _sent_pos = oldest;
+    }
+    nspans = _store->spans(_sent_pos, spans);
+  }
+
+  size_t len = _send_buffer.read_avail();
+  if(!len && !nspans)
+    return;
+
+  if(_worker->_trace) {
+    if(len)
+      trace(TraceKind::Out, _send_buffer.read_head(), len);
+    for(int i=0; i<nspans; i++)
+      trace(TraceKind::Out, spans[i].data, spans[i].len);
+  }
+
+  // the unsequenced part stays put in _sending until it is all written, and
+  // the store keeps what was sent from it until it wraps
+  _sending.swap(_send_buffer);
+  int n = 0;
+  if(len)
+    _send_iov[n++] = iovec{_sending.read_head(), len};
+  for(int i=0; i<nspans; i++)
+    _send_iov[n++] = iovec{const_cast<char*>(spans[i].data), spans[i].len};
+
+  memset(&_send_msg, 0, sizeof(_send_msg));
+  _send_msg.msg_iov = _send_iov;
+  _send_msg.msg_iovlen = n;
+  _send_total = 0;
+  for(int i=0; i<n; i++)
+    _send_total += _send_iov[i].iov_len;
+  _send_tsc = TSCClock::rdtsc();
+  if(_store) {
+    _send_from = _sent_pos;
+    _sent_pos = _store->head();
+  }
+
+  _send_waiting = true;
+  if(_worker->_uring)
+    _worker->submit_send(this);
+  else
+    write_sending();
+}
+
+// asio: write what the socket takes now, and the rest once it is writable
+void
+OUCHConnection::write_sending() {
+  if(send_overrun())
+    return;
+  ssize_t n = ::sendmsg(_socket->native_handle(), &_send_msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    send_failed(errno);
+    return;
+  }
+  if(n > 0 && advance_send(n)) {
+    finish_send();
+    return;
+  }
+
+  // a closed or replaced socket's wait is dropped; adopt() starts over
+  uint64_t gen = _read_gen;
+  _socket->async_wait(socket_base::wait_write, [this, gen](const boost::system::error_code& ec) {
+    if(gen != _read_gen || ec == boost::asio::error::operation_aborted)
+      return;
+    if(ec)
+      send_failed(ec.value());
+    else
+      write_sending();
+  });
+}
+
+// returns false while part of the send is left
+bool
+OUCHConnection::advance_send(size_t n) {
+  while(n && _send_msg.msg_iovlen) {
+    iovec& iov = _send_msg.msg_iov[0];
+    if(n < iov.iov_len) {
+      iov.iov_base = static_cast<char*>(iov.iov_base) + n;
+      iov.iov_len -= n;
+      break;
+    }
+    n -= iov.iov_len;
+    _send_msg.msg_iov++;
+    _send_msg.msg_iovlen--;
   }
+  return !_send_msg.msg_iovlen;
+}
+
+// the send is all written: its buffer goes back to the pool and the output
+// queued behind it follows
+void
+OUCHConnection::finish_send() {
+  _send_waiting = false;
+  _last_send_tsc = TSCClock::rdtsc();
+  _stats.record_write(_send_total, _last_send_tsc - _send_tsc);
+  _worker->_buffers.release(_sending);
+  flush();
+}
+
+// a store that has wrapped over a send still in progress has lost the rest
+bool
+OUCHConnection::send_overrun() {
+  if(!_store || _send_from >= _store->position(_store->first_seq()))
+    return false;
+  send_failed(ENOBUFS);
+  return true;
+}
+
+void
+OUCHConnection::send_failed(int err) {
+  LOG_WARNING(_logger, "{}: send failed len={} error={}", _name, _send_total, strerror(err));
+  _worker->_buffers.release(_sending);
+  close_socket();
+}
 
-  _socket->send(boost::asio::buffer(buf, len));
+// takes the connection down from wherever it is: closing the socket ends
+// its read, and the read path disconnects. output meanwhile is dropped.
+void
+OUCHConnection::close_socket() {
+  boost::system::error_code ec;
+  _socket->shutdown(socket_base::shutdown_both, ec);
+  _socket->close(ec);
 }
 
 void
-OUCHConnection::handle_read(const boost::system::error_code& ec, size_t bytes_transferred) {
+OUCHConnection::handle_read(uint64_t gen, const boost::system::error_code& ec, size_t bytes_transferred) {
+  // completion for a socket that has since been closed or replaced
+  if(gen != _read_gen)
+    return;
+
+  _read_tsc = TSCClock::rdtsc();
+
   if(ec) {
     LOG_INFO(_logger, "{}: fd={} disconnected", _name, _socket->native_handle());
-    shutdown();
+    disconnect();
     return;
   }
 
+  trace(TraceKind::In, _recv_buffer.write_head(), bytes_transferred);
   _recv_buffer.mark_written(bytes_transferred);
 
-  if(_ouch_sim->trace_messages()) {
-    LOG_INFO(_logger, "{}: received message xfer={} read_avail={}", _name,
-             (int)bytes_transferred, (int)_recv_buffer.read_avail());
+  consume_buffer(_recv_buffer);
+  // only a partial message keeps the buffer from going back to the pool
+  if(!_recv_buffer.read_avail())
+    _worker->_buffers.release(_recv_buffer);
+  _worker->flush_pending();
+
+  // logged out, rejected or handed to the session's owner
+  if(_state != ConnectionState::Connected && _state != ConnectionState::LoggingIn)
+    return;
+
+  arm_read();
+}
+
+// a multishot receive completion. data arrives in a provided buffer and is
+// copied into _recv_buffer, where partial messages can wait for the rest.
+void
+OUCHConnection::handle_recv(const io_uring_cqe& cqe) {
+  IOUring& ring = *_worker->_uring;
+  bool has_buffer = cqe.flags & IORING_CQE_F_BUFFER;
+  uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if(!(cqe.flags & IORING_CQE_F_MORE) && !--_recvs_inflight && _retired && !_sends_inflight)
+    _worker->schedule_reclaim();
+
+  // for a socket that has since been closed or replaced
+  if((cqe.user_data >> 48) != (_read_gen & 0xffff)) {
+    if(has_buffer)
+      ring.recycle(bid);
+    return;
   }
 
-  consume_buffer(_recv_buffer);
+  if(!(cqe.flags & IORING_CQE_F_MORE))
+    _recv_armed = false;
 
-  if(!_recv_buffer.prepare_write(2048)) {
-    LOG_ERROR(_logger, "{}: recv prepare_buffer failed", _name);
-    _recv_buffer.clear();
+  if(cqe.res == -ENOBUFS) {
+    LOG_WARNING(_logger, "{}: out of io_uring receive buffers", _name);
+    arm_read();
+    return;
+  }
+
+  if(cqe.res <= 0) {
+    boost::system::error_code ec = cqe.res ? boost::system::error_code(-cqe.res, boost::system::system_category())
+      : boost::system::error_code(boost::asio::error::eof);
+    handle_read(_read_gen, ec, 0);
+    return;
+  }
+
+  size_t n = cqe.res;
+  if(_worker->_buffers.reserve(_recv_buffer, n)) {
+    memcpy(_recv_buffer.write_head(), ring.buffer(bid), n);
+  } else {
+    LOG_ERROR(_logger, "{}: recv buffer full, dropping {} bytes", _name, n);
+    n = 0;
+  }
+  ring.recycle(bid);
+  handle_read(_read_gen, boost::system::error_code(), n);
+}
+
+// the rest of a partial send goes straight back to the kernel, which
+// waits for the socket to take it. a send to a socket since shut or
+// replaced ends here, and adopt() has left the next one to start from here.
+void
+OUCHConnection::handle_send(const io_uring_cqe& cqe) {
+  _sends_inflight--;
+  if((cqe.user_data >> 48) != (_read_gen & 0xffff)) {
+    _send_waiting = false;
+    _worker->_buffers.release(_sending);
+    if(!_retired)
+      flush();
+    else if(!_recvs_inflight && !_sends_inflight)
+      _worker->schedule_reclaim();
+    return;
+  }
+
+  if(cqe.res <= 0)
+    send_failed(cqe.res ? -cqe.res : EPIPE);
+  else if(advance_send(cqe.res))
+    finish_send();
+  else if(!send_overrun())
+    _worker->submit_send(this);
+}
+
+// inbound OUCH messages by type byte: wire size, where the token a reject
+// quotes is, field validation and handler. a zero size marks a type we
+// don't accept.
+struct InboundHandler {
+  uint16_t size;
+  uint16_t token;
+  char (*validate)(const char* msg);
+  void (*handle)(OUCHConnection* conn, const char* msg);
+};
+
+template <typename Msg, void (OUCHConnection::*Handle)(const Msg*)>
+static constexpr InboundHandler
+inbound_handler() {
+  return InboundHandler{sizeof(Msg), offsetof(Msg, token),
+      [](const char* msg) { return OUCH42::validate(*reinterpret_cast<const Msg*>(msg)); },
+      [](OUCHConnection* conn, const char* msg) { (conn->*Handle)(reinterpret_cast<const Msg*>(msg)); }};
+}
+
+struct InboundTable {
+  constexpr InboundTable() : entries{} {
+    add(inbound_handler<OUCH42::NewOrder, &OUCHConnection::handle_new_order>(), OUCH42::NewOrder::msg_type);
+    add(inbound_handler<OUCH42::CancelOrder, &OUCHConnection::handle_cancel>(), OUCH42::CancelOrder::msg_type);
+    add(inbound_handler<OUCH42::ReplaceOrder, &OUCHConnection::handle_replace>(), OUCH42::ReplaceOrder::msg_type);
+  }
+  constexpr void add(const InboundHandler& h, char msgtype) { entries[uint8_t(msgtype)] = h; }
+  const InboundHandler& operator[](char msgtype) const { return entries[uint8_t(msgtype)]; }
+
+  InboundHandler entries[256];
+};
+
+static constexpr InboundTable inbound_handlers;
+
+void
+OUCHConnection::consume_buffer(RingBuffer& buffer) {
+  if(_soupbin) {
+    consume_soupbin(buffer);
+    return;
+  }
+
+  // walk everything buffered and release it in one step
+  const char* begin = buffer.read_head();
+  const char* end = begin + buffer.read_avail();
+  const char* p = begin;
+
+  while(p < end) {
+    size_t len = handle_message(p, end - p);
+    if(!len)
+      break;
+
+    if(len == unknown_message) {
+      // skip to the next byte that could start a message
+      const char* next = p + 1;
+      while(next < end && !inbound_handlers[*next].size)
+        next++;
+      _stats.discards++;
+      _stats.discard_bytes += next - p;
+      LOG_ERROR(_logger, "{}: discarding input len={} msgtype={:#04x}", _name, next - p, uint8_t(*p));
+      p = next;
+      continue;
+    }
+
+    _stats.record_message(*p, len, TSCClock::rdtsc() - _read_tsc);
+    p += len;
+  }
+
+  buffer.mark_read(p - begin);
+}
+
+// handle the OUCH message at msg. returns its length, 0 if avail holds
+// less than a whole message, or unknown_message. a message that fails
+// validation is consumed and answered with a reject.
+size_t
+OUCHConnection::handle_message(const char* msg, size_t avail) {
+  const InboundHandler& h = inbound_handlers[*msg];
+  if(!h.size)
+    return unknown_message;
+  if(avail < h.size)
+    return 0;
+
+  char reason = h.validate(msg);
+  if(__builtin_expect(reason, 0)) {
+    send_reject(reason, msg + h.token);
+    return h.size;
+  }
+
+  h.handle(this, msg);
+  return h.size;
+}
+
+void
+OUCHConnection::handle_new_order(const OUCH42::NewOrder* new_order) {
+  if(_ouch_sim->find_order(this, new_order->token) != INVALID_OID) {
+    LOG_WARNING(_logger, "{}: ignoring duplicate token {}", _name, string(new_order->token, sizeof(new_order->token)));
+    return;
+  }
+
+  _ouch_sim->submit_order(this, new_order);
+}
+
+void
+OUCHConnection::handle_cancel(const OUCH42::CancelOrder* cxl) {
+  oid_t oid = _ouch_sim->find_order(this, cxl->token);
+  if(oid==INVALID_OID)
+    return;
+
+  uint32_t canceled = _ouch_sim->cancel_order(this, oid, cxl->qty);
+  if(canceled)
+    send_canceled(cxl->token, canceled, OUCH42::CancelReason::UserRequested);
+}
+
+// a replace of an unknown token is ignored, like a cancel; one to a token
+// in use is ignored, like a new order
+void
+OUCHConnection::handle_replace(const OUCH42::ReplaceOrder* replace) {
+  oid_t oid = _ouch_sim->find_order(this, replace->existing_token);
+  if(oid==INVALID_OID)
+    return;
+
+  if(_ouch_sim->find_order(this, replace->token) != INVALID_OID) {
+    LOG_WARNING(_logger, "{}: ignoring replace to duplicate token {}", _name, string(replace->token, sizeof(replace->token)));
     return;
   }
 
-  _socket->async_read_some(buffer(_recv_buffer.write_head(), _recv_buffer.write_avail()),
-                           std::bind(&OUCHConnection::handle_read, this,
-                                     std::placeholders::_1,
-                                     std::placeholders::_2));
+  _ouch_sim->replace_order(this, oid, replace);
 }
 
 void
-OUCHConnection::consume_buffer(RWBuffer& buffer) {
-  while(true) {
-    size_t read_avail = buffer.read_avail();
-    if(read_avail < 1)
+OUCHConnection::consume_soupbin(RingBuffer& buffer) {
+  while(buffer.read_avail() >= sizeof(SoupBin::Header)) {
+    auto header = reinterpret_cast<const SoupBin::Header*>(buffer.read_head());
+    size_t len = header->len;
+    size_t packet_len = sizeof(header->len) + len;
+    if(buffer.read_avail() < packet_len)
       break;
 
-    char msgtype = *buffer.read_head();
-    switch(msgtype) {
-    case OUCH42::MessageType::NewOrder:
-      {
-        if(read_avail < sizeof(OUCH42::NewOrder))
-          return;
+    _last_recv_tsc = _read_tsc;
+    char type = len ? header->type : 0;
+    const char* payload = buffer.read_head() + sizeof(SoupBin::Header);
+    size_t payload_len = len ? len - 1 : 0;
 
-        auto new_order = buffer.try_consume_struct<const OUCH42::NewOrder>();
-        oid_t oid = _ouch_sim->register_new_order(new_order);
-        if(oid==INVALID_OID)
-          send_reject('T', new_order->token);
-        else
-          send_ack(new_order, oid);
+    if(_state == ConnectionState::LoggingIn && type != SoupBin::PacketType::LoginRequest) {
+      LOG_ERROR(_logger, "{}: packet type={} before login, disconnecting", _name, type);
+      shutdown();
+      return;
+    }
 
+    switch(type) {
+    case SoupBin::PacketType::UnsequencedData:
+      {
+        char msgtype = payload_len ? *payload : 0;
+        size_t n = payload_len ? handle_message(payload, payload_len) : 0;
+        if(n == payload_len) {
+          _stats.record_message(msgtype, n, TSCClock::rdtsc() - _read_tsc);
+        } else {
+          _stats.discards++;
+          _stats.discard_bytes += payload_len;
+          LOG_ERROR(_logger, "{}: discarding unsequenced packet len={} msgtype={}", _name, payload_len, msgtype);
+        }
         break;
       }
 
-    case OUCH42::MessageType::CancelOrder:
+    case SoupBin::PacketType::ClientHeartbeat:
+      break;
+
+    case SoupBin::PacketType::LoginRequest:
       {
-        if(read_avail < sizeof(OUCH42::CancelOrder))
+        if(_state != ConnectionState::LoggingIn || packet_len < sizeof(SoupBin::LoginRequest)) {
+          LOG_ERROR(_logger, "{}: unexpected login request len={}, disconnecting", _name, len);
+          disconnect();
           return;
+        }
 
-        auto cxl = buffer.try_consume_struct<const OUCH42::CancelOrder>();
-        oid_t oid = _ouch_sim->find_order(cxl->token);
-        if(oid==INVALID_OID)
-          break;
-
-        _ouch_sim->cancel_order(oid);
-        send_canceled(cxl, oid);
-        break;
+        buffer.mark_read(packet_len);
+        handle_login(reinterpret_cast<const SoupBin::LoginRequest*>(header), buffer);
+        if(_state != ConnectionState::Connected)
+          return;
+        continue;
       }
 
+    case SoupBin::PacketType::LogoutRequest:
+      LOG_INFO(_logger, "{}: logout", _name);
+      buffer.mark_read(packet_len);
+      disconnect();
+      return;
+
     default:
-      buffer.mark_read(read_avail);
-      LOG_ERROR(_logger, "{}: discarding input len={} msgtype={}", _name, read_avail, msgtype);
+      _stats.discards++;
+      _stats.discard_bytes += packet_len;
+      LOG_ERROR(_logger, "{}: discarding packet type={} len={}", _name, type, len);
       break;
     }
+
+    buffer.mark_read(packet_len);
   }
 }
 
+// a username names a session for the life of the simulator. the first login
+// creates it on this connection; later logins hand their socket, along with
+// anything already read behind the login, to the session's worker.
 void
-OUCHConnection::send_ack(const OUCH42::NewOrder* new_order, oid_t oid) {
-  OUCH42::OrderAck ack;
-  memcpy(ack.token, new_order->token, sizeof(ack.token));
-  ack.side = new_order->side;
-  ack.qty = new_order->qty;
-  memcpy(ack.symbol, new_order->symbol, sizeof(ack.symbol));
-  ack.px = new_order->px;
-  ack.tif = new_order->tif;
-  memcpy(ack.mpid, new_order->mpid, sizeof(ack.mpid));
-  ack.display = new_order->display;
-  ack.oid = oid;
-  ack.capacity = new_order->capacity;
-  ack.iso = new_order->iso;
-  ack.minqty = new_order->minqty;
-  ack.cross_type = new_order->cross_type;
-  ack.state = 'L';
-
-  send_raw(reinterpret_cast<const char*>(&ack), sizeof(ack));
+OUCHConnection::handle_login(const SoupBin::LoginRequest* req, RingBuffer& buffer) {
+  string username = SoupBin::trim_alpha_field(req->username, sizeof(req->username));
+  string session = SoupBin::trim_alpha_field(req->session, sizeof(req->session));
+  uint64_t seq = SoupBin::parse_numeric_field(req->sequence, sizeof(req->sequence));
+
+  if(username.empty()) {
+    reject_login(SoupBin::RejectReason::NotAuthorized);
+    return;
+  }
+  if(!session.empty() && session != SoupBin::trim_alpha_field(_ouch_sim->session_id().data(), 10)) {
+    reject_login(SoupBin::RejectReason::SessionNotAvailable);
+    return;
+  }
+
+  OUCHConnection* owner = _ouch_sim->login(this, username);
+  if(owner == this) {
+    _username = username;
+    _name = _peer + "/" + _username;
+    trace_name();
+    size_t bytes = _ouch_sim->soupbin_store_bytes();
+    _store.reset(new SequencedStore(bytes, bytes / 32));
+    _state = ConnectionState::Connected;
+    accept_login(seq);
+    _ouch_sim->reattach_orders(this);
+    arm_heartbeat(TSCClock::rdtsc());
+    return;
+  }
+
+  string pending(buffer.read_head(), buffer.read_avail());
+  buffer.clear();
+
+  // an io_uring receive would go on reading the socket for us
+  if(_recvs_inflight)
+    _worker->cancel_recv(this);
+  _read_gen++;
+
+  boost::system::error_code ec;
+  int fd = _socket->release(ec);
+  _state = ConnectionState::Shutdown;
+  _worker->retire(this);
+  if(ec) {
+    LOG_ERROR(_logger, "{}: releasing socket for session {} failed: {}", _name, username, ec.message());
+    return;
+  }
+
+  LOG_INFO(_logger, "{}: resuming session {}", _name, username);
+  string peer = _peer;
+  boost::asio::post(*owner->_worker->_ioservice, [owner, fd, peer, seq, pending] {
+    owner->adopt(fd, peer, seq, pending);
+  });
 }
 
+// seq is the next sequence number the client expects, 0 for no replay
 void
-OUCHConnection::send_reject(const char reason, const char* token) {
-  OUCH42::OrderRejected rej;
-  memcpy(rej.token, token, sizeof(rej.token));
-  rej.reason = reason;
-  send_raw(reinterpret_cast<char*>(&rej), sizeof(rej));
+OUCHConnection::accept_login(uint64_t seq) {
+  uint64_t next = _store->next_seq();
+  uint64_t from = seq ? std::min(seq, next) : next;
+  if(from < _store->first_seq()) {
+    LOG_WARNING(_logger, "{}: sequence {} no longer held, replaying from {}", _name, from, _store->first_seq());
+    from = _store->first_seq();
+  }
+
+  SoupBin::LoginAccepted accepted;
+  memcpy(accepted.session, _ouch_sim->session_id().data(), sizeof(accepted.session));
+  SoupBin::set_numeric_field(from, accepted.sequence, sizeof(accepted.sequence));
+  send_raw(reinterpret_cast<const char*>(&accepted), sizeof(accepted));
+  _sent_pos = _store->position(from);
+
+  LOG_INFO(_logger, "{}: login accepted next={} replaying={}", _name, from, next - from);
 }
 
 void
-OUCHConnection::send_canceled(const OUCH42::CancelOrder* user_cxl, oid_t oid) {
-  OUCH42::OrderCanceled cxl;
-  memcpy(cxl.token, user_cxl->token, sizeof(cxl.token));
-  cxl.qty = user_cxl->qty;
-  cxl.reason = 'U';
-  send_raw(reinterpret_cast<char*>(&cxl), sizeof(cxl));
+OUCHConnection::reject_login(char reason) {
+  LOG_WARNING(_logger, "{}: login rejected reason={}", _name, reason);
+  SoupBin::LoginRejected rejected;
+  rejected.reason = reason;
+  send_raw(reinterpret_cast<const char*>(&rejected), sizeof(rejected));
+  flush();
+  shutdown();
 }
 
+// runs on this session's worker with a socket accepted elsewhere. a
+// connection still attached is dropped: the client has failed over.
 void
-OUCHSimulator::init(int port, bool trace_messages) {
-  _name = "ouch_sim";
+OUCHConnection::adopt(int fd, const string& peer, uint64_t seq, const string& pending) {
+  if(_socket) {
+    if(_socket->is_open())
+      LOG_INFO(_logger, "{}: replaced by {}", _name, peer);
+    // a shutdown also ends an io_uring receive, which holds its own
+    // reference to the socket
+    boost::system::error_code ec;
+    _socket->shutdown(socket_base::shutdown_both, ec);
+    _socket->close(ec);
+    delete _socket;
+  }
 
-  // logger
-  quill::Handler* handler = quill::stdout_handler("sh");
-  handler->set_pattern("%(ascii_time) %(level_name) %(logger_name) %(message)", "%D %H:%M:%S.%Qus", quill::Timezone::LocalTime);
-  quill::config::set_backend_thread_sleep_duration(std::chrono::milliseconds(10));
-  _logger = quill::create_logger(_name.c_str(), handler);
-  _logger->set_log_level(quill::LogLevel::TraceL3);
-  quill::start();
+  _read_gen++;
+  _recv_armed = false;
+  // output queued for the old socket goes with it. an io_uring send to it
+  // still in the kernel ends in handle_send, which starts the next one.
+  _send_buffer.clear();
+  if(!_sends_inflight) {
+    _send_waiting = false;
+    _worker->_buffers.release(_sending);
+  }
+  _socket = new ip::tcp::socket(*_worker->_ioservice);
+  boost::system::error_code ec;
+  _socket->assign(ip::tcp::v4(), fd, ec);
+  if(ec) {
+    LOG_ERROR(_logger, "{}: adopting fd={} failed: {}", _name, fd, ec.message());
+    ::close(fd);
+    _state = ConnectionState::Disconnected;
+    return;
+  }
 
-  _port = port;
-  _trace_messages = trace_messages;
+  _peer = peer;
+  _name = _peer + "/" + _username;
+  trace_name();
+  _state = ConnectionState::Connected;
+  _read_tsc = _last_recv_tsc = TSCClock::rdtsc();
 
-  LOG_INFO(_logger, "starting");
-  LOG_INFO(_logger, "version={} port={} trace_messages={}", ouch_simulator_version(), _port, _trace_messages);
+  _recv_buffer.clear();
+  if(!pending.empty() && _worker->_buffers.reserve(_recv_buffer, pending.size())) {
+    memcpy(_recv_buffer.write_head(), pending.data(), pending.size());
+    _recv_buffer.mark_written(pending.size());
+  }
 
-  _running = true;
-  _ioservice = std::make_shared<IOService>();
-  init_listener();
-}
+  accept_login(seq);
+  consume_buffer(_recv_buffer);
+  if(!_recv_buffer.read_avail())
+    _worker->_buffers.release(_recv_buffer);
+  _worker->flush_pending();
 
-void
-OUCHSimulator::init_listener() {
-  try {
-    _acceptor = new ip::tcp::acceptor(*_ioservice, ip::tcp::endpoint(ip::tcp::v4(), _port));
-  } catch(boost::system::system_error& e) {
-    LOG_WARNING(_logger, "accept: {}", e.what());
-    return;
+  if(_state == ConnectionState::Connected) {
+    arm_heartbeat(_last_send_tsc);
+    arm_read();
   }
-
-  arm_acceptor();
 }
 
+// the check is timed for the earliest the session could be due a heartbeat
+// or time out. traffic since only moves those later, so the timer isn't
+// touched on every read and write; the check finds out and sets the next.
 void
-OUCHSimulator::arm_acceptor() {
-  OUCHConnection* conn = new OUCHConnection(this, _ioservice);
-  _acceptor->async_accept(*(conn->_socket), std::bind(&OUCHSimulator::handle_accept, this, conn, std::placeholders::_1));
+OUCHConnection::arm_heartbeat(uint64_t last_send) {
+  uint64_t second = tsc_clock().ns_to_ticks(1000000000);
+  uint64_t due = _last_recv_tsc + SoupBin::HeartbeatTimeoutSecs * second + 1;
+  if(_state == ConnectionState::Connected)
+    due = std::min(due, last_send + SoupBin::HeartbeatIntervalSecs * second);
+
+  _worker->_timers.cancel(_heartbeat);
+  WorkerTimer timer{TimerKind::Heartbeat, 0, INVALID_OID, this};
+  _heartbeat = _worker->schedule_timer(due, timer);
 }
 
 void
-OUCHSimulator::handle_accept(OUCHConnection* conn, const boost::system::error_code& error) {
-  if(error) {
-    LOG_WARNING(_logger, "{}: handle_accept: error={} {}", _name, error.value(), error.message());
-    conn->shutdown();
+OUCHConnection::check_heartbeat() {
+  _heartbeat = 0;
+  if(_state != ConnectionState::Connected && _state != ConnectionState::LoggingIn)
+    return;
+
+  uint64_t now = TSCClock::rdtsc();
+  uint64_t second = tsc_clock().ns_to_ticks(1000000000);
+  if(now - _last_recv_tsc > SoupBin::HeartbeatTimeoutSecs * second) {
+    LOG_WARNING(_logger, "{}: nothing received for {}s, disconnecting", _name, SoupBin::HeartbeatTimeoutSecs);
+    disconnect();
     return;
   }
 
-  conn->start();
-  _conn_set.insert(conn);
-  arm_acceptor();
+  uint64_t last_send = _last_send_tsc;
+  if(_state == ConnectionState::Connected && now - last_send >= SoupBin::HeartbeatIntervalSecs * second) {
+    char heartbeat[sizeof(SoupBin::Header)];
+    SoupBin::set_header(heartbeat, SoupBin::PacketType::ServerHeartbeat, 0);
+    send_raw(heartbeat, sizeof(heartbeat));
+    last_send = now;
+  }
+  arm_heartbeat(last_send);
 }
 
+// the ack repeats the order's token..display and capacity..cross_type runs
+// byte for byte, so it is built from two copies of the wire bytes
+static constexpr size_t ack_head_len = offsetof(OUCH42::NewOrder, capacity) - offsetof(OUCH42::NewOrder, token);
+static constexpr size_t ack_tail_len = offsetof(OUCH42::NewOrder, customer_type) - offsetof(OUCH42::NewOrder, capacity);
+static_assert(offsetof(OUCH42::OrderAck, oid) - offsetof(OUCH42::OrderAck, token) == ack_head_len, "ack head layout");
+static_assert(offsetof(OUCH42::OrderAck, state) - offsetof(OUCH42::OrderAck, capacity) == ack_tail_len, "ack tail layout");
+
 void
-OUCHSimulator::stop_listener() {
-  delete _acceptor;
-  _acceptor = nullptr;
+OUCHConnection::send_ack(const OUCH42::NewOrder* new_order, oid_t oid) {
+  auto ack = begin_send<OUCH42::OrderAck>();
+  memcpy(ack->token, new_order->token, ack_head_len);
+  ack->oid = oid;
+  memcpy(&ack->capacity, &new_order->capacity, ack_tail_len);
+  ack->state = 'L';
 }
 
+// the order as it stands after the replace, with its open shares
 void
-OUCHSimulator::run() {
-  while(_running)
-    _ioservice->run_one();
+OUCHConnection::send_replaced(const OUCHOrder& order, const char* previous_token) {
+  auto rep = begin_send<OUCH42::OrderReplaced>();
+  memcpy(rep->token, order.token, sizeof(rep->token));
+  rep->side = order.side;
+  rep->qty = order.leaves();
+  memcpy(rep->symbol, order.symbol, sizeof(rep->symbol));
+  rep->px = order.px;
+  rep->tif = order.tif;
+  memcpy(rep->mpid, order.mpid, sizeof(rep->mpid));
+  rep->display = order.display;
+  rep->oid = order.oid;
+  rep->capacity = order.capacity;
+  rep->iso = order.iso;
+  rep->minqty = order.minqty;
+  rep->cross_type = order.cross_type;
+  rep->state = 'L';
+  memcpy(rep->previous_token, previous_token, sizeof(rep->previous_token));
 }
 
 void
-OUCHSimulator::shutdown() {
-  _running = false;
-  stop_listener();
-  _ioservice->stop();
+OUCHConnection::send_reject(const char reason, const char* token) {
+  auto rej = begin_send<OUCH42::OrderRejected>();
+  _stats.rejects++;
+  memcpy(rej->token, token, sizeof(rej->token));
+  rej->reason = reason;
 }
 
-oid_t
-OUCHSimulator::register_new_order(const elf::OUCH42::NewOrder* new_order) {
-  OUCHOrder order;
-  oid_t oid = _orders.size();
+void
+OUCHConnection::send_canceled(const char* token, uint32_t qty, char reason) {
+  auto cxl = begin_send<OUCH42::OrderCanceled>();
+  memcpy(cxl->token, token, sizeof(cxl->token));
+  cxl->qty = qty;
+  cxl->reason = reason;
+}
 
-  order.oid = oid;
-  order.state = OrderState::NEW;
-  order.side = new_order->side;
-  _orders.push_back(order);
-  return oid;
+void
+OUCHConnection::send_executed(const char* token, const Fill& fill, char liq_flag) {
+  auto exec = begin_send<OUCH42::OrderExecuted>();
+  memcpy(exec->token, token, sizeof(exec->token));
+  exec->qty = fill.qty;
+  exec->px = fill.px;
+  exec->liq_flag = liq_flag;
+  exec->match_id = fill.match_id;
 }
 
-oid_t
-OUCHSimulator::find_order(const char* token) const {
-  return INVALID_OID;
+IOWorker::IOWorker(OUCHSimulator* sim, int id, int cpu)
+  : _ouch_sim(sim),
+    _id(id),
+    _cpu(cpu),
+    _ioservice(std::make_shared<IOService>()),
+    _work(boost::asio::make_work_guard(*_ioservice)),
+    _tick_tsc(std::max<uint64_t>(1, tsc_clock().ns_to_ticks(std::chrono::nanoseconds(timer_tick).count()))),
+    _timers(timer_now()) {
 }
 
-void
-OUCHSimulator::cancel_order(oid_t oid) {
+// connections go last: destroying the io_service frees the operations
+// still queued for their sockets, from their handler memory
+IOWorker::~IOWorker() {
+  _work.reset();
+  _uring_wakeup.reset();
+  _timer.reset();
+  for(OUCHConnection* conn : _conns) {
+    delete conn->_socket;
+    conn->_socket = nullptr;
+  }
+  _ioservice.reset();
+
+  for(OUCHConnection* conn : _conns)
+    _slab.destroy(conn);
+}
+
+// make this the current thread's worker
+void
+IOWorker::enter() {
+  tls_worker = this;
+}
+
+void
+IOWorker::run() {
+  enter();
+
+  if(_cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(_cpu, &cpus);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if(rc)
+      LOG_WARNING(_ouch_sim->get_logger(), "worker {}: pin to cpu {} failed: {}", _id, _cpu, strerror(rc));
+    else
+      LOG_INFO(_ouch_sim->get_logger(), "worker {}: pinned to cpu {}", _id, _cpu);
+  }
+
+  if(_ouch_sim->io_uring())
+    init_uring();
+
+  if(_ouch_sim->busy_poll()) {
+    while(_ouch_sim->running()) {
+      _ioservice->poll();
+      if(_uring)
+        reap_uring();
+      if(_timer_due != WorkerTimers::no_tick && TSCClock::rdtsc() >= _timer_due * _tick_tsc)
+        run_timers();
+    }
+  } else {
+    while(_ouch_sim->running())
+      _ioservice->run_one();
+  }
+}
+
+void
+IOWorker::flush_pending() {
+  // a batch of io_uring completions is flushed once, at its end
+  if(_reaping)
+    return;
+
+  _flushing = true;
+  for(OUCHConnection* conn : _flush_list)
+    conn->flush();
+  _flushing = false;
+  if(_uring)
+    _uring->submit();
+
+  // output queued behind a send still in progress keeps its buffer
+  for(OUCHConnection* conn : _flush_list) {
+    conn->_flush_scheduled = false;
+    if(!conn->_send_buffer.read_avail())
+      _buffers.release(conn->_send_buffer);
+  }
+  _flush_list.clear();
+}
+
+// the ring is set up on the worker's own thread, its only submitter
+void
+IOWorker::init_uring() {
+  Logger* logger = _ouch_sim->get_logger();
+  try {
+    _uring.reset(new IOUring(uring_entries));
+    _uring->provide_buffers(uring_buffer_group, uring_buffers, uring_buffer_size);
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(efd < 0)
+      throw runtime_error(string("eventfd: ") + strerror(errno));
+    _uring_wakeup.reset(new posix::stream_descriptor(*_ioservice, efd));
+    _uring->register_eventfd(efd);
+  } catch(std::exception& e) {
+    LOG_WARNING(logger, "worker {}: io_uring unavailable, staying on asio: {}", _id, e.what());
+    _uring_wakeup.reset();
+    _uring.reset();
+    return;
+  }
+
+  LOG_INFO(logger, "worker {}: io_uring entries={} buffers={}x{}", _id, _uring->sq_entries(), uring_buffers, uring_buffer_size);
+  arm_uring_wakeup();
+}
+
+// the ring signals an eventfd, so completions wake the io_service
+// alongside its timers and posted handlers
+void
+IOWorker::arm_uring_wakeup() {
+  _uring_wakeup->async_wait(posix::descriptor_base::wait_read, bind_memory(_wakeup_memory, [this](const boost::system::error_code& ec) {
+    if(ec)
+      return;
+    uint64_t count;
+    if(::read(_uring_wakeup->native_handle(), &count, sizeof(count)) < 0 && errno != EAGAIN)
+      LOG_WARNING(_ouch_sim->get_logger(), "worker {}: eventfd read: {}", _id, strerror(errno));
+    reap_uring();
+    arm_uring_wakeup();
+  }));
+}
+
+void
+IOWorker::reap_uring() {
+  _uring->reap([this](const io_uring_cqe& cqe) { _completions.push_back(cqe); });
+
+  // handlers may append to _completions while polling for sends
+  _reaping = true;
+  for(size_t i=0; i<_completions.size(); i++) {
+    io_uring_cqe cqe = _completions[i];
+    OUCHConnection* conn = uring_conn(cqe.user_data);
+    if((cqe.user_data & uring_op_mask) == uring_op_recv)
+      conn->handle_recv(cqe);
+    else if((cqe.user_data & uring_op_mask) == uring_op_send)
+      conn->handle_send(cqe);
+  }
+  _completions.clear();
+  _reaping = false;
+
+  flush_pending();
+  _uring->submit();
+}
+
+void
+IOWorker::submit_recv(OUCHConnection* conn) {
+  io_uring_sqe* sqe = _uring->get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->_socket->native_handle();
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = uring_buffer_group;
+  sqe->user_data = uring_tag(conn, uring_op_recv, conn->_read_gen & 0xffff);
+  conn->_recv_armed = true;
+  conn->_recvs_inflight++;
+
+  // reap_uring submits once the batch is done
+  if(!_reaping)
+    _uring->submit();
+}
+
+void
+IOWorker::queue_send(OUCHConnection* conn) {
+  io_uring_sqe* sqe = _uring->get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = conn->_socket->native_handle();
+  sqe->addr = reinterpret_cast<uint64_t>(&conn->_send_msg);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = uring_tag(conn, uring_op_send, conn->_read_gen & 0xffff);
+}
+
+// completions of sends the kernel has already done, without waiting for
+// any others. the rest are kept for reap_uring.
+void
+IOWorker::poll_sends() {
+  _uring->submit();
+  size_t first = _completions.size();
+  _uring->reap([this](const io_uring_cqe& cqe) { _completions.push_back(cqe); });
+
+  size_t kept = first;
+  for(size_t i=first; i<_completions.size(); i++) {
+    if((_completions[i].user_data & uring_op_mask) == uring_op_send)
+      _sends.push_back(_completions[i]);
+    else
+      _completions[kept++] = _completions[i];
+  }
+  _completions.resize(kept);
+
+  for(const io_uring_cqe& cqe : _sends)
+    uring_conn(cqe.user_data)->handle_send(cqe);
+  _sends.clear();
+}
+
+// sends queued while flushing go to the kernel together at its end
+void
+IOWorker::submit_send(OUCHConnection* conn) {
+  queue_send(conn);
+  conn->_sends_inflight++;
+
+  if(!_flushing)
+    _uring->submit();
+}
+
+// cancel the receive armed at the connection's current read generation. its
+// last completion still arrives, with -ECANCELED; the cancel's own is ignored.
+void
+IOWorker::cancel_recv(OUCHConnection* conn) {
+  io_uring_sqe* sqe = _uring->get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = uring_tag(conn, uring_op_recv, conn->_read_gen & 0xffff);
+  sqe->user_data = uring_tag(conn, uring_op_cancel);
+
+  if(!_reaping)
+    _uring->submit();
+}
+
+// called from other workers; at most one drain is outstanding at a time
+void
+IOWorker::post_fill(const PassiveFill& pf) {
+  bool post;
+  {
+    std::lock_guard<std::mutex> guard(_mailbox_lock);
+    _mailbox.push_back(pf);
+    post = !_mailbox_posted;
+    _mailbox_posted = true;
+  }
+
+  // _mailbox_memory is released before drain_mailbox runs, and that
+  // clears _mailbox_posted under the lock, so it is never shared
+  if(post)
+    boost::asio::post(*_ioservice, bind_memory(_mailbox_memory, [this] { drain_mailbox(); }));
+}
+
+void
+IOWorker::drain_mailbox() {
+  {
+    std::lock_guard<std::mutex> guard(_mailbox_lock);
+    _draining.swap(_mailbox);
+    _mailbox_posted = false;
+  }
+
+  for(const PassiveFill& pf : _draining) {
+    pf.conn->send_executed(pf.token, pf.fill, OUCH::Constants::LiqAdded);
+    if(pf.done) {
+      pf.conn->_tokens.erase(pf.token);
+      _timers.cancel(pf.expiry);
+    }
+  }
+  _draining.clear();
+  flush_pending();
+}
+
+OUCHConnection*
+IOWorker::new_connection() {
+  OUCHConnection* conn = _slab.create(_ouch_sim, this);
+  _conns.push_back(conn);
+  return conn;
+}
+
+// sockets accepted on worker 0 for this worker
+void
+IOWorker::accept_connections(const vector<int>& fds) {
+  Logger* logger = _ouch_sim->get_logger();
+  for(int fd : fds) {
+    OUCHConnection* conn = new_connection();
+    boost::system::error_code ec;
+    conn->_socket->assign(ip::tcp::v4(), fd, ec);
+    if(ec) {
+      LOG_WARNING(logger, "worker {}: assigning fd={} failed: {}", _id, fd, ec.message());
+      ::close(fd);
+      conn->shutdown();
+      continue;
+    }
+
+    try {
+      conn->start();
+    } catch(boost::system::system_error& e) {
+      LOG_INFO(logger, "worker {}: fd={} lost before start: {}", _id, fd, e.what());
+      conn->shutdown();
+    }
+  }
+}
+
+void
+IOWorker::retire(OUCHConnection* conn) {
+  if(conn->_retired)
+    return;
+  conn->_retired = true;
+  _timers.cancel(conn->_heartbeat);
+  _retired.push_back(conn);
+  schedule_reclaim();
+}
+
+void
+IOWorker::schedule_reclaim() {
+  if(_reclaim_posted)
+    return;
+  _reclaim_posted = true;
+  boost::asio::post(*_ioservice, [this] { reclaim_connections(); });
+}
+
+// runs as a handler of its own, after anything the connections had queued
+// on the io_service. their orders are detached first, so other workers
+// stop queueing fills for them, and fills already in the mailbox are
+// delivered before the slots are reused. connections with an io_uring
+// receive or send still in the kernel wait for its last completion.
+void
+IOWorker::reclaim_connections() {
+  _reclaim_posted = false;
+
+  size_t waiting = 0;
+  for(OUCHConnection* conn : _retired) {
+    if(conn->_recvs_inflight || conn->_sends_inflight) {
+      _retired[waiting++] = conn;
+      continue;
+    }
+    _ouch_sim->detach_orders(conn);
+    _reclaiming.push_back(conn);
+  }
+  _retired.resize(waiting);
+  if(_reclaiming.empty())
+    return;
+
+  drain_mailbox();
+
+  for(OUCHConnection* conn : _reclaiming) {
+    _closed_stats.merge(conn->_stats);
+    _buffers.release(conn->_recv_buffer);
+    _buffers.release(conn->_send_buffer);
+    _buffers.release(conn->_sending);
+    _conns.erase(std::find(_conns.begin(), _conns.end(), conn));
+    _slab.destroy(conn);
+  }
+  _reclaiming.clear();
+}
+
+// timers never fire early: the due time is rounded up to a tick
+WorkerTimers::Handle
+IOWorker::schedule_timer(uint64_t due_tsc, const WorkerTimer& timer) {
+  WorkerTimers::Handle h = _timers.schedule((due_tsc + _tick_tsc - 1) / _tick_tsc, timer);
+  arm_timers();
+  return h;
+}
+
+void
+IOWorker::arm_timers() {
+  uint64_t due = _timers.next_due();
+  if(due >= _timer_due)
+    return;
+  _timer_due = due;
+  if(_ouch_sim->busy_poll())
+    return;
+
+  if(!_timer)
+    _timer.reset(new boost::asio::steady_timer(*_ioservice));
+  uint64_t now = TSCClock::rdtsc();
+  uint64_t wait = due * _tick_tsc > now ? tsc_clock().ticks_to_ns(due * _tick_tsc - now) : 0;
+  HandlerMemory& memory = _timer_memory[_timer_memory[0].in_use()];
+  _timer->expires_after(std::chrono::nanoseconds(wait));
+  _timer->async_wait(bind_memory(memory, [this](const boost::system::error_code& ec) {
+    if(!ec)
+      run_timers();
+  }));
+}
+
+void
+IOWorker::run_timers() {
+  _timer_due = WorkerTimers::no_tick;
+  _timers.advance(timer_now(), [this](const WorkerTimer& timer) { fire_timer(timer); });
+  flush_pending();
+  arm_timers();
+}
+
+void
+IOWorker::fire_timer(const WorkerTimer& timer) {
+  if(timer.kind == TimerKind::ModelFill)
+    _model_fills += _ouch_sim->model_fill(this, timer.oid, timer.fills_left);
+  else if(timer.kind == TimerKind::Expiry)
+    _expired += _ouch_sim->expire_order(timer.oid);
+  else if(timer.kind == TimerKind::Heartbeat)
+    timer.conn->check_heartbeat();
+}
+
+static void
+log_session_stats(Logger* logger, const string& who, const SessionStats& s, bool compact) {
+  LOG_INFO(logger, "{}: stats msgs_in={} bytes_in={} msgs_out={} bytes_out={} writes={} rejects={} discards={} discard_bytes={}",
+           who, s.msgs_in, s.bytes_in, s.msgs_out, s.bytes_out, s.writes, s.rejects, s.discards, s.discard_bytes);
+
+  TSCClock& clock = tsc_clock();
+  for(auto& t : s.types) {
+    const LatencyHistogram& h = t.second->latency;
+    if(compact) {
+      LOG_INFO(logger, "{}: type={} count={} p50={}ns p99={}ns max={}ns", who, t.first, t.second->count,
+               clock.ticks_to_ns(h.percentile(50)), clock.ticks_to_ns(h.percentile(99)), clock.ticks_to_ns(h.max()));
+    } else {
+      LOG_INFO(logger, "{}: type={} count={} bytes={} min={}ns mean={}ns p50={}ns p90={}ns p99={}ns p99.9={}ns max={}ns",
+               who, t.first, t.second->count, t.second->bytes,
+               clock.ticks_to_ns(h.min()), clock.ticks_to_ns(h.mean()), clock.ticks_to_ns(h.percentile(50)),
+               clock.ticks_to_ns(h.percentile(90)), clock.ticks_to_ns(h.percentile(99)),
+               clock.ticks_to_ns(h.percentile(99.9)), clock.ticks_to_ns(h.max()));
+    }
+  }
+
+  if(s.write_latency && !compact) {
+    const LatencyHistogram& h = *s.write_latency;
+    LOG_INFO(logger, "{}: write count={} p50={}ns p99={}ns p99.9={}ns max={}ns", who, h.count(),
+             clock.ticks_to_ns(h.percentile(50)), clock.ticks_to_ns(h.percentile(99)),
+             clock.ticks_to_ns(h.percentile(99.9)), clock.ticks_to_ns(h.max()));
+  }
+}
+
+// runs on this worker, so its sessions' counters can be read without races
+void
+IOWorker::dump_stats(bool detail) {
+  Logger* logger = _ouch_sim->get_logger();
+  SessionStats total;
+  total.merge(_closed_stats);
+  for(OUCHConnection* conn : _conns) {
+    total.merge(conn->_stats);
+    if(detail && conn->_state == ConnectionState::Connected)
+      log_session_stats(logger, conn->_name, conn->_stats, false);
+  }
+
+  log_session_stats(logger, "worker " + to_string(_id), total, !detail);
+  LOG_INFO(logger, "worker {}: sessions={} slab={} buffers outstanding={} free={} mapped={}KB", _id, _conns.size(),
+           _slab.capacity(), _buffers.outstanding(), _buffers.free_buffers(), _buffers.mapped_bytes() >> 10);
+  LOG_INFO(logger, "worker {}: timers pending={} model_fills={} expired={}", _id, _timers.size(), _model_fills, _expired);
+}
+
+BookShard::BookShard(uint32_t id, const SymbolDirectory& symbols)
+  : _orders(id),
+    _symbols(symbols),
+    _next_match_id((uint64_t(id) << 56) + 1) {
+  _books.reserve(symbols.size());
+  for(size_t i=0; i<symbols.size(); i++)
+    _books.emplace_back(_orders);
+  _markets.assign(symbols.size(), nullptr);
+}
+
+// a listed symbol's id, or no_symbol; without a list, every symbol is
+// given the next id the first time it's seen
+uint32_t
+BookShard::symbol_id(const char* symbol) {
+  if(!_symbols.empty())
+    return _symbols.find(symbol);
+
+  uint64_t key;
+  memcpy(&key, symbol, sizeof(key));
+  auto it = _symbol_ids.try_emplace(key, uint32_t(_books.size()));
+  if(it.second) {
+    _books.emplace_back(_orders);
+    _markets.push_back(nullptr);
+  }
+  return it.first->second;
+}
+
+void
+OUCHSimulator::init(const SimulatorConfig& config) {
+  _name = "ouch_sim";
+
+  // logger
+  quill::Handler* handler = quill::stdout_handler("sh");
+  handler->set_pattern("%(ascii_time) %(level_name) %(logger_name) %(message)", "%D %H:%M:%S.%Qus", quill::Timezone::LocalTime);
+  quill::config::set_backend_thread_sleep_duration(std::chrono::milliseconds(10));
+  if(config.log_cpu >= 0)
+    quill::config::set_backend_thread_cpu_affinity(config.log_cpu);
+  _logger = quill::create_logger(_name.c_str(), handler);
+  _logger->set_log_level(quill::LogLevel::TraceL3);
+  quill::start();
+
+  _port = config.port;
+  _busy_poll = config.busy_poll;
+  _busy_poll_usec = config.busy_poll_usec;
+  _io_uring = config.io_uring;
+  _stats_interval = config.stats_interval;
+  _soupbin = config.soupbin;
+  _soupbin_store_bytes = config.soupbin_store_mb << 20;
+  int threads = std::max(1, std::min(config.threads, int(OrderStore::max_stores)));
+
+  LOG_INFO(_logger, "starting");
+  tsc_clock().start();
+  LOG_INFO(_logger, "tsc clock ns_per_tick={}", tsc_clock().ns_per_tick());
+  LOG_INFO(_logger, "version={} port={} trace_messages={} threads={} busy_poll={} io_uring={} soupbin={}", ouch_simulator_version(),
+           _port, config.trace_messages, threads, _busy_poll, _io_uring, _soupbin);
+
+  // soupbin session ids default to the trading date
+  string session = config.soupbin_session;
+  if(session.empty()) {
+    time_t now = time(nullptr);
+    struct tm tm;
+    char date[16];
+    localtime_r(&now, &tm);
+    strftime(date, sizeof(date), "%Y%m%d", &tm);
+    session = date;
+  }
+  _session_id.assign(10, ' ');
+  OUCH::set_alpha_field(session, &_session_id[0], _session_id.size());
+
+  // the shards size their per-symbol arrays by the list
+  if(!config.symbol_file.empty()) {
+    _symbols.load(config.symbol_file);
+    LOG_INFO(_logger, "{}: symbols {} count={} slots={}", _name, config.symbol_file, _symbols.size(), _symbols.table_size());
+  }
+
+  _running = true;
+  for(int i=0; i<threads; i++) {
+    int cpu = i < int(config.io_cpus.size()) ? config.io_cpus[i] : -1;
+    _workers.emplace_back(new IOWorker(this, i, cpu));
+    _shards.emplace_back(new BookShard(i, _symbols));
+    _shards.back()->_rng.seed(config.fill_seed + i);
+  }
+  if(!config.fill_model.empty()) {
+    _fill_models.load(config.fill_model);
+    LOG_INFO(_logger, "{}: fill model {} symbols={} seed={}", _name, config.fill_model, _fill_models.size(), config.fill_seed);
+  }
+  if(!config.itch_file.empty()) {
+    _itch.reset(new ItchReader(config.itch_file));
+    _itch_books.reset(new ItchBooks());
+    _itch_speed = std::max(0.0, config.itch_speed);
+    _itch_from = config.itch_from;
+    LOG_INFO(_logger, "{}: replaying {} bytes={} compressed={} speed={} from={}", _name, config.itch_file,
+             _itch->file_bytes(), _itch->compressed(), _itch_speed, _itch_from);
+  }
+  if(config.trace_messages)
+    init_trace(config);
+  if(!config.journal_dir.empty())
+    init_journal(config);
+  if(_port > 0)
+    init_listener();
+  init_stats();
+}
+
+// each worker records into a ring of its own, drained to the trace file by
+// the recorder's thread
+void
+OUCHSimulator::init_trace(const SimulatorConfig& config) {
+  _trace.reset(new TraceRecorder(config.trace_file, _soupbin ? TraceFlags::SoupBin : 0));
+  for(auto& worker : _workers)
+    worker->_trace = _trace->add_ring();
+  _trace->start();
+  LOG_INFO(_logger, "{}: tracing to {}", _name, config.trace_file);
+}
+
+OUCHConnection*
+OUCHSimulator::login(OUCHConnection* conn, const string& username) {
+  std::lock_guard<std::mutex> guard(_sessions_lock);
+  return _sessions.try_emplace(username, conn).first->second;
+}
+
+// shards are replayed in parallel; each one's journal is then compacted to
+// the orders still resting, written to a fresh file that replaces the old
+// one only once complete
+void
+OUCHSimulator::init_journal(const SimulatorConfig& config) {
+  if(mkdir(config.journal_dir.c_str(), 0755) < 0 && errno != EEXIST)
+    throw runtime_error(config.journal_dir + ": " + strerror(errno));
+
+  vector<string> errors(_shards.size());
+  vector<std::thread> threads;
+  for(size_t i=0; i<_shards.size(); i++) {
+    threads.emplace_back([&, i] {
+      try {
+        recover_shard(*_shards[i], config.journal_dir + "/journal." + to_string(i), config.journal_records);
+      } catch(const runtime_error& e) {
+        errors[i] = e.what();
+      }
+    });
+  }
+  for(auto& t : threads)
+    t.join();
+
+  for(auto& e : errors) {
+    if(!e.empty())
+      throw runtime_error(e);
+  }
+}
+
+void
+OUCHSimulator::recover_shard(BookShard& shard, const string& path, size_t records) {
+  auto start = std::chrono::steady_clock::now();
+  uint32_t id = shard._orders.store_id();
+  vector<oid_t> opened, pending;
+  size_t replayed = 0;
+
+  std::unique_ptr<OrderJournal> old = OrderJournal::open(path, id, _shards.size());
+  if(old) {
+    replayed = old->replay([&](const JournalRecord& rec) { apply_journal(shard, rec, opened, pending); });
+
+    // an order journaled as NEW but never rested or retired was mid-match
+    // when we stopped; its fills were lost with it
+    for(oid_t oid : pending) {
+      OUCHOrder* order = shard._orders.get(oid);
+      if(order && order->state == OrderState::NEW)
+        shard._orders.release(oid);
+    }
+  }
+  shard._orders.finish_restore();
+
+  shard._journal.reset(new OrderJournal(path + ".new", id, _shards.size(), records));
+  if(old) {
+    shard._journal->copy_users(*old);
+    shard._next_match_id = std::max(shard._next_match_id, old->next_match_id());
+  }
+  shard._journal->set_next_match_id(shard._next_match_id);
+  size_t owned = 0;
+  for(oid_t oid : opened) {
+    OUCHOrder* order = shard._orders.get(oid);
+    if(!order || order->state != OrderState::OPEN)
+      continue;
+    if(!shard._journal->append(*order))
+      throw runtime_error(shard._journal->path() + ": can't grow the journal for the orders recovered: " + strerror(errno));
+    if(order->user) {
+      std::lock_guard<std::mutex> guard(_sessions_lock);
+      _recovered[shard._journal->username(order->user)].push_back(oid);
+      owned++;
+    }
+  }
+  shard._journal->rename(path);
+
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  LOG_INFO(_logger, "{}: shard {} journal replayed={} recovered={} session owned={} capacity={} in {}ms", _name, id,
+           replayed, shard._journal->size(), owned, shard._journal->capacity(), ms);
+}
+
+// records are full order images. recovered orders have no connection until
+// the session that entered them logs in again, see reattach_orders; until
+// then, and for good if they have no username, they rest and trade but
+// nobody hears about it
+void
+OUCHSimulator::apply_journal(BookShard& shard, const JournalRecord& rec, vector<oid_t>& opened, vector<oid_t>& pending) {
+  auto state = OrderState::get_by_index(rec.state);
+  if(!state)
+    throw runtime_error("journal record with bad state " + to_string(rec.state));
+
+  OUCHOrder* order = shard._orders.get(rec.oid);
+  if(order && order->state == OrderState::INITIAL)
+    order = nullptr;
+
+  if(*state == OrderState::NEW || (*state == OrderState::OPEN && !order)) {
+    order = shard._orders.restore(rec.oid);
+    if(!order)
+      throw runtime_error("journal record for foreign oid " + to_string(rec.oid));
+    OrderJournal::load(rec, *order);
+    order->symbol_id = shard.symbol_id(order->symbol);
+    if(order->symbol_id == SymbolDirectory::no_symbol)
+      throw runtime_error("journal order " + to_string(rec.oid) + " in unlisted symbol " + string(order->symbol, sizeof(order->symbol)));
+    order->state = OrderState::NEW;
+    if(*state == OrderState::NEW) {
+      pending.push_back(rec.oid);
+      return;
+    }
+  }
+
+  if(!order)
+    return;
+
+  OrderBook& book = shard.book(order->symbol_id);
+  if(*state == OrderState::OPEN) {
+    if(order->state == OrderState::NEW) {
+      order->qty = rec.qty;
+      order->filled_qty = rec.filled_qty;
+      book.add(rec.oid);
+      opened.push_back(rec.oid);
+    } else {
+      // fills, partial cancels and in-place replaces, which may also
+      // change the token and terms
+      book.reduce(rec.oid, rec.qty - rec.filled_qty);
+      OrderJournal::load(rec, *order);
+    }
+    return;
+  }
+
+  if(order->state == OrderState::OPEN)
+    book.remove(rec.oid);
+  shard._orders.release(rec.oid);
+}
+
+// every operation that takes match numbers journals an order before it
+// lets go of the shard, so the header's next match number is never behind
+// a fill anyone has heard of
+void
+OUCHSimulator::journal(BookShard& shard, const OUCHOrder& order) {
+  if(!shard._journal)
+    return;
+  shard._journal->set_next_match_id(shard._next_match_id);
+  if(!shard._journal->append(order)) {
+    LOG_ERROR(_logger, "{}: journal {} full at {} records and can't grow: {}; journaling stopped and the journal"
+              " abandoned", _name, shard._journal->path(), shard._journal->capacity(), strerror(errno));
+    shard._journal->abandon();
+    shard._journal.reset();
+  }
+}
+
+void
+OUCHSimulator::init_stats() {
+  IOService& io = *_workers[0]->_ioservice;
+
+  // shutdown is taken from a handler on worker 0 rather than from the
+  // signal itself, which may land while a worker holds its io_service lock
+  _signals = new signal_set(io, SIGUSR1, SIGINT, SIGTERM);
+  _signals->async_wait(std::bind(&OUCHSimulator::handle_signal, this, std::placeholders::_1, std::placeholders::_2));
+
+  if(_stats_interval > 0) {
+    _stats_timer = new deadline_timer(io);
+    arm_stats_timer();
+  }
+}
+
+void
+OUCHSimulator::arm_stats_timer() {
+  _stats_timer->expires_from_now(boost::posix_time::seconds(_stats_interval));
+  _stats_timer->async_wait([this](const boost::system::error_code& ec) {
+    if(ec)
+      return;
+    dump_stats(false);
+    arm_stats_timer();
+  });
+}
+
+void
+OUCHSimulator::handle_signal(const boost::system::error_code& ec, int signum) {
+  if(ec)
+    return;
+
+  if(signum != SIGUSR1) {
+    shutdown();
+    return;
+  }
+
+  dump_stats(true);
+  _signals->async_wait(std::bind(&OUCHSimulator::handle_signal, this, std::placeholders::_1, std::placeholders::_2));
+}
+
+void
+OUCHSimulator::dump_stats(bool detail) {
+  for(auto& worker : _workers) {
+    IOWorker* w = worker.get();
+    boost::asio::post(*w->_ioservice, [w, detail] { w->dump_stats(detail); });
+  }
+}
+
+void
+OUCHSimulator::init_listener() {
+  try {
+    _acceptor = new ip::tcp::acceptor(*_workers[0]->_ioservice, ip::tcp::endpoint(ip::tcp::v4(), _port));
+    _acceptor->non_blocking(true);
+  } catch(boost::system::system_error& e) {
+    LOG_WARNING(_logger, "accept: {}", e.what());
+    delete _acceptor;
+    _acceptor = nullptr;
+    return;
+  }
+
+  _accept_timer = new deadline_timer(*_workers[0]->_ioservice);
+  _accepted.resize(_workers.size());
+  arm_acceptor();
+}
+
+void
+OUCHSimulator::arm_acceptor() {
+  _acceptor->async_wait(socket_base::wait_read, [this](const boost::system::error_code& ec) { handle_accept(ec); });
+}
+
+// accept until the listen queue is empty or a batch is full, then hand the
+// sockets to their workers round-robin. a full batch continues from a
+// posted handler so a connection storm doesn't starve worker 0's sessions;
+// running out of descriptors backs off before trying again.
+void
+OUCHSimulator::handle_accept(const boost::system::error_code& error) {
+  if(error == boost::asio::error::operation_aborted || !_acceptor)
+    return;
+  if(error) {
+    LOG_WARNING(_logger, "{}: handle_accept: error={} {}", _name, error.value(), error.message());
+    return;
+  }
+
+  size_t accepted = 0;
+  int err = 0;
+  while(accepted < accept_batch) {
+    int fd = ::accept4(_acceptor->native_handle(), nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd < 0) {
+      if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+        continue;
+      if(errno != EAGAIN && errno != EWOULDBLOCK)
+        err = errno;
+      break;
+    }
+    _accepted[_next_worker++ % _workers.size()].push_back(fd);
+    accepted++;
+  }
+
+  for(size_t i=0; i<_workers.size(); i++) {
+    if(_accepted[i].empty())
+      continue;
+    IOWorker* worker = _workers[i].get();
+    boost::asio::post(*worker->_ioservice, [worker, fds = std::move(_accepted[i])] { worker->accept_connections(fds); });
+    _accepted[i].clear();
+  }
+
+  if(accepted == accept_batch) {
+    boost::asio::post(*_workers[0]->_ioservice, [this] { handle_accept(boost::system::error_code()); });
+  } else if(err) {
+    LOG_WARNING(_logger, "{}: accept: {}, retrying in 100ms", _name, strerror(err));
+    _accept_timer->expires_from_now(boost::posix_time::milliseconds(100));
+    _accept_timer->async_wait([this](const boost::system::error_code& ec) {
+      if(!ec && _acceptor)
+        arm_acceptor();
+    });
+  } else {
+    arm_acceptor();
+  }
+}
+
+void
+OUCHSimulator::stop_listener() {
+  if(_accept_timer)
+    _accept_timer->cancel();
+  delete _acceptor;
+  _acceptor = nullptr;
+}
+
+void
+OUCHSimulator::run() {
+  if(_itch)
+    _itch_thread = std::thread([this] { replay_itch(); });
+
+  for(size_t i=1; i<_workers.size(); i++) {
+    IOWorker* worker = _workers[i].get();
+    worker->_thread = std::thread([worker] { worker->run(); });
+  }
+
+  _workers[0]->run();
+
+  for(size_t i=1; i<_workers.size(); i++) {
+    if(_workers[i]->_thread.joinable())
+      _workers[i]->_thread.join();
+  }
+  if(_itch_thread.joinable())
+    _itch_thread.join();
+
+  if(_trace) {
+    _trace->stop();
+    LOG_INFO(_logger, "{}: trace {} bytes={} dropped={}", _name, _trace->path(), _trace->bytes(), _trace->dropped());
+  }
+  tsc_clock().stop();
+}
+
+void
+OUCHSimulator::shutdown() {
+  // workers and the feed go on trading until stopped
+  size_t occupancy = 0, high_water = 0, capacity = 0;
+  for(auto& shard : _shards) {
+    std::lock_guard<std::mutex> guard(shard->_lock);
+    occupancy += shard->_orders.occupancy();
+    high_water += shard->_orders.high_water();
+    capacity += shard->_orders.capacity();
+  }
+  LOG_INFO(_logger, "{}: orders occupancy={} high_water={} capacity={}", _name, occupancy, high_water, capacity);
+
+  _running = false;
+  stop_listener();
+  if(_stats_timer)
+    _stats_timer->cancel();
+  if(_signals)
+    _signals->cancel();
+  for(auto& worker : _workers)
+    worker->_ioservice->stop();
+}
+
+BookShard&
+OUCHSimulator::shard_for(const char* symbol) {
+  if(_shards.size() == 1)
+    return *_shards[0];
+
+  uint64_t key;
+  memcpy(&key, symbol, sizeof(key));
+  return *_shards[((key * 0x9e3779b97f4a7c15ULL) >> 32) % _shards.size()];
+}
+
+void
+OUCHSimulator::submit_order(OUCHConnection* conn, const elf::OUCH42::NewOrder* new_order) {
+  BookShard& shard = shard_for(new_order->symbol);
+  std::lock_guard<std::mutex> guard(shard._lock);
+
+  uint32_t symbol_id = shard.symbol_id(new_order->symbol);
+  if(symbol_id == SymbolDirectory::no_symbol) {
+    conn->send_reject(OUCH42::RejectReason::InvalidSymbol, new_order->token);
+    return;
+  }
+
+  // an order journaled without its session couldn't go back to it after a
+  // restart
+  uint16_t user = 0;
+  if(shard._journal && !conn->_username.empty()) {
+    user = shard._journal->user_id(conn->_username);
+    if(!user) {
+      LOG_WARNING(_logger, "{}: journal {} has no room for username {}, rejecting {}", _name, shard._journal->path(),
+                  conn->_username, string(new_order->token, sizeof(new_order->token)));
+      conn->send_reject(OUCH42::RejectReason::Other, new_order->token);
+      return;
+    }
+  }
+
+  oid_t oid = register_new_order(shard, conn, new_order, symbol_id, user);
+  if(oid==INVALID_OID) {
+    conn->send_reject(OUCH42::RejectReason::TestMode, new_order->token);
+    return;
+  }
+
+  conn->send_ack(new_order, oid);
+  match_order(shard, oid);
+}
+
+oid_t
+OUCHSimulator::register_new_order(BookShard& shard, OUCHConnection* conn, const elf::OUCH42::NewOrder* new_order,
+                                  uint32_t symbol_id, uint16_t user) {
+  oid_t oid = shard._orders.alloc();
+  if(oid==INVALID_OID)
+    return INVALID_OID;
+
+  OUCHOrder& order = shard._orders[oid];
+  order.state = OrderState::NEW;
+  memcpy(order.token, new_order->token, sizeof(order.token));
+  order.side = new_order->side;
+  order.qty = new_order->qty;
+  memcpy(order.symbol, new_order->symbol, sizeof(order.symbol));
+  order.px = new_order->px;
+  order.tif = new_order->tif;
+  memcpy(order.mpid, new_order->mpid, sizeof(order.mpid));
+  order.display = new_order->display;
+  order.capacity = new_order->capacity;
+  order.iso = new_order->iso;
+  order.minqty = new_order->minqty;
+  order.cross_type = new_order->cross_type;
+  order.user = user;
+  order.symbol_id = symbol_id;
+  order.conn = conn;
+  conn->_tokens.insert(order.token, oid);
+  journal(shard, order);
+  return oid;
+}
+
+void
+OUCHSimulator::match_order(BookShard& shard, oid_t oid) {
+  OUCHOrder& order = shard._orders[oid];
+  OrderBook& book = shard.book(order.symbol_id);
+  MarketBook* market = shard.market(order.symbol_id);
+  bool buy = OrderBook::is_buy(order.side);
+
+  // an order not yet traded takes nothing unless the book and the replayed
+  // market between them cross it by its minimum quantity; short of that it
+  // rests untouched, or is left to the fill model, which keeps the minimum
+  // itself, and canceled if immediate
+  uint32_t leaves = order.leaves();
+  uint32_t want = order.filled_qty ? 0 : std::min(order.minqty, leaves);
+  uint32_t crossing = want ? book.crossing(buy, order.px, want) : 0;
+  if(want && market && crossing < want)
+    crossing += market->crossing(buy, order.px, want - crossing);
+
+  if(crossing >= want) {
+    // a replayed market's levels priced through the book's best go first,
+    // the rest after the book
+    uint32_t pivot = 0;
+    if(market) {
+      const PriceLevel* best = buy ? book.best_ask() : book.best_bid();
+      pivot = best ? best->px : buy ? UINT32_MAX : 0;
+      fill_market(shard, oid, *market, pivot, true);
+    }
+
+    shard._fills.clear();
+    leaves = book.match(oid, shard._next_match_id, shard._fills);
+
+    for(const Fill& fill : shard._fills) {
+      OUCHOrder& passive = shard._orders[fill.passive];
+      journal(shard, passive);
+      deliver_fill(passive, fill);
+      order.conn->send_executed(order.token, fill, OUCH::Constants::LiqRemoved);
+      if(passive.state == OrderState::FILLED)
+        shard._orders.release(fill.passive);
+    }
+
+    if(leaves && market)
+      leaves = fill_market(shard, oid, *market, pivot, false);
+
+    if(!leaves) {
+      retire_order(shard, oid);
+      return;
+    }
+  }
+
+  if(order.tif == OUCH42::TimeInForce::Immediate) {
+    leaves = fill_ioc(shard, oid);
+    if(leaves) {
+      order.state = OrderState::CANCELED;
+      order.conn->send_canceled(order.token, leaves, OUCH42::CancelReason::ImmediateOrCancel);
+    }
+    retire_order(shard, oid);
+    return;
+  }
+
+  book.add(oid);
+  journal(shard, order);
+
+  // the market and system hours sessions outlast the simulator
+  if(order.tif < OUCH42::TimeInForce::MarketHours) {
+    uint64_t due = TSCClock::rdtsc() + tsc_clock().ns_to_ticks(uint64_t(order.tif) * 1000000000);
+    order.expiry = order.conn->_worker->schedule_timer(due, WorkerTimer{TimerKind::Expiry, 0, oid, nullptr});
+  }
+
+  const FillModel* model = _fill_models.find(order.symbol);
+  if(model && model->fills(shard._rng))
+    schedule_model_fill(order.conn->_worker, shard, *model, oid, model->max_fills);
+}
+
+// the model's fills of a resting order are timed, one at a time, by the
+// worker of the session that entered it
+void
+OUCHSimulator::schedule_model_fill(IOWorker* worker, BookShard& shard, const FillModel& model, oid_t oid, uint32_t fills_left) {
+  uint64_t due = TSCClock::rdtsc() + tsc_clock().ns_to_ticks(model.delay_ns(shard._rng));
+  worker->schedule_timer(due, WorkerTimer{TimerKind::ModelFill, fills_left, oid, nullptr});
+}
+
+// an order that has since traded away, been canceled or had its slot
+// reused is left alone; a detached one is filled without a report. returns
+// whether there was a fill.
+bool
+OUCHSimulator::model_fill(IOWorker* worker, oid_t oid, uint32_t fills_left) {
+  BookShard& shard = *_shards[OrderStore::store_of(oid)];
+  std::lock_guard<std::mutex> guard(shard._lock);
+
+  OUCHOrder* order = shard._orders.get(oid);
+  if(!order || order->state != OrderState::OPEN)
+    return false;
+  const FillModel* model = _fill_models.find(order->symbol);
+  if(!model)
+    return false;
+
+  uint32_t qty = model->fill_qty(shard._rng, order->leaves(), order->filled_qty ? 0 : order->minqty, fills_left);
+  if(!shard.book(order->symbol_id).execute(oid, qty))
+    return false;
+  Fill fill{oid, INVALID_OID, qty, order->px, shard._next_match_id++};
+  journal(shard, *order);
+  deliver_fill(*order, fill);
+
+  // both of the order's timers are on this worker
+  if(order->state == OrderState::FILLED) {
+    worker->_timers.cancel(order->expiry);
+    shard._orders.release(oid);
+  } else {
+    schedule_model_fill(worker, shard, *model, oid, fills_left - 1);
+  }
+  return true;
+}
+
+// runs on the worker that scheduled the expiry, which is the owning
+// session's, if it still has one. an order already gone is left alone.
+bool
+OUCHSimulator::expire_order(oid_t oid) {
+  BookShard& shard = *_shards[OrderStore::store_of(oid)];
+  std::lock_guard<std::mutex> guard(shard._lock);
+
+  OUCHOrder* order = shard._orders.get(oid);
+  if(!order || order->state != OrderState::OPEN)
+    return false;
+
+  uint32_t leaves = order->leaves();
+  shard.book(order->symbol_id).reduce(oid, 0);
+  order->state = OrderState::CANCELED;
+  order->expiry = 0;
+  if(order->conn)
+    order->conn->send_canceled(order->token, leaves, OUCH42::CancelReason::Timeout);
+  retire_order(shard, oid);
+  return true;
+}
+
+// what the book left of an immediate-or-cancel order may be filled by the
+// model straight away, in one execution. returns the shares still open.
+uint32_t
+OUCHSimulator::fill_ioc(BookShard& shard, oid_t oid) {
+  OUCHOrder& order = shard._orders[oid];
+  const FillModel* model = _fill_models.find(order.symbol);
+  if(!model || !model->fills(shard._rng))
+    return order.leaves();
+
+  uint32_t qty = model->fill_qty(shard._rng, order.leaves(), order.filled_qty ? 0 : order.minqty, model->max_fills);
+  Fill fill{INVALID_OID, oid, qty, order.px, shard._next_match_id++};
+  order.filled_qty += qty;
+  if(!order.leaves())
+    order.state = OrderState::FILLED;
+  order.conn->send_executed(order.token, fill, OUCH::Constants::LiqRemoved);
+  return order.leaves();
+}
+
+// takes the replayed market's displayed depth crossing the order, each
+// level at its own price. the feed's book is left as the feed has it, so
+// the market never sees the simulator's trades, but the shares taken are
+// marked on their level and not offered again until the feed changes it.
+// with ahead, only levels priced better than pivot are taken; otherwise
+// those at it or worse. returns the shares still open.
+uint32_t
+OUCHSimulator::fill_market(BookShard& shard, oid_t oid, MarketBook& market, uint32_t pivot, bool ahead) {
+  OUCHOrder& order = shard._orders[oid];
+  bool buy = OrderBook::is_buy(order.side);
+  const MarketBook::Levels& levels = buy ? market.asks() : market.bids();
+
+  for(auto it = levels.rbegin(); it != levels.rend() && order.leaves(); ++it) {
+    if(buy ? it->px > order.px : it->px < order.px)
+      break;
+    if(ahead != (buy ? it->px < pivot : it->px > pivot)) {
+      if(ahead)
+        break;
+      continue;
+    }
+
+    uint32_t qty = std::min(order.leaves(), it->available());
+    if(!qty)
+      continue;
+    Fill fill{INVALID_OID, oid, qty, it->px, shard._next_match_id++};
+    order.filled_qty += qty;
+    order.conn->send_executed(order.token, fill, OUCH::Constants::LiqRemoved);
+    market.take(!buy, it->px, qty);
+    shard._market_taken++;
+  }
+
+  if(!order.leaves())
+    order.state = OrderState::FILLED;
+  return order.leaves();
+}
+
+// shares the feed adds at a price crossing resting orders trade with them
+// at the orders' prices, in the book's priority, up to the shares added.
+// the shares that traded are taken from the feed's level.
+void
+OUCHSimulator::cross_resting(BookShard& shard, uint32_t symbol_id, const MarketOrder& added) {
+  OrderBook& book = shard.book(symbol_id);
+  uint32_t left = added.qty;
+  while(left) {
+    const PriceLevel* level = added.buy ? book.best_ask() : book.best_bid();
+    if(!level || (added.buy ? level->px > added.px : level->px < added.px))
+      break;
+
+    oid_t oid = level->head;
+    OUCHOrder& order = shard._orders[oid];
+    uint32_t qty = std::min(left, order.leaves());
+    book.execute(oid, qty);
+    Fill fill{oid, INVALID_OID, qty, order.px, shard._next_match_id++};
+    journal(shard, order);
+    deliver_fill(order, fill);
+    if(order.state == OrderState::FILLED)
+      shard._orders.release(oid);
+    left -= qty;
+    shard._market_crossed++;
+  }
+
+  if(left < added.qty)
+    shard.market(symbol_id)->take(added.buy, added.px, added.qty - left);
+}
+
+// the feed is pushed through its books a message at a time, each order
+// message under the lock of the shard its stock belongs to. stocks are
+// given to their shards by their directory messages; a book with none
+// yet, or in a stock not listed, is seen by nobody else and is built
+// without a lock.
+void
+OUCHSimulator::replay_itch() {
+  struct Route {
+    BookShard* shard;
+    uint32_t symbol_id;
+  };
+  vector<Route> routes(UINT16_MAX + 1, Route{nullptr, 0});
+  auto t0 = std::chrono::steady_clock::now();
+  bool finished = false;
+
+  try {
+    finished = _itch->read([&](const char* msg, size_t len) {
+      if(len < sizeof(ITCH50::Header))
+        return true;
+      if(!(_itch->messages() & 0xffff) && !running())
+        return false;
+
+      auto header = reinterpret_cast<const ITCH50::Header*>(msg);
+      uint16_t locate = header->locate;
+      if(ItchBooks::is_book_message(msg[0])) {
+        if(_itch_speed > 0 && !pace_itch(header->nanos()))
+          return false;
+        const Route& route = routes[locate];
+        if(!route.shard) {
+          _itch_books->apply(msg, len);
+          return true;
+        }
+        std::lock_guard<std::mutex> guard(route.shard->_lock);
+        if(const MarketOrder* added = _itch_books->apply(msg, len))
+          cross_resting(*route.shard, route.symbol_id, *added);
+        return true;
+      }
+
+      if(msg[0] == ITCH50::MessageType::StockDirectory) {
+        _itch_books->apply(msg, len);
+        MarketBook* market = _itch_books->book(locate);
+        if(!market)
+          return true;
+        BookShard& shard = shard_for(market->symbol);
+        std::lock_guard<std::mutex> guard(shard._lock);
+        uint32_t symbol_id = shard.symbol_id(market->symbol);
+        if(symbol_id == SymbolDirectory::no_symbol)
+          return true;
+        shard._markets[symbol_id] = market;
+        routes[locate] = Route{&shard, symbol_id};
+      }
+      return true;
+    });
+  } catch(const runtime_error& e) {
+    LOG_ERROR(_logger, "{}: replay: {}", _name, e.what());
+  }
+
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  uint64_t taken = 0, crossed = 0;
+  for(auto& shard : _shards) {
+    std::lock_guard<std::mutex> guard(shard->_lock);
+    taken += shard->_market_taken;
+    crossed += shard->_market_crossed;
+  }
+  LOG_INFO(_logger, "{}: replay {} {} messages={} secs={:.1f} msgs/s={:.0f} open orders={} unknown refs={} truncated={}",
+           _name, _itch->path(), finished ? "finished" : "stopped", _itch->messages(), secs, _itch->messages() / secs,
+           _itch_books->orders(), _itch_books->unknown_refs(), _itch->truncated());
+  LOG_INFO(_logger, "{}: replay market fills taken={} crossed={}", _name, taken, crossed);
+}
+
+// holds the feed back to its own clock, sped up, once a pace_ns of feed
+// time. messages before itch_from go as fast as they build. returns false
+// once the simulator stops.
+bool
+OUCHSimulator::pace_itch(uint64_t feed_ns) {
+  static constexpr uint64_t pace_ns = 100000;
+  if(feed_ns < _itch_paced_ns + pace_ns || feed_ns < _itch_from)
+    return true;
+
+  auto now = std::chrono::steady_clock::now();
+  _itch_paced_ns = feed_ns;
+  if(!_itch_start_ns) {
+    _itch_start_ns = feed_ns;
+    _itch_start = now;
+    return true;
+  }
+
+  auto due = _itch_start + std::chrono::nanoseconds(uint64_t((feed_ns - _itch_start_ns) / _itch_speed));
+  while(now < due) {
+    if(!running())
+      return false;
+    std::this_thread::sleep_until(std::min(due, now + std::chrono::milliseconds(100)));
+    now = std::chrono::steady_clock::now();
+  }
+  return true;
+}
+
+// the passive side may belong to a session on another worker, in which case
+// the report, the token cleanup and the expiry are handled by the owner
+void
+OUCHSimulator::deliver_fill(OUCHOrder& passive, const Fill& fill) {
+  OUCHConnection* conn = passive.conn;
+  bool done = passive.state == OrderState::FILLED;
+  if(!conn)
+    return;
+
+  if(conn->_worker == tls_worker) {
+    conn->send_executed(passive.token, fill, OUCH::Constants::LiqAdded);
+    if(done) {
+      conn->_tokens.erase(passive.token);
+      conn->_worker->_timers.cancel(passive.expiry);
+    }
+    return;
+  }
+
+  PassiveFill pf;
+  pf.conn = conn;
+  memcpy(pf.token, passive.token, sizeof(pf.token));
+  pf.fill = fill;
+  pf.expiry = passive.expiry;
+  pf.done = done;
+  conn->_worker->post_fill(pf);
+}
+
+oid_t
+OUCHSimulator::find_order(const OUCHConnection* conn, const char* token) const {
+  return conn->_tokens.find(token);
+}
+
+// qty is the new intended order size per OUCH 4.2; returns shares canceled
+uint32_t
+OUCHSimulator::cancel_order(OUCHConnection* conn, oid_t oid, uint32_t qty) {
+  uint32_t s = OrderStore::store_of(oid);
+  if(s >= _shards.size())
+    return 0;
+
+  BookShard& shard = *_shards[s];
+  std::lock_guard<std::mutex> guard(shard._lock);
+
+  OUCHOrder* order = shard._orders.get(oid);
+  if(!order || order->conn != conn || order->state != OrderState::OPEN || qty >= order->leaves())
+    return 0;
+
+  uint32_t canceled = order->leaves() - qty;
+  shard.book(order->symbol_id).reduce(oid, qty);
+  if(!qty) {
+    order->state = OrderState::CANCELED;
+    retire_order(shard, oid);
+  } else {
+    journal(shard, *order);
+  }
+  return canceled;
+}
+
+// qty is the replacement's open shares, per OUCH 4.2. one that keeps its
+// price and time in force and adds no shares is changed in place: the
+// order keeps its oid and its place in the queue, its token is swapped and
+// its leaves cut. any other replacement loses priority, so it is entered
+// as a new order with a new oid, matched and rested behind the rest of its
+// price, and the old order is retired.
+void
+OUCHSimulator::replace_order(OUCHConnection* conn, oid_t oid, const OUCH42::ReplaceOrder* replace) {
+  uint32_t s = OrderStore::store_of(oid);
+  if(s >= _shards.size())
+    return;
+
+  BookShard& shard = *_shards[s];
+  std::lock_guard<std::mutex> guard(shard._lock);
+
+  OUCHOrder* order = shard._orders.get(oid);
+  if(!order || order->conn != conn || order->state != OrderState::OPEN)
+    return;
+
+  uint32_t qty = replace->qty;
+  uint32_t px = replace->px;
+  uint32_t tif = replace->tif;
+  if(px == order->px && tif == order->tif && qty <= order->leaves()) {
+    if(qty < order->leaves())
+      shard.book(order->symbol_id).reduce(oid, qty);
+    conn->_tokens.erase(order->token);
+    memcpy(order->token, replace->token, sizeof(order->token));
+    conn->_tokens.insert(order->token, oid);
+    order->display = replace->display;
+    order->iso = replace->iso;
+    order->minqty = replace->minqty;
+    journal(shard, *order);
+    conn->send_replaced(*order, replace->existing_token);
+    return;
+  }
+
+  oid_t new_oid = shard._orders.alloc();
+  if(new_oid==INVALID_OID) {
+    conn->send_reject(OUCH42::RejectReason::TestMode, replace->token);
+    return;
+  }
+
+  OUCHOrder& replacement = shard._orders[new_oid];
+  replacement = *order;
+  replacement.state = OrderState::NEW;
+  replacement.oid = new_oid;
+  memcpy(replacement.token, replace->token, sizeof(replacement.token));
+  replacement.qty = qty;
+  replacement.filled_qty = 0;
+  replacement.px = px;
+  replacement.tif = tif;
+  replacement.display = replace->display;
+  replacement.iso = replace->iso;
+  replacement.minqty = replace->minqty;
+  replacement.prev = replacement.next = INVALID_OID;
+  replacement.expiry = 0;
+
+  shard.book(order->symbol_id).remove(oid);
+  order->state = OrderState::CANCELED;
+  retire_order(shard, oid);
+
+  conn->_tokens.insert(replacement.token, new_oid);
+  journal(shard, replacement);
+  conn->send_replaced(replacement, replace->existing_token);
+  match_order(shard, new_oid);
+}
+
+// a session's orders recovered from the journals go back to it at its first
+// login: their tokens go into its index and their fills are reported from
+// then on. fills while it was away went unreported. runs on the session's
+// worker.
+void
+OUCHSimulator::reattach_orders(OUCHConnection* conn) {
+  vector<oid_t> oids;
+  {
+    std::lock_guard<std::mutex> guard(_sessions_lock);
+    auto it = _recovered.find(conn->_username);
+    if(it == _recovered.end())
+      return;
+    oids.swap(it->second);
+    _recovered.erase(it);
+  }
+
+  size_t reattached = 0;
+  for(oid_t oid : oids) {
+    BookShard& shard = *_shards[OrderStore::store_of(oid)];
+    std::lock_guard<std::mutex> guard(shard._lock);
+    OUCHOrder* order = shard._orders.get(oid);
+    if(!order || order->state != OrderState::OPEN || order->conn)
+      continue;
+    order->conn = conn;
+    conn->_tokens.insert(order->token, oid);
+    reattached++;
+  }
+  LOG_INFO(_logger, "{}: reattached {} recovered orders", conn->_name, reattached);
+}
+
+// a closed session's resting orders stay in the book, like recovered ones:
+// they trade, but nobody hears about it. called by the owning worker before
+// the connection is reclaimed.
+void
+OUCHSimulator::detach_orders(const OUCHConnection* conn) {
+  if(!conn->_tokens.size())
+    return;
+
+  vector<oid_t> oids;
+  conn->_tokens.for_each_oid([&](oid_t oid) { oids.push_back(oid); });
+
+  for(auto& shard : _shards) {
+    uint32_t id = shard->_orders.store_id();
+    std::lock_guard<std::mutex> guard(shard->_lock);
+    for(oid_t oid : oids) {
+      if(OrderStore::store_of(oid) != id)
+        continue;
+      OUCHOrder* order = shard->_orders.get(oid);
+      if(order && order->conn == conn)
+        order->conn = nullptr;
+    }
+  }
+}
+
+// orders in a terminal state give back their slot, token and expiry
+// timer. only for orders owned by a session on the calling worker; orders
+// that end elsewhere leave their timer to find them gone.
+void
+OUCHSimulator::retire_order(BookShard& shard, oid_t oid) {
+  OUCHOrder& order = shard._orders[oid];
+  journal(shard, order);
+  if(order.conn) {
+    order.conn->_tokens.erase(order.token);
+    order.conn->_worker->_timers.cancel(order.expiry);
+  }
+  shard._orders.release(oid);
 }
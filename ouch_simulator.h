@@ -1,7 +1,12 @@
 #pragma once
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <mutex>
 #include <string>
-#include <set>
+#include <thread>
 #include <unordered_map>
 
 #include <boost/asio.hpp>
@@ -9,8 +14,28 @@
 #include <quill/Quill.h>
 
 #include "boost_enum.h"
+#include "handler_allocator.h"
 #include "rwbuffer.h"
+#include "ring_buffer.h"
+#include "buffer_pool.h"
+#include "slab.h"
 #include "ouch_structs.h"
+#include "soupbin_structs.h"
+#include "sequenced_store.h"
+#include "ouch_order.h"
+#include "order_store.h"
+#include "order_book.h"
+#include "order_journal.h"
+#include "fill_model.h"
+#include "market_book.h"
+#include "symbol_directory.h"
+#include "itch_reader.h"
+#include "token_index.h"
+#include "uring.h"
+#include "tsc_clock.h"
+#include "session_stats.h"
+#include "trace_recorder.h"
+#include "timing_wheel.h"
 
 namespace OUCHSim {
   using namespace std;
@@ -18,98 +43,477 @@ namespace OUCHSim {
 
   using Logger = quill::Logger;
 
-  typedef int64_t oid_t;
-  static const oid_t INVALID_OID = -1;
   typedef boost::asio::io_service IOService;
   typedef std::shared_ptr<boost::asio::io_service> IOServiceRP;
 
+  struct SimulatorConfig {
+    // 0 runs without a listener, for in-process sessions
+    int port = 4722;
+    // record the bytes of every session to trace_file, for ouch_tracedump
+    bool trace_messages = false;
+    string trace_file = "ouch_simulator.trace";
+    int threads = 1;
+    // spin on poll() instead of blocking in epoll; pin io threads to
+    // io_cpus[i] and the logger backend to log_cpu when given
+    bool busy_poll = false;
+    int busy_poll_usec = 50;
+    // receive and send through a per-worker io_uring instead of asio's
+    // reactor. a worker whose ring can't be set up stays on asio.
+    bool io_uring = false;
+    vector<int> io_cpus;
+    int log_cpu = -1;
+    // seconds between compact stats dumps, 0 to disable. SIGUSR1 always
+    // triggers a detailed dump.
+    int stats_interval = 60;
+    // directory for per-shard order journals, empty to run without. an
+    // existing journal is replayed at startup.
+    string journal_dir;
+    size_t journal_records = OrderJournal::default_records;
+    // speak SoupBinTCP rather than bare OUCH. sessions are named by the
+    // login username and outlive their connections; each keeps its
+    // sequenced output for replay in a store of soupbin_store_mb.
+    bool soupbin = false;
+    size_t soupbin_store_mb = 256;
+    string soupbin_session;
+    // per-symbol fill models for orders nobody trades with, see
+    // FillModelTable. each shard draws from its own generator, seeded from
+    // fill_seed, so a run is repeatable for the same input.
+    string fill_model;
+    uint64_t fill_seed = 1;
+    // the symbols to trade, see SymbolDirectory; orders in others are
+    // rejected. without a list any symbol trades.
+    string symbol_file;
+    // rebuild the market's books from a TotalView-ITCH 5.0 file, plain or
+    // gzip, on a thread of its own. orders crossing the replayed depth
+    // trade with it, and liquidity the feed adds trades with resting
+    // orders it crosses. the feed is paced to its timestamps, itch_speed
+    // times faster, from itch_from (ns since midnight) on; a speed of 0
+    // replays as fast as the books build.
+    string itch_file;
+    double itch_speed = 1;
+    uint64_t itch_from = 0;
+  };
+
   BOOST_ENUM(ConnectionState,
              (Initial)
+             (LoggingIn)
              (Connected)
+             (Disconnected)
              (Shutdown)
              );
 
   class OUCHSimulator;
+  struct IOWorker;
 
   struct OUCHConnection {
-    OUCHConnection(OUCHSimulator* sim, IOServiceRP iosvc);
+    OUCHConnection(OUCHSimulator* sim, IOWorker* worker);
+    ~OUCHConnection();
     void shutdown();
     void start();
-    void handle_read(const boost::system::error_code& ec, size_t bytes_transferred);
-    void consume_buffer(RWBuffer& buffer);
+    void start_detached(const string& name);
+    void disconnect();
+    void arm_read();
+    void handle_readable(uint64_t gen, const boost::system::error_code& ec);
+    void handle_read(uint64_t gen, const boost::system::error_code& ec, size_t bytes_transferred);
+    void consume_buffer(RingBuffer& buffer);
+    size_t handle_message(const char* msg, size_t avail);
+    void handle_new_order(const elf::OUCH42::NewOrder* new_order);
+    void handle_cancel(const elf::OUCH42::CancelOrder* cxl);
+    void handle_replace(const elf::OUCH42::ReplaceOrder* replace);
     void send_raw(const char* buf, size_t len);
+    void reserve_send();
+    void flush();
+    void write_sending();
+    bool advance_send(size_t n);
+    void finish_send();
+    bool send_overrun();
+    void send_failed(int err);
+    void close_socket();
+    template <typename T> T* begin_send();
+
+    // soupbin
+    void consume_soupbin(RingBuffer& buffer);
+    void handle_login(const elf::SoupBin::LoginRequest* req, RingBuffer& buffer);
+    void accept_login(uint64_t seq);
+    void reject_login(char reason);
+    void adopt(int fd, const string& peer, uint64_t seq, const string& pending);
+    void arm_heartbeat(uint64_t last_send);
+    void check_heartbeat();
+
+    // io_uring
+    void handle_recv(const io_uring_cqe& cqe);
+    void handle_send(const io_uring_cqe& cqe);
 
     void send_ack(const elf::OUCH42::NewOrder* new_order, oid_t oid);
+    void send_replaced(const OUCHOrder& order, const char* previous_token);
     void send_reject(const char reason, const char* token);
-    void send_canceled(const elf::OUCH42::CancelOrder* user_cxl, oid_t oid);
+    void send_canceled(const char* token, uint32_t qty, char reason);
+    void send_executed(const char* token, const Fill& fill, char liq_flag);
+    void trace(uint8_t kind, const char* data, size_t len);
+    void trace_name() { trace(TraceKind::Name, _name.data(), _name.size()); }
 
+    // identifies the connection in the trace
+    uint32_t _id;
     ConnectionState _state;
     boost::asio::ip::tcp::socket* _socket;
     OUCHSimulator* _ouch_sim;
+    IOWorker* _worker;
     Logger* _logger;
-    RWBuffer _recv_buffer;
+    // the buffers come from the worker's pool while there is data in them;
+    // _recv_room is the space asked for ahead of the next read
+    RingBuffer _recv_buffer;
+    RingBuffer _send_buffer;
+    RingBuffer _sending;
+    size_t _recv_room;
+    bool _flush_scheduled = false;
+    TokenIndex _tokens;
+    SessionStats _stats;
+    HandlerMemory _read_memory;
+    uint64_t _read_tsc = 0;
     string _peer;
     string _name;
+
+    // soupbin session state. _sent_pos is the store position sent, or being
+    // sent, to the current connection; reads and sends carry _read_gen so
+    // that completions for a replaced socket are ignored. _heartbeat is the
+    // session's timer on the worker's wheel.
+    bool _soupbin = false;
+    string _username;
+    std::unique_ptr<SequencedStore> _store;
+    uint64_t _sent_pos = 0;
+    uint64_t _read_gen = 0;
+    uint64_t _last_recv_tsc = 0;
+    uint64_t _last_send_tsc = 0;
+    uint64_t _heartbeat = 0;
+
+    // output being written: _send_msg gathers the unsequenced part, moved
+    // from _send_buffer to _sending, and the store's spans from _send_from
+    // up to _sent_pos. what the socket doesn't take at once is written when
+    // it is writable again, and output queued meanwhile waits for the next
+    // send.
+    msghdr _send_msg;
+    iovec _send_iov[3];
+    size_t _send_total = 0;
+    uint64_t _send_tsc = 0;
+    uint64_t _send_from = 0;
+    bool _send_waiting = false;
+
+    // io_uring: the multishot receive stays armed across reads. a retired
+    // connection is reclaimed once none of its receives or sends are left
+    // in the kernel.
+    bool _recv_armed = false;
+    unsigned _recvs_inflight = 0;
+    unsigned _sends_inflight = 0;
+
+    // shut down and queued for its worker to reclaim
+    bool _retired = false;
   };
 
-  typedef std::set<OUCHConnection*> OUCHConnectionSet;
+  // handle_message result for a message type we don't know
+  static constexpr size_t unknown_message = SIZE_MAX;
 
-  BOOST_ENUM(OrderState,
-             (INITIAL)
-             (NEW)
-             (OPEN)
-             (CANCELED)
-             (FILLED)
-             (REJECTED)
+  // execution report for a resting order whose session lives on another
+  // worker; queued in that worker's mailbox. an order done trading has its
+  // expiry canceled there, on the wheel it was scheduled on.
+  struct PassiveFill {
+    OUCHConnection* conn;
+    char token[14];
+    Fill fill;
+    uint64_t expiry;
+    bool done;
+  };
+
+  BOOST_ENUM(TimerKind,
+             (ModelFill)
+             (Expiry)
+             (Heartbeat)
              );
 
-  struct OUCHOrder {
-    OrderState state = OrderState::INITIAL;
-    char token[14];
-    char side;
-    uint32_t qty = 0;
-    uint32_t filled_qty = 0;
-    char symbol[8];
-    uint32_t px = 0;
-    uint32_t tif = 0;
-    char mpid[4];
-    char display;
-    uint64_t oid;
-    char capacity;
-    char iso;
-    uint32_t minqty = 0;
-    char cross_type;
+  // an entry on a worker's timing wheel: the next model fill of an order,
+  // the end of an order's time in force, or a session's heartbeat check
+  struct WorkerTimer {
+    TimerKind kind;
+    uint32_t fills_left;
+    oid_t oid;
+    OUCHConnection* conn;
   };
 
+  typedef TimingWheel<WorkerTimer> WorkerTimers;
+
+  // one io_service and the thread that runs it. connections are pinned to a
+  // worker for life: they live in its slab, draw buffers from its pool, and
+  // their token index and socket are only touched from its thread.
+  struct IOWorker {
+    IOWorker(OUCHSimulator* sim, int id, int cpu);
+    ~IOWorker();
+    void enter();
+    void run();
+    void flush_pending();
+    void post_fill(const PassiveFill& pf);
+    void drain_mailbox();
+    OUCHConnection* new_connection();
+    void accept_connections(const vector<int>& fds);
+    void retire(OUCHConnection* conn);
+    void schedule_reclaim();
+    void reclaim_connections();
+    void dump_stats(bool detail);
+    void init_uring();
+    void arm_uring_wakeup();
+    void reap_uring();
+    void submit_recv(OUCHConnection* conn);
+    void queue_send(OUCHConnection* conn);
+    void submit_send(OUCHConnection* conn);
+    void poll_sends();
+    void cancel_recv(OUCHConnection* conn);
+    WorkerTimers::Handle schedule_timer(uint64_t due_tsc, const WorkerTimer& timer);
+    void arm_timers();
+    void run_timers();
+    void fire_timer(const WorkerTimer& timer);
+    uint64_t timer_now() const { return TSCClock::rdtsc() / _tick_tsc; }
+
+    // outbound messages are coalesced per connection and written once per
+    // read cycle
+    void schedule_flush(OUCHConnection* conn) { _flush_list.push_back(conn); }
+
+    OUCHSimulator* _ouch_sim;
+    int _id;
+    int _cpu;
+    // handler memory for the mailbox drain and the io_uring wakeup; declared
+    // ahead of the io_service, which frees operations still queued
+    HandlerMemory _mailbox_memory;
+    HandlerMemory _wakeup_memory;
+    HandlerMemory _timer_memory[2];
+    IOServiceRP _ioservice;
+    boost::asio::executor_work_guard<IOService::executor_type> _work;
+    vector<OUCHConnection*> _flush_list;
+    std::mutex _mailbox_lock;
+    vector<PassiveFill> _mailbox;
+    vector<PassiveFill> _draining;
+    bool _mailbox_posted = false;
+    std::thread _thread;
+    // this thread's ring in the simulator's trace, when tracing
+    TraceRing* _trace = nullptr;
+
+    // model fills and time-in-force expiry for orders of this worker's
+    // sessions, and their heartbeats, on a wheel turning every timer_tick.
+    // _timer_due is the first tick with anything to do: a busy-polling run
+    // loop checks for it between polls, otherwise _timer wakes the worker.
+    // re-arming cancels the wait in flight, which still holds its handler
+    // memory until it completes, so the two blocks take turns.
+    static constexpr std::chrono::microseconds timer_tick{100};
+    uint64_t _tick_tsc;
+    WorkerTimers _timers;
+    uint64_t _timer_due = WorkerTimers::no_tick;
+    std::unique_ptr<boost::asio::steady_timer> _timer;
+    uint64_t _model_fills = 0;
+    uint64_t _expired = 0;
+
+    // connections live in _slab. one that shuts down is retired, and
+    // reclaimed later from a handler of its own; the stats of reclaimed
+    // sessions are folded into _closed_stats. receive and send buffers are
+    // drawn from _buffers while they hold data: reads ask for recv_read_min
+    // and more as input queues up, to at most recv_buffer_max.
+    static constexpr size_t recv_read_min = 2048;
+    static constexpr size_t recv_buffer_max = 128*1024;
+    static constexpr size_t send_buffer_size = 64*1024;
+    Slab<OUCHConnection> _slab;
+    vector<OUCHConnection*> _conns;
+    vector<OUCHConnection*> _retired;
+    vector<OUCHConnection*> _reclaiming;
+    bool _reclaim_posted = false;
+    SessionStats _closed_stats;
+    BufferPool _buffers{recv_buffer_max};
+
+    // io_uring backend. completions are copied out of the ring and handled
+    // in batches; sends queued while flushing go to the kernel in one call.
+    // a connection whose output outgrows its send in flight polls for the
+    // sends done so far, through _sends.
+    static constexpr unsigned uring_entries = 1024;
+    static constexpr uint16_t uring_buffer_group = 0;
+    static constexpr unsigned uring_buffers = 512;
+    static constexpr size_t uring_buffer_size = 16*1024;
+    std::unique_ptr<IOUring> _uring;
+    std::unique_ptr<boost::asio::posix::stream_descriptor> _uring_wakeup;
+    vector<io_uring_cqe> _completions;
+    vector<io_uring_cqe> _sends;
+    bool _reaping = false;
+    bool _flushing = false;
+  };
+
+  typedef std::unique_ptr<IOWorker> IOWorkerP;
+
+  // a partition of the symbol space: order store, books and match id
+  // sequence for every symbol hashing to it, guarded by one lock
+  struct BookShard {
+    BookShard(uint32_t id, const SymbolDirectory& symbols);
+    uint32_t symbol_id(const char* symbol);
+    OrderBook& book(uint32_t symbol_id)     { return _books[symbol_id]; }
+    MarketBook* market(uint32_t symbol_id)  { return _markets[symbol_id]; }
+
+    std::mutex _lock;
+    OrderStore _orders;
+    // per-symbol state, by the symbol's id in the directory or, without
+    // one, in the order the shard first saw the symbol
+    const SymbolDirectory& _symbols;
+    unordered_map<uint64_t, uint32_t> _symbol_ids;
+    vector<OrderBook> _books;
+    // the replayed market's books for the shard's symbols, owned by the
+    // replay and changed by it under the lock
+    vector<MarketBook*> _markets;
+    // executions against the replayed market: orders taking its depth, and
+    // resting orders its new liquidity traded with
+    uint64_t _market_taken = 0;
+    uint64_t _market_crossed = 0;
+    FillList _fills;
+    uint64_t _next_match_id;
+    std::unique_ptr<OrderJournal> _journal;
+    std::mt19937_64 _rng;
+  };
+
+  typedef std::unique_ptr<BookShard> BookShardP;
+
+  // threading model
+  //
+  // - each of the N workers runs its own io_service; accepted connections are
+  //   assigned round-robin and are only ever serviced by their worker.
+  // - the acceptor belongs to worker 0, which hands accepted sockets to the
+  //   workers; each creates and reclaims its own connections.
+  // - order state is partitioned into book shards by symbol. a worker locks
+  //   the shard for the symbol (or, for cancels, the shard encoded in the
+  //   oid) for the duration of a register/match/cancel.
+  // - fills against a resting order owned by a session on another worker are
+  //   handed to that worker's mailbox; the owner writes the execution and
+  //   drops the token. until then a lookup of the token yields a stale oid,
+  //   which the shard's OrderStore rejects by generation.
   class OUCHSimulator {
   public:
     OUCHSimulator() = default;
-    void init(int port, bool trace_messages);
+    void init(const SimulatorConfig& config);
     void run();
     void shutdown();
     auto get_logger() { return _logger; }
-    bool trace_messages() { return _trace_messages; }
+    uint32_t next_connection_id() { return _next_connection_id.fetch_add(1, std::memory_order_relaxed); }
+    bool running() const { return _running; }
+    IOWorker* worker(size_t i) { return _workers[i].get(); }
+    bool busy_poll() const { return _busy_poll; }
+    int busy_poll_usec() const { return _busy_poll_usec; }
+    bool io_uring() const { return _io_uring; }
+    bool soupbin() const { return _soupbin; }
+    const string& session_id() const { return _session_id; }
+    size_t soupbin_store_bytes() const { return _soupbin_store_bytes; }
+    OUCHConnection* login(OUCHConnection* conn, const string& username);
 
     // om
-    oid_t register_new_order(const elf::OUCH42::NewOrder* new_order);
-    oid_t find_order(const char* token) const;
-    void cancel_order(oid_t oid);
+    void submit_order(OUCHConnection* conn, const elf::OUCH42::NewOrder* new_order);
+    oid_t find_order(const OUCHConnection* conn, const char* token) const;
+    uint32_t cancel_order(OUCHConnection* conn, oid_t oid, uint32_t qty);
+    void replace_order(OUCHConnection* conn, oid_t oid, const elf::OUCH42::ReplaceOrder* replace);
+    void reattach_orders(OUCHConnection* conn);
+    void detach_orders(const OUCHConnection* conn);
+    bool model_fill(IOWorker* worker, oid_t oid, uint32_t fills_left);
+    bool expire_order(oid_t oid);
+    bool fill_model() const { return !_fill_models.empty(); }
 
   private:
     void init_listener();
     void stop_listener();
-    void handle_accept(OUCHConnection* conn, const boost::system::error_code& error);
+    void handle_accept(const boost::system::error_code& error);
     void arm_acceptor();
+    void init_trace(const SimulatorConfig& config);
+    void init_stats();
+    void arm_stats_timer();
+    void handle_signal(const boost::system::error_code& ec, int signum);
+    void dump_stats(bool detail);
+    void init_journal(const SimulatorConfig& config);
+    void recover_shard(BookShard& shard, const string& path, size_t records);
+    void apply_journal(BookShard& shard, const JournalRecord& rec, vector<oid_t>& opened, vector<oid_t>& pending);
+    void journal(BookShard& shard, const OUCHOrder& order);
+    BookShard& shard_for(const char* symbol);
+    oid_t register_new_order(BookShard& shard, OUCHConnection* conn, const elf::OUCH42::NewOrder* new_order,
+                             uint32_t symbol_id, uint16_t user);
+    void match_order(BookShard& shard, oid_t oid);
+    void deliver_fill(OUCHOrder& passive, const Fill& fill);
+    void retire_order(BookShard& shard, oid_t oid);
+    void schedule_model_fill(IOWorker* worker, BookShard& shard, const FillModel& model, oid_t oid, uint32_t fills_left);
+    uint32_t fill_ioc(BookShard& shard, oid_t oid);
+    void replay_itch();
+    bool pace_itch(uint64_t feed_ns);
+    uint32_t fill_market(BookShard& shard, oid_t oid, MarketBook& market, uint32_t pivot, bool ahead);
+    void cross_resting(BookShard& shard, uint32_t symbol_id, const MarketOrder& added);
 
   private:
-    bool _running = false;
+    std::atomic<bool> _running{false};
     string _name;
     Logger* _logger = nullptr;
-    IOServiceRP _ioservice;
     int _port = 0;
-    bool _trace_messages = false;
+    std::unique_ptr<TraceRecorder> _trace;
+    std::atomic<uint32_t> _next_connection_id{1};
+    bool _busy_poll = false;
+    int _busy_poll_usec = 0;
+    bool _io_uring = false;
+    int _stats_interval = 0;
+    // the listen queue is drained accept_batch at a time; each worker's
+    // share of a batch is handed over in one post
+    static constexpr size_t accept_batch = 64;
     boost::asio::ip::tcp::acceptor* _acceptor = nullptr;
-    OUCHConnectionSet _conn_set;
-    vector<OUCHOrder> _orders;
+    boost::asio::deadline_timer* _accept_timer = nullptr;
+    vector<vector<int>> _accepted;
+    boost::asio::signal_set* _signals = nullptr;
+    boost::asio::deadline_timer* _stats_timer = nullptr;
+    vector<IOWorkerP> _workers;
+    size_t _next_worker = 0;
+    vector<BookShardP> _shards;
+    bool _soupbin = false;
+    size_t _soupbin_store_bytes = 0;
+    string _session_id;
+    std::mutex _sessions_lock;
+    unordered_map<string, OUCHConnection*> _sessions;
+    // orders recovered from the journals by the username that entered
+    // them, until its session logs in; under _sessions_lock
+    unordered_map<string, vector<oid_t>> _recovered;
+    FillModelTable _fill_models;
+    SymbolDirectory _symbols;
+    std::unique_ptr<ItchReader> _itch;
+    double _itch_speed = 0;
+    uint64_t _itch_from = 0;
+    std::unique_ptr<ItchBooks> _itch_books;
+    std::thread _itch_thread;
+    // when pacing began, by the clock and by the feed; used by the replay
+    // thread only
+    std::chrono::steady_clock::time_point _itch_start;
+    uint64_t _itch_start_ns = 0;
+    uint64_t _itch_paced_ns = 0;
   };
+
+  // construct an outbound message in place in the connection's send buffer,
+  // stamped with nanoseconds since midnight
+  template <typename T>
+  T*
+  OUCHConnection::begin_send() {
+    if(!_flush_scheduled) {
+      _flush_scheduled = true;
+      _worker->schedule_flush(this);
+    }
+    _stats.msgs_out++;
+
+    // soupbin output is framed and sequenced straight into the store
+    T* msg;
+    if(_store) {
+      char* p = _store->append(sizeof(SoupBin::Header) + sizeof(T));
+      SoupBin::set_header(p, SoupBin::PacketType::SequencedData, sizeof(T));
+      msg = new (p + sizeof(SoupBin::Header)) T();
+    } else {
+      if(!_send_buffer.prepare_write(sizeof(T)))
+        reserve_send();
+      msg = _send_buffer.try_produce_struct<T>();
+    }
+    msg->timestamp = tsc_clock().nanos_since_midnight();
+    return msg;
+  }
+
+  inline void
+  OUCHConnection::trace(uint8_t kind, const char* data, size_t len) {
+    if(__builtin_expect(_worker->_trace != nullptr, 0))
+      _worker->_trace->record(kind, _id, TSCClock::rdtsc(), data, len);
+  }
 }
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
 
@@ -11,8 +12,6 @@ using namespace std;
 using namespace elf;
 using namespace OUCHSim;
 
-OUCHSimulator* __ouch_sim = nullptr;
-
 const char*
 ouch_simulator_version() {
 #ifdef VERSION
@@ -27,12 +26,30 @@ show_version() {
   cout << ouch_simulator_version() << endl;
 }
 
-void
-signal_handler(int signum) {
-  if(__ouch_sim) {
-    __ouch_sim->shutdown();
-    __ouch_sim = nullptr;
+vector<int>
+parse_cpu_list(const string& s) {
+  vector<int> cpus;
+  size_t pos = 0;
+  while(pos < s.size()) {
+    size_t end = s.find(',', pos);
+    if(end == string::npos)
+      end = s.size();
+    if(end > pos)
+      cpus.push_back(stoi(s.substr(pos, end - pos)));
+    pos = end + 1;
   }
+  return cpus;
+}
+
+// HH:MM[:SS] as nanoseconds since midnight
+uint64_t
+parse_time_of_day(const string& s) {
+  unsigned h = 0, m = 0, sec = 0;
+  char tail;
+  int n = sscanf(s.c_str(), "%u:%u:%u%c", &h, &m, &sec, &tail);
+  if(n < 2 || n > 3 || h > 23 || m > 59 || sec > 59)
+    throw runtime_error("bad time of day " + s + ", expected HH:MM[:SS]");
+  return ((h * 60 + m) * 60 + sec) * 1000000000ULL;
 }
 
 int
@@ -41,7 +58,26 @@ main(int argc, char** argv) {
   parser.helpParams.addDefault = true;
   args::ValueFlag<int> port(parser, "port", "specify listen port", {'p'}, 4722);
   args::Flag version(parser, "version", "show version", {'v', "version"});
-  args::Flag trace_messages(parser, "trace_messages", "trace messages", {'t', "trace-messages"}, false);
+  args::Flag trace_messages(parser, "trace_messages", "record every session's messages to the trace file", {'t', "trace-messages"}, false);
+  args::ValueFlag<string> trace_file(parser, "file", "trace file written with --trace-messages, read by ouch_tracedump", {"trace-file"}, "ouch_simulator.trace");
+  args::ValueFlag<int> threads(parser, "threads", "number of io threads and book shards", {'n', "threads"}, 1);
+  args::Flag busy_poll(parser, "busy_poll", "spin on the io services instead of blocking", {"busy-poll"}, false);
+  args::ValueFlag<int> busy_poll_usec(parser, "usec", "SO_BUSY_POLL on accepted sockets in busy-poll mode", {"busy-poll-usec"}, 50);
+  args::Flag io_uring(parser, "io_uring", "receive and send through io_uring, falling back to asio where unavailable", {"io-uring"}, false);
+  args::ValueFlag<string> io_cpus(parser, "cpus", "comma separated cpus to pin io threads to", {"io-cpus"}, "");
+  args::ValueFlag<int> log_cpu(parser, "cpu", "cpu to pin the logger backend thread to", {"log-cpu"}, -1);
+  args::ValueFlag<string> journal_dir(parser, "dir", "journal order state to dir and recover from it at startup", {"journal"}, "");
+  args::ValueFlag<size_t> journal_records(parser, "records", "records preallocated per shard journal, doubled when full", {"journal-records"}, OrderJournal::default_records);
+  args::Flag soupbin(parser, "soupbin", "speak SoupBinTCP: login, heartbeats and sequenced, replayable output", {"soupbin"}, false);
+  args::ValueFlag<size_t> soupbin_store_mb(parser, "mb", "per-session store of sequenced output kept for replay", {"soupbin-store-mb"}, 256);
+  args::ValueFlag<string> soupbin_session(parser, "session", "soupbin session id, defaults to the date", {"soupbin-session"}, "");
+  args::ValueFlag<string> symbols(parser, "file", "symbols to trade, one per line; orders in others are rejected", {"symbols"}, "");
+  args::ValueFlag<string> fill_model(parser, "file", "per-symbol fill model for orders with no counterparty", {"fill-model"}, "");
+  args::ValueFlag<uint64_t> fill_seed(parser, "seed", "seed for the fill model", {"fill-seed"}, 1);
+  args::ValueFlag<string> itch(parser, "file", "replay market books from a TotalView-ITCH 5.0 file, plain or gzip", {"itch"}, "");
+  args::ValueFlag<double> itch_speed(parser, "x", "replay speed relative to the feed's timestamps, 0 for as fast as possible", {"itch-speed"}, 1);
+  args::ValueFlag<string> itch_from(parser, "HH:MM:SS", "replay as fast as possible up to this feed time, paced after", {"itch-from"}, "");
+  args::ValueFlag<int> stats_interval(parser, "seconds", "interval between stats dumps, 0 to disable (SIGUSR1 dumps on demand)", {"stats-interval"}, 60);
 
   try {
     parser.ParseCLI(argc, argv);
@@ -56,16 +92,38 @@ main(int argc, char** argv) {
     exit(0);
   }
 
+  // SIGINT and SIGTERM are handled by the simulator once it is running
   OUCHSimulator ouch_sim;
-  __ouch_sim = &ouch_sim;
 
-  ::signal(SIGINT, signal_handler);
-  ::signal(SIGTERM, signal_handler);
   ::signal(SIGHUP, SIG_IGN);
   ::signal(SIGPIPE, SIG_IGN);
 
+  SimulatorConfig config;
+  config.port = args::get(port);
+  config.trace_messages = args::get(trace_messages);
+  config.trace_file = args::get(trace_file);
+  config.threads = args::get(threads);
+  config.busy_poll = args::get(busy_poll);
+  config.busy_poll_usec = args::get(busy_poll_usec);
+  config.io_uring = args::get(io_uring);
+  config.log_cpu = args::get(log_cpu);
+  config.stats_interval = args::get(stats_interval);
+  config.soupbin = args::get(soupbin);
+  config.soupbin_store_mb = std::max<size_t>(1, args::get(soupbin_store_mb));
+  config.soupbin_session = args::get(soupbin_session);
+  config.journal_dir = args::get(journal_dir);
+  config.journal_records = std::max<size_t>(1, args::get(journal_records));
+  config.symbol_file = args::get(symbols);
+  config.fill_model = args::get(fill_model);
+  config.fill_seed = args::get(fill_seed);
+  config.itch_file = args::get(itch);
+  config.itch_speed = args::get(itch_speed);
+
   try {
-    ouch_sim.init(args::get(port), args::get(trace_messages));
+    config.io_cpus = parse_cpu_list(args::get(io_cpus));
+    if(!args::get(itch_from).empty())
+      config.itch_from = parse_time_of_day(args::get(itch_from));
+    ouch_sim.init(config);
     ouch_sim.run();
   } catch (const std::runtime_error& e) {
     cout << "Error: " << e.what() << endl;
@@ -4,6 +4,8 @@
 
 #include <string>
 
+#include "big_endian.h"
+
 namespace elf {
 
   namespace OUCH {
@@ -27,6 +29,7 @@ namespace elf {
       static const char Agency              = 'A';
       static const char Principal           = 'P';
       static const char Riskless            = 'R';
+      static const char CapacityOther       = 'O';
       static const char ISOEligible         = 'Y';
       static const char ISONonEligible      = 'N';
       static const char CrossNone           = 'N';
@@ -34,11 +37,22 @@ namespace elf {
       static const char StartOfDay          = 'S';
       static const char EndOfDay            = 'E';
       static const char DisplayAttributable = 'A';
+      static const char DisplayAnonymous    = 'Y';
+      static const char DisplayNone         = 'N';
+      static const char DisplayPostOnly     = 'P';
+      static const char DisplayImbalance    = 'I';
+      static const char DisplayMidpoint     = 'M';
+      static const char DisplayMidpointPost = 'W';
+      static const char DisplayPostOnlyAttr = 'L';
+      static const char DisplayRetail1      = 'O';
+      static const char DisplayRetail2      = 'T';
+      static const char DisplayRetailPI     = 'Q';
     }
 
     namespace MessageType {
       static const char NewOrder       = 'O';
       static const char CancelOrder    = 'X';
+      static const char ReplaceOrder   = 'U';
       static const char SystemEvent    = 'S';
       static const char OrderAck       = 'A';
       static const char OrderCanceled  = 'C';
@@ -49,112 +63,300 @@ namespace elf {
       static const char CancelRejected = 'I';
       static const char PriorityUpdate = 'T';
       static const char OrderModified  = 'M';
+      static const char OrderReplaced  = 'U';
+    }
+
+    namespace RejectReason {
+      static const char TestMode        = 'T';
+      static const char Halted          = 'H';
+      static const char QtyExceeded     = 'Z';
+      static const char InvalidSymbol   = 'S';
+      static const char InvalidDisplay  = 'D';
+      static const char Closed          = 'C';
+      static const char InvalidPrice    = 'X';
+      static const char InvalidMinQty   = 'N';
+      static const char Other           = 'O';
+    }
+
+    namespace CancelReason {
+      static const char UserRequested     = 'U';
+      static const char ImmediateOrCancel = 'I';
+      static const char Timeout           = 'T';
+      static const char Supervisory       = 'S';
+      static const char Regulatory        = 'D';
+      static const char SelfMatch         = 'Q';
+      static const char System            = 'Z';
+    }
+
+    // other values are a lifetime in seconds
+    namespace TimeInForce {
+      static const uint32_t Immediate   = 0;
+      static const uint32_t MarketHours = 99998;
+      static const uint32_t SystemHours = 99999;
     }
 
     struct __attribute__((__packed__)) NewOrder {
     NewOrder() : type(MessageType::NewOrder), qty(0), px(0), tif(0), minqty(0) {}
+      static constexpr char msg_type = MessageType::NewOrder;
       char type;
       char token[14];
       char side;
-      uint32_t qty;
+      be32_t qty;
       char symbol[8];
-      uint32_t px;
-      uint32_t tif;
+      be32_t px;
+      be32_t tif;
       char mpid[4];
       char display;
       char capacity;
       char iso;
-      uint32_t minqty;
+      be32_t minqty;
       char cross_type;
       char customer_type;
-
-      void prepare_send();
     };
 
     struct __attribute__((__packed__)) CancelOrder {
     CancelOrder() : type(MessageType::CancelOrder), qty(0) {}
+      static constexpr char msg_type = MessageType::CancelOrder;
       char type;
       char token[14];
-      uint32_t qty;
-      void prepare_send();
+      be32_t qty;
+    };
+
+    // the replacement token is named token, as in every other inbound
+    // message, so a reject quotes it
+    struct __attribute__((__packed__)) ReplaceOrder {
+    ReplaceOrder() : type(MessageType::ReplaceOrder), qty(0), px(0), tif(0), minqty(0) {}
+      static constexpr char msg_type = MessageType::ReplaceOrder;
+      char type;
+      char existing_token[14];
+      char token[14];
+      be32_t qty;
+      be32_t px;
+      be32_t tif;
+      char display;
+      char iso;
+      be32_t minqty;
     };
 
     struct __attribute__((__packed__)) SystemEvent {
     SystemEvent() : type(MessageType::SystemEvent), timestamp(0), event_code('_') {}
+      static constexpr char msg_type = MessageType::SystemEvent;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char event_code;
     };
 
     struct __attribute__((__packed__)) OrderAck {
     OrderAck() : type(MessageType::OrderAck), timestamp(0) {}
+      static constexpr char msg_type = MessageType::OrderAck;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char token[14];
       char side;
-      uint32_t qty;
+      be32_t qty;
       char symbol[8];
-      uint32_t px;
-      uint32_t tif;
+      be32_t px;
+      be32_t tif;
       char mpid[4];
       char display;
-      uint64_t oid;
+      be64_t oid;
       char capacity;
       char iso;
-      uint32_t minqty;
+      be32_t minqty;
       char cross_type;
       char state;
     };
 
+    // the replacement order, laid out as an ack, and the token it replaced
+    struct __attribute__((__packed__)) OrderReplaced {
+    OrderReplaced() : type(MessageType::OrderReplaced), timestamp(0) {}
+      static constexpr char msg_type = MessageType::OrderReplaced;
+      char type;
+      be64_t timestamp;
+      char token[14];
+      char side;
+      be32_t qty;
+      char symbol[8];
+      be32_t px;
+      be32_t tif;
+      char mpid[4];
+      char display;
+      be64_t oid;
+      char capacity;
+      char iso;
+      be32_t minqty;
+      char cross_type;
+      char state;
+      char previous_token[14];
+    };
+
     struct __attribute__((__packed__)) OrderCanceled {
     OrderCanceled() : type(MessageType::OrderCanceled), timestamp(0) {}
+      static constexpr char msg_type = MessageType::OrderCanceled;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char token[14];
-      uint32_t qty;
+      be32_t qty;
       char reason;
     };
 
     struct __attribute__((__packed__)) OrderExecuted {
     OrderExecuted() : type(MessageType::OrderExecuted), timestamp(0) {}
+      static constexpr char msg_type = MessageType::OrderExecuted;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char token[14];
-      uint32_t qty;
-      uint32_t px;
+      be32_t qty;
+      be32_t px;
       char liq_flag;
-      uint64_t match_id;
+      be64_t match_id;
     };
 
     struct __attribute__((__packed__)) BrokenOrder {
+    BrokenOrder() : type(MessageType::OrderBroken), timestamp(0) {}
+      static constexpr char msg_type = MessageType::OrderBroken;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char token[14];
-      uint64_t match_id;
+      be64_t match_id;
       char reason;
     };
 
     struct __attribute__((__packed__)) OrderRejected {
     OrderRejected() : type(MessageType::OrderRejected), timestamp(0) {}
+      static constexpr char msg_type = MessageType::OrderRejected;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char token[14];
       char reason;
     };
 
     struct __attribute__((__packed__)) CancelPending {
+    CancelPending() : type(MessageType::CancelPending), timestamp(0) {}
+      static constexpr char msg_type = MessageType::CancelPending;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char token[14];
     };
 
     struct __attribute__((__packed__)) CancelRejected {
     CancelRejected() : type(MessageType::CancelRejected), timestamp(0) {}
+      static constexpr char msg_type = MessageType::CancelRejected;
       char type;
-      uint64_t timestamp;
+      be64_t timestamp;
       char token[14];
     };
 
-    size_t message_size(const char msgtype);
+    // wire sizes indexed by message type, built from the message structs
+    template <typename... Msgs>
+    struct MessageSizeTable {
+      constexpr MessageSizeTable() : sizes{} {
+        ((sizes[uint8_t(Msgs::msg_type)] = sizeof(Msgs)), ...);
+      }
+      constexpr size_t operator[](char msgtype) const { return sizes[uint8_t(msgtype)]; }
+
+      uint16_t sizes[256];
+    };
+
+    static constexpr MessageSizeTable<NewOrder, CancelOrder, ReplaceOrder> inbound_sizes;
+    static constexpr MessageSizeTable<SystemEvent, OrderAck, OrderReplaced, OrderCanceled, OrderExecuted, BrokenOrder,
+                                      OrderRejected, CancelPending, CancelRejected> outbound_sizes;
+
+    static_assert(sizeof(NewOrder) == 49 && sizeof(CancelOrder) == 19 && sizeof(ReplaceOrder) == 47, "OUCH 4.2 inbound sizes");
+    static_assert(sizeof(OrderAck) == 65 && sizeof(OrderReplaced) == 79 && sizeof(OrderExecuted) == 40,
+                  "OUCH 4.2 outbound sizes");
+
+    // sizes of server to client messages, 0 for unknown types
+    inline size_t message_size(const char msgtype)         { return outbound_sizes[msgtype]; }
+    inline size_t inbound_message_size(const char msgtype) { return inbound_sizes[msgtype]; }
+
+    // the single character fields of an inbound order, as one bit per field
+    // in a table indexed by the character
+    namespace FieldDomain {
+      static const uint8_t Side     = 1;
+      static const uint8_t Display  = 2;
+      static const uint8_t Capacity = 4;
+      static const uint8_t ISO      = 8;
+    }
+
+    struct FieldDomainTable {
+      constexpr FieldDomainTable() : bits{} {
+        using namespace Constants;
+        for(char c : {SideBuy, SideSell, SideShort, SideShortExempt})
+          bits[uint8_t(c)] |= FieldDomain::Side;
+        for(char c : {DisplayAttributable, DisplayAnonymous, DisplayNone, DisplayPostOnly, DisplayImbalance,
+                      DisplayMidpoint, DisplayMidpointPost, DisplayPostOnlyAttr, DisplayRetail1, DisplayRetail2,
+                      DisplayRetailPI})
+          bits[uint8_t(c)] |= FieldDomain::Display;
+        for(char c : {Agency, Principal, Riskless, CapacityOther})
+          bits[uint8_t(c)] |= FieldDomain::Capacity;
+        for(char c : {ISOEligible, ISONonEligible})
+          bits[uint8_t(c)] |= FieldDomain::ISO;
+      }
+      constexpr bool has(char c, uint8_t field) const { return bits[uint8_t(c)] & field; }
+
+      uint8_t bits[256];
+    };
+
+    static constexpr FieldDomainTable field_domains;
+
+    // the reject reason for an order with a field out of its domain, or 0.
+    // every check lands in one mask, so a well formed order costs a single
+    // branch; the lowest failing check picks the reason.
+    inline char
+    validate(const NewOrder& m) {
+      static constexpr char reasons[] = {
+        RejectReason::Other,          // side
+        RejectReason::Other,          // zero quantity
+        RejectReason::QtyExceeded,    // quantity over MaxQty
+        RejectReason::InvalidPrice,   // zero price
+        RejectReason::InvalidDisplay, // display
+        RejectReason::Other,          // capacity
+        RejectReason::Other,          // iso
+        RejectReason::InvalidMinQty,  // minimum quantity over quantity
+      };
+
+      uint32_t qty = m.qty;
+      uint32_t bad =
+        uint32_t(!field_domains.has(m.side, FieldDomain::Side))
+        | uint32_t(qty == 0) << 1
+        | uint32_t(qty > uint32_t(Constants::MaxQty)) << 2
+        | uint32_t(uint32_t(m.px) == 0) << 3
+        | uint32_t(!field_domains.has(m.display, FieldDomain::Display)) << 4
+        | uint32_t(!field_domains.has(m.capacity, FieldDomain::Capacity)) << 5
+        | uint32_t(!field_domains.has(m.iso, FieldDomain::ISO)) << 6
+        | uint32_t(uint32_t(m.minqty) > qty) << 7;
+      return __builtin_expect(bad, 0) ? reasons[__builtin_ctz(bad)] : 0;
+    }
+
+    // a replace is checked like a new order, on the fields it carries. its
+    // reject quotes the replacement token and leaves the existing order be.
+    inline char
+    validate(const ReplaceOrder& m) {
+      static constexpr char reasons[] = {
+        RejectReason::Other,          // zero quantity
+        RejectReason::QtyExceeded,    // quantity over MaxQty
+        RejectReason::InvalidPrice,   // zero price
+        RejectReason::InvalidDisplay, // display
+        RejectReason::Other,          // iso
+        RejectReason::InvalidMinQty,  // minimum quantity over quantity
+      };
+
+      uint32_t qty = m.qty;
+      uint32_t bad =
+        uint32_t(qty == 0)
+        | uint32_t(qty > uint32_t(Constants::MaxQty)) << 1
+        | uint32_t(uint32_t(m.px) == 0) << 2
+        | uint32_t(!field_domains.has(m.display, FieldDomain::Display)) << 3
+        | uint32_t(!field_domains.has(m.iso, FieldDomain::ISO)) << 4
+        | uint32_t(uint32_t(m.minqty) > qty) << 5;
+      return __builtin_expect(bad, 0) ? reasons[__builtin_ctz(bad)] : 0;
+    }
+
+    // a cancel for an unknown token or a larger size is a no-op, never a reject
+    inline char
+    validate(const CancelOrder&) {
+      return 0;
+    }
   }
 }
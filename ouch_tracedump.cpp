@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <args.hxx>
+
+#include "ouch_structs.h"
+#include "soupbin_structs.h"
+#include "trace_recorder.h"
+
+using namespace std;
+using namespace elf;
+
+const char*
+ouch_tracedump_version() {
+#ifdef VERSION
+  return VERSION;
+#else
+  return "unknown";
+#endif
+}
+
+namespace OUCHTraceDump {
+  struct DumpConfig {
+    string path;
+    // 0 for every connection
+    uint32_t conn = 0;
+    bool records = false;
+  };
+
+  // a connection's byte streams, reassembled across records so messages
+  // split between reads or writes decode whole
+  struct Stream {
+    string name;
+    string in;
+    string out;
+  };
+
+  class TraceDump {
+  public:
+    TraceDump(const DumpConfig& config, uint32_t flags)
+      : _config(config), _soupbin(flags & TraceFlags::SoupBin) {}
+
+    void
+    handle(const TraceRecord& r, const char* payload) {
+      if(r.kind == TraceKind::Clock) {
+        TraceClock c;
+        memcpy(&c, payload, sizeof(c));
+        _clock_tsc = r.tsc;
+        _clock_ns = c.ns;
+        _ns_per_tick = c.ns_per_tick;
+        return;
+      }
+      if(r.kind == TraceKind::Lost) {
+        uint64_t n;
+        memcpy(&n, payload, sizeof(n));
+        printf("%s lost %lu records\n", timestamp(r.tsc).c_str(), n);
+        return;
+      }
+      if(_config.conn && r.stream != _config.conn)
+        return;
+
+      Stream& s = _streams[r.stream];
+      if(_config.records)
+        printf("%s %u %s kind=%u len=%u\n", timestamp(r.tsc).c_str(), r.stream, s.name.c_str(), r.kind, r.len);
+
+      switch(r.kind) {
+      case TraceKind::Name:
+        s.name.assign(payload, r.len);
+        printf("%s %u connection %s\n", timestamp(r.tsc).c_str(), r.stream, s.name.c_str());
+        break;
+      case TraceKind::In:
+        s.in.append(payload, r.len);
+        decode(r, s, s.in, true);
+        break;
+      case TraceKind::Out:
+        s.out.append(payload, r.len);
+        decode(r, s, s.out, false);
+        break;
+      case TraceKind::Close:
+        if(!s.in.empty() || !s.out.empty())
+          printf("%s %u %s closed with in=%zu out=%zu bytes undecoded\n", timestamp(r.tsc).c_str(), r.stream,
+                 s.name.c_str(), s.in.size(), s.out.size());
+        else
+          printf("%s %u %s closed\n", timestamp(r.tsc).c_str(), r.stream, s.name.c_str());
+        // a soupbin session carries on under the same id on its next
+        // connection, so only the byte streams start over
+        s.in.clear();
+        s.out.clear();
+        break;
+      }
+    }
+
+  private:
+    string
+    timestamp(uint64_t tsc) const {
+      int64_t ticks = int64_t(tsc - _clock_tsc);
+      uint64_t ns = _clock_ns + int64_t(ticks * _ns_per_tick);
+      time_t secs = ns / 1000000000;
+      struct tm tm;
+      localtime_r(&secs, &tm);
+      char buf[40];
+      size_t n = strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+      snprintf(buf + n, sizeof(buf) - n, ".%09lu", ns % 1000000000);
+      return buf;
+    }
+
+    void
+    decode(const TraceRecord& r, const Stream& s, string& data, bool inbound) {
+      size_t pos = _soupbin ? decode_soupbin(r, s, data, inbound) : decode_ouch(r, s, data, inbound);
+      data.erase(0, pos);
+    }
+
+    static size_t
+    ouch_size(char type, bool inbound) {
+      return inbound ? OUCH42::inbound_message_size(type) : OUCH42::message_size(type);
+    }
+
+    // returns the bytes consumed. input of a type we don't know is skipped
+    // up to the next byte that could start a message, as the simulator does.
+    size_t
+    decode_ouch(const TraceRecord& r, const Stream& s, const string& data, bool inbound) {
+      size_t pos = 0;
+      while(pos < data.size()) {
+        const char* msg = data.data() + pos;
+        size_t len = ouch_size(*msg, inbound);
+        if(!len) {
+          size_t next = pos + 1;
+          while(next < data.size() && !ouch_size(data[next], inbound))
+            next++;
+          print(r, s, inbound, "discarding " + to_string(next - pos) + " bytes msgtype=" + hex(*msg));
+          pos = next;
+          continue;
+        }
+        if(data.size() - pos < len)
+          break;
+        print(r, s, inbound, describe(msg, inbound));
+        pos += len;
+      }
+      return pos;
+    }
+
+    size_t
+    decode_soupbin(const TraceRecord& r, const Stream& s, const string& data, bool inbound) {
+      size_t pos = 0;
+      while(data.size() - pos >= sizeof(SoupBin::Header)) {
+        const SoupBin::Header* h = reinterpret_cast<const SoupBin::Header*>(data.data() + pos);
+        size_t len = sizeof(be16_t) + h->len;
+        if(h->len == 0) {
+          print(r, s, inbound, "empty soupbin packet, dropping " + to_string(data.size() - pos) + " bytes");
+          return data.size();
+        }
+        if(data.size() - pos < len)
+          break;
+
+        const char* payload = data.data() + pos + sizeof(SoupBin::Header);
+        size_t payload_len = len - sizeof(SoupBin::Header);
+        switch(h->type) {
+        case SoupBin::PacketType::UnsequencedData:
+        case SoupBin::PacketType::SequencedData: {
+          size_t expected = ouch_size(*payload, inbound);
+          if(payload_len && payload_len == expected)
+            print(r, s, inbound, string(1, h->type) + " " + describe(payload, inbound));
+          else
+            print(r, s, inbound, string(1, h->type) + " malformed len=" + to_string(payload_len));
+          break;
+        }
+        case SoupBin::PacketType::LoginRequest: {
+          const SoupBin::LoginRequest* req = reinterpret_cast<const SoupBin::LoginRequest*>(h);
+          if(len == sizeof(*req))
+            print(r, s, inbound, "login user=" + SoupBin::trim_alpha_field(req->username, sizeof(req->username)) +
+                  " session=" + SoupBin::trim_alpha_field(req->session, sizeof(req->session)) +
+                  " seq=" + to_string(SoupBin::parse_numeric_field(req->sequence, sizeof(req->sequence))));
+          else
+            print(r, s, inbound, "login malformed len=" + to_string(len));
+          break;
+        }
+        case SoupBin::PacketType::LoginAccepted: {
+          const SoupBin::LoginAccepted* acc = reinterpret_cast<const SoupBin::LoginAccepted*>(h);
+          if(len == sizeof(*acc))
+            print(r, s, inbound, "login accepted session=" + SoupBin::trim_alpha_field(acc->session, sizeof(acc->session)) +
+                  " seq=" + to_string(SoupBin::parse_numeric_field(acc->sequence, sizeof(acc->sequence))));
+          else
+            print(r, s, inbound, "login accepted malformed len=" + to_string(len));
+          break;
+        }
+        case SoupBin::PacketType::LoginRejected:
+          print(r, s, inbound, "login rejected reason=" + string(payload, payload_len));
+          break;
+        case SoupBin::PacketType::ServerHeartbeat:
+        case SoupBin::PacketType::ClientHeartbeat:
+          print(r, s, inbound, "heartbeat");
+          break;
+        case SoupBin::PacketType::LogoutRequest:
+          print(r, s, inbound, "logout");
+          break;
+        case SoupBin::PacketType::EndOfSession:
+          print(r, s, inbound, "end of session");
+          break;
+        default:
+          print(r, s, inbound, "packet type " + hex(h->type) + " len=" + to_string(len));
+          break;
+        }
+        pos += len;
+      }
+      return pos;
+    }
+
+    void
+    print(const TraceRecord& r, const Stream& s, bool inbound, const string& what) {
+      printf("%s %u %s %s %s\n", timestamp(r.tsc).c_str(), r.stream, s.name.c_str(), inbound ? "in " : "out", what.c_str());
+    }
+
+    static string
+    hex(char c) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "%#04x", uint8_t(c));
+      return buf;
+    }
+
+    static string
+    field(const char* p, size_t len) {
+      return SoupBin::trim_alpha_field(p, len);
+    }
+
+    static string
+    price(uint32_t px) {
+      char buf[24];
+      snprintf(buf, sizeof(buf), "%u.%04u", px / 10000, px % 10000);
+      return buf;
+    }
+
+    static string
+    describe(const char* msg, bool inbound) {
+      using namespace OUCH42;
+      string type(1, *msg);
+      if(inbound) {
+        switch(*msg) {
+        case MessageType::NewOrder: {
+          const NewOrder* m = reinterpret_cast<const NewOrder*>(msg);
+          return type + " token=" + field(m->token, sizeof(m->token)) + " side=" + m->side +
+            " qty=" + to_string(m->qty) + " symbol=" + field(m->symbol, sizeof(m->symbol)) +
+            " px=" + price(m->px) + " tif=" + to_string(m->tif) + " display=" + m->display;
+        }
+        case MessageType::CancelOrder: {
+          const CancelOrder* m = reinterpret_cast<const CancelOrder*>(msg);
+          return type + " token=" + field(m->token, sizeof(m->token)) + " qty=" + to_string(m->qty);
+        }
+        case MessageType::ReplaceOrder: {
+          const ReplaceOrder* m = reinterpret_cast<const ReplaceOrder*>(msg);
+          return type + " token=" + field(m->existing_token, sizeof(m->existing_token)) +
+            " new_token=" + field(m->token, sizeof(m->token)) + " qty=" + to_string(m->qty) +
+            " px=" + price(m->px) + " tif=" + to_string(m->tif) + " display=" + m->display;
+        }
+        }
+        return type;
+      }
+
+      switch(*msg) {
+      case MessageType::SystemEvent: {
+        const SystemEvent* m = reinterpret_cast<const SystemEvent*>(msg);
+        return type + " event=" + m->event_code;
+      }
+      case MessageType::OrderAck: {
+        const OrderAck* m = reinterpret_cast<const OrderAck*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token)) + " side=" + m->side +
+          " qty=" + to_string(m->qty) + " symbol=" + field(m->symbol, sizeof(m->symbol)) +
+          " px=" + price(m->px) + " oid=" + to_string(m->oid) + " state=" + m->state;
+      }
+      case MessageType::OrderReplaced: {
+        const OrderReplaced* m = reinterpret_cast<const OrderReplaced*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token)) + " previous=" +
+          field(m->previous_token, sizeof(m->previous_token)) + " side=" + m->side + " qty=" + to_string(m->qty) +
+          " symbol=" + field(m->symbol, sizeof(m->symbol)) + " px=" + price(m->px) + " oid=" + to_string(m->oid) +
+          " state=" + m->state;
+      }
+      case MessageType::OrderCanceled: {
+        const OrderCanceled* m = reinterpret_cast<const OrderCanceled*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token)) + " qty=" + to_string(m->qty) +
+          " reason=" + m->reason;
+      }
+      case MessageType::OrderExecuted: {
+        const OrderExecuted* m = reinterpret_cast<const OrderExecuted*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token)) + " qty=" + to_string(m->qty) +
+          " px=" + price(m->px) + " liq=" + m->liq_flag + " match=" + to_string(m->match_id);
+      }
+      case MessageType::OrderBroken: {
+        const BrokenOrder* m = reinterpret_cast<const BrokenOrder*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token)) + " match=" + to_string(m->match_id) +
+          " reason=" + m->reason;
+      }
+      case MessageType::OrderRejected: {
+        const OrderRejected* m = reinterpret_cast<const OrderRejected*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token)) + " reason=" + m->reason;
+      }
+      case MessageType::CancelPending: {
+        const CancelPending* m = reinterpret_cast<const CancelPending*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token));
+      }
+      case MessageType::CancelRejected: {
+        const CancelRejected* m = reinterpret_cast<const CancelRejected*>(msg);
+        return type + " token=" + field(m->token, sizeof(m->token));
+      }
+      }
+      return type;
+    }
+
+    DumpConfig _config;
+    bool _soupbin;
+    uint64_t _clock_tsc = 0;
+    uint64_t _clock_ns = 0;
+    double _ns_per_tick = 1.0;
+    unordered_map<uint32_t, Stream> _streams;
+  };
+}
+
+using namespace OUCHTraceDump;
+
+int
+main(int argc, char** argv) {
+  args::ArgumentParser parser("ouch_tracedump", "decode an ouch_simulator message trace");
+  parser.helpParams.addDefault = true;
+  args::Positional<string> path(parser, "file", "trace written by ouch_simulator --trace-messages", "ouch_simulator.trace");
+  args::ValueFlag<uint32_t> conn(parser, "id", "only show this connection", {'c', "conn"}, 0);
+  args::Flag records(parser, "records", "also list the raw records", {"records"}, false);
+  args::Flag version(parser, "version", "show version", {'v', "version"});
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch(const runtime_error& e) {
+    cout << parser;
+    cout << e.what() << endl;
+    return 1;
+  }
+
+  if(version) {
+    cout << ouch_tracedump_version() << endl;
+    exit(0);
+  }
+
+  DumpConfig config;
+  config.path = args::get(path);
+  config.conn = args::get(conn);
+  config.records = args::get(records);
+
+  try {
+    TraceFile trace(config.path);
+    TraceDump dump(config, trace.flags());
+    trace.for_each([&dump](const TraceRecord& r, const char* payload) { dump.handle(r, payload); });
+  } catch(const std::runtime_error& e) {
+    cout << "Error: " << e.what() << endl;
+    exit(2);
+  }
+
+  exit(0);
+}
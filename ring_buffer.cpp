@@ -0,0 +1,77 @@
+#include "ring_buffer.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace elf;
+using namespace std;
+
+static runtime_error
+ring_error(const char* what) {
+  return runtime_error(string("ringbuffer: ") + what + ": " + strerror(errno));
+}
+
+void
+RingBuffer::init(size_t size) {
+  if(_buffer)
+    throw runtime_error("ringbuffer: fatal: already initialized");
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t len = (size + page - 1) / page * page;
+
+  int fd = memfd_create("ringbuffer", MFD_CLOEXEC);
+  if(fd < 0)
+    throw ring_error("memfd_create");
+  if(ftruncate(fd, len) < 0) {
+    close(fd);
+    throw ring_error("ftruncate");
+  }
+
+  // reserve both halves, then map the same pages over each
+  char* base = static_cast<char*>(mmap(nullptr, 2 * len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if(base == MAP_FAILED) {
+    close(fd);
+    throw ring_error("mmap");
+  }
+  for(char* half : {base, base + len}) {
+    if(mmap(half, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      munmap(base, 2 * len);
+      close(fd);
+      throw ring_error("mmap");
+    }
+  }
+  close(fd);
+
+  _buffer = base;
+  _len = len;
+  _read_mark = _write_mark = 0;
+}
+
+RingBuffer::~RingBuffer() {
+  if(_buffer)
+    munmap(_buffer, 2 * _len);
+  _buffer = nullptr;
+  _len = 0;
+}
+
+void
+RingBuffer::mark_read(size_t len) {
+  assert(_read_mark+len <= _write_mark);
+  _read_mark += len;
+  if(_read_mark >= _len) {
+    _read_mark -= _len;
+    _write_mark -= _len;
+  }
+}
+
+void
+RingBuffer::mark_written(size_t len) {
+  assert(read_avail()+len <= _len);
+  _write_mark += len;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace elf {
+  // a byte ring whose pages are mapped twice, back to back, so the readable
+  // and the writable regions are always contiguous in memory and the unread
+  // tail never has to be moved. a drop-in for RWBuffer on streams where
+  // compaction copies show up.
+  struct RingBuffer {
+    RingBuffer() {}
+    RingBuffer(size_t size) { init(size); }
+    ~RingBuffer();
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+    RingBuffer(RingBuffer&& other) noexcept { swap(other); }
+
+    void
+    swap(RingBuffer& other) noexcept {
+      std::swap(_buffer, other._buffer);
+      std::swap(_len, other._len);
+      std::swap(_write_mark, other._write_mark);
+      std::swap(_read_mark, other._read_mark);
+    }
+
+    // size is rounded up to a whole number of pages
+    void init(size_t size);
+    char* read_head()          { return _buffer + _read_mark; }
+    char* write_head()         { return _buffer + _write_mark; }
+    void mark_read(size_t len);
+    void mark_written(size_t len);
+    bool prepare_write(size_t len) const { return len <= write_avail(); }
+    size_t write_avail() const { return _len - read_avail(); }
+    size_t read_avail() const  { return _write_mark - _read_mark; }
+    size_t capacity() const    { return _len; }
+    void clear()               { _read_mark = _write_mark = 0; }
+
+    template <typename T>
+    const T*
+    try_consume_struct() {
+      if(read_avail() < sizeof(T))
+        return nullptr;
+
+      const T* p = reinterpret_cast<const T*>(read_head());
+      mark_read(sizeof(T));
+      return p;
+    }
+
+    template <typename T>
+    T*
+    try_produce_struct() {
+      if(!prepare_write(sizeof(T)))
+        return nullptr;
+
+      T* p = new (write_head()) T();
+      mark_written(sizeof(T));
+      return p;
+    }
+
+    // _read_mark stays inside the first mapping; _write_mark may run into
+    // the second by up to _len
+    char* _buffer = nullptr;
+    size_t _len = 0;
+    size_t _write_mark = 0;
+    size_t _read_mark = 0;
+  };
+}
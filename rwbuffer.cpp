@@ -1,6 +1,5 @@
 #include "rwbuffer.h"
 
-#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
@@ -18,8 +17,6 @@ RWBuffer::init(size_t len) {
   _buffer = reinterpret_cast<char*>(std::calloc(len, 1));
   _len = len;
   _read_mark = _write_mark = 0;
-  _low_watermark = std::max(network_recv_size, _len / 10);
-  _high_watermark = _low_watermark * 9;
 }
 
 RWBuffer::~RWBuffer() {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <new>
 
 namespace elf {
   static constexpr size_t network_recv_size = 1500;
@@ -31,11 +32,20 @@ namespace elf {
       return p;
     }
 
+    template <typename T>
+    T*
+    try_produce_struct() {
+      if(!prepare_write(sizeof(T)))
+        return nullptr;
+
+      T* p = new (write_head()) T();
+      mark_written(sizeof(T));
+      return p;
+    }
+
     char* _buffer;
     size_t _len;
     size_t _write_mark;
     size_t _read_mark;
-    size_t _low_watermark;
-    size_t _high_watermark;
   };
 }
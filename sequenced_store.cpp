@@ -0,0 +1,93 @@
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "sequenced_store.h"
+
+using namespace elf;
+using namespace std;
+
+static size_t
+round_pow2(size_t n) {
+  size_t p = 4096;
+  while(p < n)
+    p <<= 1;
+  return p;
+}
+
+static void*
+map_anonymous(size_t len) {
+  void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(p == MAP_FAILED)
+    throw runtime_error(string("SequencedStore: mmap: ") + strerror(errno));
+  return p;
+}
+
+SequencedStore::SequencedStore(size_t data_bytes, size_t max_messages)
+  : _data_size(round_pow2(data_bytes)),
+    _data_mask(_data_size - 1),
+    _index_size(round_pow2(max_messages)),
+    _index_mask(_index_size - 1) {
+  _data = static_cast<char*>(map_anonymous(_data_size));
+  _index = static_cast<uint64_t*>(map_anonymous(_index_size * sizeof(uint64_t)));
+}
+
+SequencedStore::~SequencedStore() {
+  munmap(_data, _data_size);
+  munmap(_index, _index_size * sizeof(uint64_t));
+}
+
+char*
+SequencedStore::append(size_t len) {
+  if(len > _data_size)
+    throw runtime_error("SequencedStore: message larger than the store");
+
+  uint64_t offset = _head & _data_mask;
+  if(offset + len > _data_size) {
+    _lap_end = _head;
+    _head += _data_size - offset;
+    offset = 0;
+  } else if(!offset && _head) {
+    _lap_end = _head;
+  }
+
+  _index[_next_seq & _index_mask] = _head;
+  _next_seq++;
+  _head += len;
+  evict();
+  return _data + offset;
+}
+
+// a message at position p survives until the head is a full ring past it
+void
+SequencedStore::evict() {
+  uint64_t oldest = _head > _data_size ? _head - _data_size : 0;
+  while(_first_seq < _next_seq &&
+        (_next_seq - _first_seq > _index_size || _index[_first_seq & _index_mask] < oldest))
+    _first_seq++;
+}
+
+int
+SequencedStore::spans(uint64_t from, Span out[2]) const {
+  if(from >= _head)
+    return 0;
+
+  uint64_t lap = ~_data_mask;
+  if((from & lap) == ((_head - 1) & lap)) {
+    out[0] = Span{_data + (from & _data_mask), size_t(_head - from)};
+    return 1;
+  }
+
+  // from is on the previous lap, whose data ends at _lap_end
+  Span tail{_data, size_t((_head - 1) & _data_mask) + 1};
+  if(from >= _lap_end) {
+    out[0] = tail;
+    return 1;
+  }
+  out[0] = Span{_data + (from & _data_mask), size_t(_lap_end - from)};
+  out[1] = tail;
+  return 2;
+}
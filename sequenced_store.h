@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace elf {
+  // outbound message store for a sequenced session. messages are written in
+  // place into a ring of anonymous, lazily backed memory and numbered from 1;
+  // an index ring maps each sequence number to its position in the stream.
+  // once the data or the index wraps, the oldest messages are dropped.
+  //
+  // stream positions only grow. a message never straddles the end of the
+  // ring, so any retained range of the stream is at most two spans of
+  // memory, which can be written to a socket without copying.
+  class SequencedStore {
+  public:
+    struct Span {
+      const char* data;
+      size_t len;
+    };
+
+    // sizes are rounded up to powers of two
+    SequencedStore(size_t data_bytes, size_t max_messages);
+    ~SequencedStore();
+    SequencedStore(const SequencedStore&) = delete;
+    SequencedStore& operator=(const SequencedStore&) = delete;
+
+    // room for the next message; it takes sequence number next_seq()
+    char* append(size_t len);
+
+    uint64_t next_seq() const  { return _next_seq; }
+    uint64_t first_seq() const { return _first_seq; }
+    uint64_t head() const      { return _head; }
+
+    // stream position of a retained message, or head() for next_seq()
+    uint64_t position(uint64_t seq) const {
+      return seq == _next_seq ? _head : _index[seq & _index_mask];
+    }
+
+    // the stream from position `from` to head(); returns the span count
+    int spans(uint64_t from, Span out[2]) const;
+
+  private:
+    void evict();
+
+    char* _data = nullptr;
+    size_t _data_size = 0;
+    uint64_t _data_mask = 0;
+    uint64_t* _index = nullptr;
+    size_t _index_size = 0;
+    uint64_t _index_mask = 0;
+
+    uint64_t _next_seq = 1;
+    uint64_t _first_seq = 1;
+    uint64_t _head = 0;
+    // where the data of the previous lap of the ring ends
+    uint64_t _lap_end = 0;
+  };
+}
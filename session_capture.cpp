@@ -0,0 +1,299 @@
+#include <endian.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "session_capture.h"
+
+using namespace elf;
+using namespace std;
+
+// records never straddle blocks, so a block must hold the largest one
+static constexpr size_t max_record_len = capture_header_len + UINT16_MAX;
+
+CompressedReader::CompressedReader(const string& path) : _path(path) {
+  _file = fopen(path.c_str(), "rb");
+  if(!_file)
+    throw runtime_error(path + ": " + strerror(errno));
+
+  unsigned char magic[3] = {0, 0, 0};
+  size_t n = fread(magic, 1, sizeof(magic), _file);
+  rewind(_file);
+
+  if(n == 3 && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h') {
+    int err = BZ_OK;
+    _bz = BZ2_bzReadOpen(&err, _file, 0, 0, nullptr, 0);
+    if(err != BZ_OK)
+      throw runtime_error(path + ": BZ2_bzReadOpen failed (" + to_string(err) + ")");
+    return;
+  }
+
+  // zlib reads plain files transparently
+  fclose(_file);
+  _file = nullptr;
+  _gz = gzopen(path.c_str(), "rb");
+  if(!_gz)
+    throw runtime_error(path + ": gzopen failed");
+  gzbuffer(_gz, 256*1024);
+}
+
+CompressedReader::~CompressedReader() {
+  if(_bz) {
+    int err;
+    BZ2_bzReadClose(&err, _bz);
+  }
+  if(_file)
+    fclose(_file);
+  if(_gz)
+    gzclose(_gz);
+}
+
+size_t
+CompressedReader::read(char* buf, size_t len) {
+  if(_gz) {
+    int n = gzread(_gz, buf, len);
+    if(n < 0) {
+      int err;
+      throw runtime_error(_path + ": " + gzerror(_gz, &err));
+    }
+    return n;
+  }
+
+  if(_bz_eof)
+    return 0;
+
+  int err = BZ_OK;
+  int n = BZ2_bzRead(&err, _bz, buf, len);
+  if(err == BZ_STREAM_END)
+    _bz_eof = true;
+  else if(err != BZ_OK)
+    throw runtime_error(_path + ": BZ2_bzRead failed (" + to_string(err) + ")");
+  return n;
+}
+
+bool
+CompressedReader::read_exact(char* buf, size_t len) {
+  size_t got = 0;
+  while(got < len) {
+    size_t n = read(buf + got, len - got);
+    if(!n)
+      break;
+    got += n;
+  }
+  if(got && got < len)
+    throw runtime_error(_path + ": truncated record");
+  return got == len;
+}
+
+CaptureWriter::CaptureWriter(const string& path) : _path(path) {
+  _gz = gzopen(path.c_str(), "wb1");
+  if(!_gz)
+    throw runtime_error(path + ": gzopen failed");
+  gzbuffer(_gz, 256*1024);
+}
+
+CaptureWriter::~CaptureWriter() {
+  if(_gz)
+    gzclose(_gz);
+}
+
+void
+CaptureWriter::write(uint64_t timestamp, const char* data, uint16_t len) {
+  char header[capture_header_len];
+  uint64_t ts = htobe64(timestamp);
+  uint16_t l = htobe16(len);
+  memcpy(header, &ts, sizeof(ts));
+  memcpy(header + sizeof(ts), &l, sizeof(l));
+
+  if(gzwrite(_gz, header, sizeof(header)) != int(sizeof(header)) || gzwrite(_gz, data, len) != int(len)) {
+    int err;
+    throw runtime_error(_path + ": " + gzerror(_gz, &err));
+  }
+}
+
+bool
+CaptureBlock::peek(CaptureRecord& rec) const {
+  if(cursor + capture_header_len > used)
+    return false;
+
+  uint64_t ts;
+  uint16_t len;
+  memcpy(&ts, &data[cursor], sizeof(ts));
+  memcpy(&len, &data[cursor + sizeof(ts)], sizeof(len));
+  rec.timestamp = be64toh(ts);
+  rec.len = be16toh(len);
+  rec.data = &data[cursor + capture_header_len];
+  return true;
+}
+
+bool
+CaptureBlock::next(CaptureRecord& rec) {
+  if(!peek(rec))
+    return false;
+  cursor += capture_header_len + rec.len;
+  return true;
+}
+
+CapturePipeline::CapturePipeline(size_t block_size, size_t depth)
+  : _block_size(max(block_size, 2 * max_record_len)), _depth(max<size_t>(depth, 1)) {
+}
+
+CapturePipeline::~CapturePipeline() {
+  stop();
+}
+
+void
+CapturePipeline::start(const vector<string>& paths) {
+  _streams.resize(paths.size());
+  for(size_t i=0; i<paths.size(); i++)
+    _streams[i].reader.reset(new CompressedReader(paths[i]));
+
+  _stop = false;
+  _thread = thread(&CapturePipeline::run, this);
+}
+
+void
+CapturePipeline::stop() {
+  {
+    lock_guard<mutex> guard(_lock);
+    _stop = true;
+  }
+  _cv.notify_all();
+  if(_thread.joinable())
+    _thread.join();
+}
+
+// fill whole records until the next one might not fit
+bool
+CapturePipeline::fill(Stream& s, CaptureBlock* block) {
+  block->used = 0;
+  block->cursor = 0;
+  if(block->data.size() < _block_size)
+    block->data.resize(_block_size);
+
+  while(block->used + max_record_len <= block->data.size()) {
+    char* p = &block->data[block->used];
+    if(!s.reader->read_exact(p, capture_header_len))
+      return false;
+
+    uint16_t len;
+    memcpy(&len, p + sizeof(uint64_t), sizeof(len));
+    len = be16toh(len);
+    if(len && !s.reader->read_exact(p + capture_header_len, len))
+      throw runtime_error(s.reader->path() + ": truncated record");
+
+    block->used += capture_header_len + len;
+  }
+  return true;
+}
+
+void
+CapturePipeline::run() {
+  unique_lock<mutex> guard(_lock);
+  size_t next = 0;
+
+  while(!_stop) {
+    // round robin over streams with room in their queue
+    Stream* s = nullptr;
+    for(size_t i=0; i<_streams.size() && !s; i++) {
+      Stream& candidate = _streams[(next + i) % _streams.size()];
+      if(!candidate.eof && candidate.ready.size() < _depth) {
+        s = &candidate;
+        next = (next + i + 1) % _streams.size();
+      }
+    }
+
+    if(!s) {
+      _cv.wait(guard);
+      continue;
+    }
+
+    CaptureBlock* block;
+    if(_free.empty()) {
+      _blocks.emplace_back(new CaptureBlock());
+      block = _blocks.back().get();
+    } else {
+      block = _free.back();
+      _free.pop_back();
+    }
+
+    guard.unlock();
+    bool more = false;
+    string error;
+    try {
+      more = fill(*s, block);
+    } catch(const runtime_error& e) {
+      error = e.what();
+    }
+    _bytes += block->used;
+    guard.lock();
+
+    if(!error.empty()) {
+      _error = error;
+      for(Stream& st : _streams)
+        st.eof = true;
+      _free.push_back(block);
+      _cv.notify_all();
+      break;
+    }
+
+    if(block->used)
+      s->ready.push_back(block);
+    else
+      _free.push_back(block);
+    if(!more) {
+      s->eof = true;
+      s->reader.reset();
+    }
+    _cv.notify_all();
+  }
+}
+
+CaptureBlock*
+CapturePipeline::try_pop(size_t stream) {
+  lock_guard<mutex> guard(_lock);
+  if(!_error.empty())
+    throw runtime_error(_error);
+
+  Stream& s = _streams[stream];
+  if(s.ready.empty())
+    return nullptr;
+
+  CaptureBlock* block = s.ready.front();
+  s.ready.pop_front();
+  _cv.notify_all();
+  return block;
+}
+
+CaptureBlock*
+CapturePipeline::wait_pop(size_t stream) {
+  unique_lock<mutex> guard(_lock);
+  Stream& s = _streams[stream];
+  _cv.wait(guard, [&] { return !_error.empty() || !s.ready.empty() || s.eof; });
+  if(!_error.empty())
+    throw runtime_error(_error);
+  if(s.ready.empty())
+    return nullptr;
+
+  CaptureBlock* block = s.ready.front();
+  s.ready.pop_front();
+  _cv.notify_all();
+  return block;
+}
+
+void
+CapturePipeline::release(CaptureBlock* block) {
+  lock_guard<mutex> guard(_lock);
+  _free.push_back(block);
+  _cv.notify_all();
+}
+
+bool
+CapturePipeline::done(size_t stream) {
+  lock_guard<mutex> guard(_lock);
+  if(!_error.empty())
+    throw runtime_error(_error);
+  return _streams[stream].eof && _streams[stream].ready.empty();
+}
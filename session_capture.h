@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+namespace elf {
+  // a session capture is the client side of one session as a sequence of
+  // records: an 8-byte big-endian timestamp (ns), a 2-byte big-endian length
+  // and that many bytes of wire message. files may be gzip, bzip2 or plain.
+  static constexpr size_t capture_header_len = 10;
+
+  struct CaptureRecord {
+    uint64_t timestamp;
+    uint16_t len;
+    const char* data;
+  };
+
+  // sequential reader over a possibly compressed file; the format is taken
+  // from the magic bytes rather than the file name
+  class CompressedReader {
+  public:
+    CompressedReader(const std::string& path);
+    ~CompressedReader();
+    CompressedReader(const CompressedReader&) = delete;
+    CompressedReader& operator=(const CompressedReader&) = delete;
+
+    // reads up to len bytes, returning 0 at end of file
+    size_t read(char* buf, size_t len);
+    bool read_exact(char* buf, size_t len);
+    const std::string& path() const { return _path; }
+
+  private:
+    std::string _path;
+    gzFile _gz = nullptr;
+    FILE* _file = nullptr;
+    BZFILE* _bz = nullptr;
+    bool _bz_eof = false;
+  };
+
+  class CaptureWriter {
+  public:
+    CaptureWriter(const std::string& path);
+    ~CaptureWriter();
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    void write(uint64_t timestamp, const char* data, uint16_t len);
+
+  private:
+    std::string _path;
+    gzFile _gz = nullptr;
+  };
+
+  // a run of whole records, decompressed ahead of the consumer
+  struct CaptureBlock {
+    std::vector<char> data;
+    size_t used = 0;
+    size_t cursor = 0;
+
+    bool next(CaptureRecord& rec);
+    bool peek(CaptureRecord& rec) const;
+  };
+
+  // decompresses a set of captures on a background thread into bounded
+  // per-file queues of blocks. the consumer pops blocks without waiting and
+  // hands them back when done so blocks are reused rather than reallocated.
+  class CapturePipeline {
+  public:
+    CapturePipeline(size_t block_size = 256*1024, size_t depth = 8);
+    ~CapturePipeline();
+
+    void start(const std::vector<std::string>& paths);
+    void stop();
+
+    // nullptr if nothing is ready; done() tells a dry queue from a finished
+    // one. a read error on the pipeline thread is rethrown here.
+    CaptureBlock* try_pop(size_t stream);
+    CaptureBlock* wait_pop(size_t stream);
+    void release(CaptureBlock* block);
+    bool done(size_t stream);
+    size_t streams() const { return _streams.size(); }
+    uint64_t bytes() const { return _bytes; }
+
+  private:
+    struct Stream {
+      std::unique_ptr<CompressedReader> reader;
+      std::deque<CaptureBlock*> ready;
+      bool eof = false;
+    };
+
+    void run();
+    bool fill(Stream& s, CaptureBlock* block);
+
+    size_t _block_size;
+    size_t _depth;
+    std::vector<Stream> _streams;
+    std::vector<std::unique_ptr<CaptureBlock>> _blocks;
+    std::vector<CaptureBlock*> _free;
+    std::string _error;
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    bool _stop = false;
+    std::atomic<uint64_t> _bytes{0};
+  };
+}
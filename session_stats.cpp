@@ -0,0 +1,29 @@
+#include "session_stats.h"
+
+using namespace OUCHSim;
+using namespace elf;
+
+void
+SessionStats::merge(const SessionStats& other) {
+  msgs_in += other.msgs_in;
+  bytes_in += other.bytes_in;
+  msgs_out += other.msgs_out;
+  bytes_out += other.bytes_out;
+  rejects += other.rejects;
+  discards += other.discards;
+  discard_bytes += other.discard_bytes;
+  writes += other.writes;
+
+  if(other.write_latency) {
+    if(!write_latency)
+      write_latency.reset(new LatencyHistogram());
+    write_latency->merge(*other.write_latency);
+  }
+
+  for(auto& t : other.types) {
+    MessageTypeStats& mine = type(t.first);
+    mine.count += t.second->count;
+    mine.bytes += t.second->bytes;
+    mine.latency.merge(t.second->latency);
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "latency_histogram.h"
+
+namespace OUCHSim {
+  // per inbound message type: count, bytes and wire-in to processed latency
+  // in tsc ticks
+  struct MessageTypeStats {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    elf::LatencyHistogram latency;
+  };
+
+  // counters for one session. written only from the owning worker; type
+  // stats are allocated the first time a type is seen so idle sessions stay
+  // small.
+  struct SessionStats {
+    uint64_t msgs_in = 0;
+    uint64_t bytes_in = 0;
+    uint64_t msgs_out = 0;
+    uint64_t bytes_out = 0;
+    uint64_t rejects = 0;
+    uint64_t discards = 0;
+    uint64_t discard_bytes = 0;
+    uint64_t writes = 0;
+    std::unique_ptr<elf::LatencyHistogram> write_latency;
+    std::vector<std::pair<char, std::unique_ptr<MessageTypeStats>>> types;
+
+    MessageTypeStats&
+    type(char msgtype) {
+      for(auto& t : types) {
+        if(t.first == msgtype)
+          return *t.second;
+      }
+      types.emplace_back(msgtype, new MessageTypeStats());
+      return *types.back().second;
+    }
+
+    void
+    record_message(char msgtype, size_t len, uint64_t ticks) {
+      MessageTypeStats& t = type(msgtype);
+      t.count++;
+      t.bytes += len;
+      t.latency.record(ticks);
+      msgs_in++;
+      bytes_in += len;
+    }
+
+    void
+    record_write(size_t len, uint64_t ticks) {
+      if(!write_latency)
+        write_latency.reset(new elf::LatencyHistogram());
+      write_latency->record(ticks);
+      writes++;
+      bytes_out += len;
+    }
+
+    void merge(const SessionStats& other);
+  };
+}
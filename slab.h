@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace elf {
+  // storage for objects of one type, owned by one thread. slots are carved
+  // from chunks of ChunkObjects and reused most recently freed first, so a
+  // churning population stays on warm memory. chunks are only given back
+  // when the slab is destroyed, by which time its objects must be too.
+  template <typename T, size_t ChunkObjects = 64>
+  class Slab {
+  public:
+    Slab() = default;
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    ~Slab() {
+      for(Slot* chunk : _chunks)
+        ::operator delete(chunk, std::align_val_t(alignof(Slot)));
+    }
+
+    template <typename... Args>
+    T*
+    create(Args&&... args) {
+      if(!_free)
+        grow();
+
+      // the link is read first: construction overwrites it, and a
+      // constructor that throws leaves the slot on the list
+      Slot* slot = _free;
+      Slot* next = slot->next;
+      T* p = new (slot->object) T(std::forward<Args>(args)...);
+      _free = next;
+      _size++;
+      return p;
+    }
+
+    void
+    destroy(T* p) {
+      p->~T();
+      Slot* slot = reinterpret_cast<Slot*>(p);
+      slot->next = _free;
+      _free = slot;
+      _size--;
+    }
+
+    size_t size() const     { return _size; }
+    size_t capacity() const { return _chunks.size() * ChunkObjects; }
+
+  private:
+    union Slot {
+      Slot* next;
+      alignas(T) unsigned char object[sizeof(T)];
+    };
+
+    void
+    grow() {
+      Slot* chunk = static_cast<Slot*>(::operator new(sizeof(Slot) * ChunkObjects, std::align_val_t(alignof(Slot))));
+      _chunks.push_back(chunk);
+      for(size_t i=0; i<ChunkObjects; i++)
+        chunk[i].next = i+1 < ChunkObjects ? &chunk[i+1] : nullptr;
+      _free = chunk;
+    }
+
+    std::vector<Slot*> _chunks;
+    Slot* _free = nullptr;
+    size_t _size = 0;
+  };
+}
@@ -0,0 +1,33 @@
+#include "soupbin_structs.h"
+
+using namespace elf;
+using namespace std;
+
+uint64_t
+SoupBin::parse_numeric_field(const char* src, size_t len) {
+  uint64_t value = 0;
+  for(size_t i=0; i<len; i++) {
+    if(src[i] >= '0' && src[i] <= '9')
+      value = value * 10 + (src[i] - '0');
+  }
+  return value;
+}
+
+void
+SoupBin::set_numeric_field(uint64_t value, char* dest, size_t len) {
+  size_t i = len;
+  do {
+    dest[--i] = '0' + value % 10;
+    value /= 10;
+  } while(value && i);
+
+  while(i)
+    dest[--i] = ' ';
+}
+
+string
+SoupBin::trim_alpha_field(const char* src, size_t len) {
+  while(len && src[len-1] == ' ')
+    len--;
+  return string(src, len);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "big_endian.h"
+
+namespace elf {
+
+  // SoupBinTCP 3.00. every packet is a 2-byte big-endian length, counting
+  // the type byte and payload, followed by the type byte and the payload.
+  namespace SoupBin {
+    namespace PacketType {
+      // server to client
+      static const char Debug           = '+';
+      static const char LoginAccepted   = 'A';
+      static const char LoginRejected   = 'J';
+      static const char SequencedData   = 'S';
+      static const char ServerHeartbeat = 'H';
+      static const char EndOfSession    = 'Z';
+      // client to server
+      static const char LoginRequest    = 'L';
+      static const char UnsequencedData = 'U';
+      static const char ClientHeartbeat = 'R';
+      static const char LogoutRequest   = 'O';
+    }
+
+    namespace RejectReason {
+      static const char NotAuthorized       = 'A';
+      static const char SessionNotAvailable = 'S';
+    }
+
+    // servers heartbeat after a second without output; either side may
+    // drop a peer that has been silent for the timeout
+    static const int HeartbeatIntervalSecs = 1;
+    static const int HeartbeatTimeoutSecs  = 15;
+
+    struct __attribute__((__packed__)) Header {
+      be16_t len;
+      char type;
+    };
+
+    struct __attribute__((__packed__)) LoginRequest {
+    LoginRequest() : header{sizeof(LoginRequest) - sizeof(be16_t), PacketType::LoginRequest} {}
+      Header header;
+      char username[6];
+      char password[10];
+      char session[10];
+      char sequence[20];
+    };
+
+    struct __attribute__((__packed__)) LoginAccepted {
+    LoginAccepted() : header{sizeof(LoginAccepted) - sizeof(be16_t), PacketType::LoginAccepted} {}
+      Header header;
+      char session[10];
+      char sequence[20];
+    };
+
+    struct __attribute__((__packed__)) LoginRejected {
+    LoginRejected() : header{sizeof(LoginRejected) - sizeof(be16_t), PacketType::LoginRejected} {}
+      Header header;
+      char reason;
+    };
+
+    // frame a payload of len bytes that follows the header at p
+    inline void
+    set_header(char* p, char type, size_t len) {
+      Header* h = reinterpret_cast<Header*>(p);
+      h->len = uint16_t(len + 1);
+      h->type = type;
+    }
+
+    // numeric fields are ascii, right justified and space padded; alpha
+    // fields are left justified and space padded
+    uint64_t parse_numeric_field(const char* src, size_t len);
+    void set_numeric_field(uint64_t value, char* dest, size_t len);
+    std::string trim_alpha_field(const char* src, size_t len);
+  }
+}
@@ -1,7 +1,15 @@
-SOURCES=rwbuffer.cpp ouch_structs.cpp ouch_simulator.cpp ouch_simulator_main.cpp
+CORE_SOURCES=rwbuffer.cpp ring_buffer.cpp buffer_pool.cpp tsc_clock.cpp latency_histogram.cpp session_stats.cpp ouch_structs.cpp soupbin_structs.cpp sequenced_store.cpp order_store.cpp order_book.cpp order_journal.cpp fill_model.cpp market_book.cpp itch_reader.cpp symbol_directory.cpp token_index.cpp trace_recorder.cpp uring.cpp ouch_simulator.cpp
 
-INCLUDES=boost_enum.h rwbuffer.h ouch_structs.h ouch_simulator.h
+SOURCES=$(CORE_SOURCES) ouch_simulator_main.cpp
 
-BINARIES=ouch_simulator
+BENCH_SOURCES=$(CORE_SOURCES) ouch_bench.cpp
+
+LOADGEN_SOURCES=rwbuffer.cpp tsc_clock.cpp latency_histogram.cpp ouch_structs.cpp soupbin_structs.cpp token_index.cpp session_capture.cpp ouch_loadgen.cpp
+
+TRACEDUMP_SOURCES=ring_buffer.cpp tsc_clock.cpp ouch_structs.cpp soupbin_structs.cpp trace_recorder.cpp ouch_tracedump.cpp
+
+INCLUDES=boost_enum.h handler_allocator.h slab.h big_endian.h rwbuffer.h ring_buffer.h buffer_pool.h tsc_clock.h latency_histogram.h session_stats.h session_capture.h ouch_structs.h soupbin_structs.h sequenced_store.h ouch_order.h order_store.h order_book.h order_journal.h fill_model.h itch_structs.h itch_reader.h market_book.h symbol_directory.h token_index.h trace_recorder.h timing_wheel.h uring.h ouch_simulator.h
+
+BINARIES=ouch_simulator ouch_loadgen ouch_tracedump
 
 LIBRARIES=
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "ouch_structs.h"
+#include "symbol_directory.h"
+
+using namespace OUCHSim;
+using namespace elf;
+using namespace std;
+
+// pilots tried per bucket before the build starts over with a new seed
+static constexpr uint32_t max_pilot = 1 << 16;
+
+void
+SymbolDirectory::load(const string& path) {
+  ifstream in(path);
+  if(!in)
+    throw runtime_error(path + ": cannot open symbol list");
+  parse(in, path);
+}
+
+void
+SymbolDirectory::parse(istream& in, const string& source) {
+  unordered_map<uint64_t, size_t> lines;
+  string line;
+  size_t lineno = 0;
+  while(getline(in, line)) {
+    lineno++;
+    size_t hash = line.find('#');
+    if(hash != string::npos)
+      line.resize(hash);
+
+    istringstream words(line);
+    string symbol;
+    if(!(words >> symbol))
+      continue;
+
+    auto fail = [&](const string& what) {
+      return runtime_error(source + ":" + to_string(lineno) + ": " + what);
+    };
+    if(symbol.size() > 8)
+      throw fail("symbol " + symbol + " is longer than 8 characters");
+
+    char field[8];
+    OUCH::set_alpha_field(symbol, field, sizeof(field));
+    uint64_t key;
+    memcpy(&key, field, sizeof(key));
+    auto seen = lines.emplace(key, lineno);
+    if(!seen.second)
+      throw fail("symbol " + symbol + " is already listed on line " + to_string(seen.first->second));
+    if(_keys.size() == no_symbol)
+      throw fail("too many symbols");
+    _keys.push_back(key);
+  }
+  build();
+}
+
+// about four symbols to a bucket, and a table at most 80% full. the
+// build is seeded the same way every time, so a list always gets the
+// same table; a table that takes too many seeds is doubled.
+void
+SymbolDirectory::build() {
+  size_t n = _keys.size();
+  size_t slots = 2, buckets = 2;
+  while(slots < n + n/4)
+    slots <<= 1;
+  while(buckets < n/4)
+    buckets <<= 1;
+
+  std::mt19937_64 rng(n);
+  for(int attempt=1; ; attempt++) {
+    _seed = rng() | 1;
+    if(try_build(slots, buckets))
+      return;
+    if(attempt % 8 == 0)
+      slots <<= 1;
+  }
+}
+
+// buckets are placed largest first, while the table is emptiest, each with
+// the first pilot that puts all its symbols in free slots
+bool
+SymbolDirectory::try_build(size_t slots, size_t buckets) {
+  _bucket_shift = 64 - __builtin_ctzll(buckets);
+  _slot_shift = 64 - __builtin_ctzll(slots);
+  _pilots.assign(buckets, 0);
+  _slots.assign(slots, Slot{0, no_symbol});
+
+  vector<vector<uint32_t>> members(buckets);
+  for(uint32_t id=0; id<_keys.size(); id++)
+    members[(_keys[id] * _seed) >> _bucket_shift].push_back(id);
+
+  vector<uint32_t> order(buckets);
+  for(uint32_t b=0; b<buckets; b++)
+    order[b] = b;
+  stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return members[a].size() > members[b].size(); });
+
+  vector<size_t> placed;
+  for(uint32_t b : order) {
+    const vector<uint32_t>& ids = members[b];
+    if(ids.empty())
+      break;
+
+    uint32_t pilot = 0;
+    for(; pilot<max_pilot; pilot++) {
+      placed.clear();
+      for(uint32_t id : ids) {
+        size_t slot = slot_of(_keys[id] * _seed, pilot);
+        if(_slots[slot].id != no_symbol || std::find(placed.begin(), placed.end(), slot) != placed.end())
+          break;
+        placed.push_back(slot);
+      }
+      if(placed.size() == ids.size())
+        break;
+    }
+    if(pilot == max_pilot)
+      return false;
+
+    _pilots[b] = pilot;
+    for(size_t i=0; i<ids.size(); i++)
+      _slots[placed[i]] = Slot{_keys[ids[i]], ids[i]};
+  }
+  return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace OUCHSim {
+  // the symbols the simulator trades, listed one per line in a file, with
+  // # starting a comment. each symbol's id is its place in the list, so
+  // per-symbol state can live in flat arrays.
+  //
+  // lookup goes through a perfect hash built at load. the symbol, as the
+  // 8-byte word it is on the wire, is scrambled by a multiply; the top
+  // bits pick a bucket, and the bucket's pilot, found by trial at build,
+  // moves its symbols to slots no other symbol uses. a lookup is two
+  // multiplies, two loads and one compare, which also tells a listed
+  // symbol from any other.
+  class SymbolDirectory {
+  public:
+    static constexpr uint32_t no_symbol = UINT32_MAX;
+
+    // throws runtime_error naming the line of a bad or repeated symbol
+    void load(const std::string& path);
+    void parse(std::istream& in, const std::string& source);
+
+    uint32_t
+    find(const char* symbol) const {
+      uint64_t key;
+      memcpy(&key, symbol, sizeof(key));
+      uint64_t h = key * _seed;
+      const Slot& slot = _slots[slot_of(h, _pilots[h >> _bucket_shift])];
+      return slot.key == key ? slot.id : no_symbol;
+    }
+
+    // the symbol with an id, 8 characters space padded
+    const char* symbol(uint32_t id) const { return reinterpret_cast<const char*>(&_keys[id]); }
+    size_t size() const                   { return _keys.size(); }
+    bool empty() const                    { return _keys.empty(); }
+    size_t table_size() const             { return _slots.size(); }
+
+  private:
+    struct Slot {
+      uint64_t key;
+      uint32_t id;
+    };
+
+    size_t
+    slot_of(uint64_t h, uint32_t pilot) const {
+      return ((h ^ (pilot * 0x9e3779b97f4a7c15ULL)) * 0xbf58476d1ce4e5b9ULL) >> _slot_shift;
+    }
+
+    void build();
+    bool try_build(size_t slots, size_t buckets);
+
+    std::vector<uint64_t> _keys;
+    // until a directory is built, every lookup lands on an empty slot
+    std::vector<Slot> _slots = std::vector<Slot>(2, Slot{0, no_symbol});
+    std::vector<uint32_t> _pilots = std::vector<uint32_t>(2, 0);
+    uint64_t _seed = 1;
+    int _bucket_shift = 63;
+    int _slot_shift = 63;
+  };
+}
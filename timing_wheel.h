@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace elf {
+  // timers for one thread on a hierarchical wheel: levels of 256 slots, in
+  // ticks of the owner's choosing. level 0 has a slot per tick for the next
+  // 256 ticks; each level above spans 256 times the one below, and its
+  // slots cascade down as the wheel turns into them. scheduling and
+  // canceling are O(1), and advance() fires each tick's timers as a batch.
+  //
+  // a bitmap of occupied slots per level lets the wheel skip straight to
+  // the next tick with timers to fire or cascade, however sparse they are.
+  // timers are kept by value in nodes linked by index, recycled through a
+  // free list, so a churning population allocates only past its high water
+  // mark. a handle carries its node's generation: once the timer has fired
+  // or been canceled, the handle cancels nothing. 0 is never a handle.
+  template <typename T>
+  class TimingWheel {
+  public:
+    typedef uint64_t Handle;
+
+    static constexpr unsigned slot_bits = 8;
+    static constexpr uint32_t slots = uint32_t(1) << slot_bits;
+    static constexpr unsigned levels = 4;
+    static constexpr uint64_t no_tick = UINT64_MAX;
+
+    explicit TimingWheel(uint64_t now = 0) : _now(now) {
+      for(uint32_t& head : _heads)
+        head = none;
+      for(uint64_t& word : _occupied)
+        word = 0;
+    }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    void reserve(size_t n) { _nodes.reserve(n); }
+
+    // due at tick when; a tick already reached fires at the next one
+    Handle
+    schedule(uint64_t when, T value) {
+      uint32_t i = _free;
+      if(i == none) {
+        i = uint32_t(_nodes.size());
+        _nodes.emplace_back();
+      } else {
+        _free = _nodes[i].next;
+      }
+
+      Node& n = _nodes[i];
+      n.value = std::move(value);
+      n.when = std::max(when, _now + 1);
+      place(i);
+      _size++;
+      return (Handle(n.generation) << 32) | (i + 1);
+    }
+
+    bool
+    cancel(Handle h) {
+      uint32_t i = uint32_t(h) - 1;
+      if(i >= _nodes.size() || _nodes[i].list == none || _nodes[i].generation != uint32_t(h >> 32))
+        return false;
+      unlink(i);
+      release(i);
+      return true;
+    }
+
+    // turn the wheel to tick now, calling fire(T&) for each timer due on
+    // the way. fire may schedule and cancel timers, the ones due alongside
+    // it included. returns the number fired.
+    template <typename F>
+    size_t
+    advance(uint64_t now, F&& fire) {
+      size_t fired = 0;
+      while(_now < now) {
+        // ticks with nothing to fire or cascade are skipped over
+        uint64_t tick = next_due();
+        if(tick > now) {
+          _now = now;
+          break;
+        }
+        _now = tick;
+
+        for(unsigned level=1; level<levels && !(tick & ((uint64_t(1) << (level * slot_bits)) - 1)); level++)
+          cascade(level, uint32_t(tick >> (level * slot_bits)) & slot_mask);
+
+        // the batch is moved to a list of its own, where fire() can still
+        // cancel the timers it hasn't reached
+        uint32_t slot = uint32_t(tick) & slot_mask;
+        std::swap(_heads[firing], _heads[slot]);
+        vacate(slot);
+        for(uint32_t i = _heads[firing]; i != none; i = _nodes[i].next)
+          _nodes[i].list = firing;
+
+        while(_heads[firing] != none) {
+          uint32_t i = _heads[firing];
+          unlink(i);
+          T value = std::move(_nodes[i].value);
+          release(i);
+          fire(value);
+          fired++;
+        }
+      }
+      return fired;
+    }
+
+    // the first tick at which advance() has anything to do, no_tick when
+    // the wheel is empty: the next occupied slot of level 0 to come round,
+    // or of a level above, at the tick it cascades
+    uint64_t
+    next_due() const {
+      if(!_size)
+        return no_tick;
+      uint64_t due = no_tick;
+      for(unsigned level=0; level<levels; level++) {
+        unsigned shift = level * slot_bits;
+        uint64_t turn = (_now >> shift) + 1;
+        uint32_t distance = scan(level, uint32_t(turn) & slot_mask);
+        if(distance < slots)
+          due = std::min(due, (turn + distance) << shift);
+      }
+      return due;
+    }
+
+    uint64_t now() const { return _now; }
+    size_t size() const  { return _size; }
+    bool empty() const   { return !_size; }
+
+  private:
+    static constexpr uint32_t none = UINT32_MAX;
+    static constexpr uint32_t slot_mask = slots - 1;
+    static constexpr uint32_t firing = levels * slots;
+
+    struct Node {
+      T value;
+      uint64_t when = 0;
+      uint32_t prev = none;
+      uint32_t next = none;
+      // the list the node is on, none while it's free
+      uint32_t list = none;
+      uint32_t generation = 0;
+    };
+
+    // the lowest level whose span reaches the timer, by the slot its tick
+    // falls in. timers beyond the top level's span wait in its furthest
+    // slot and are placed again when it cascades.
+    void
+    place(uint32_t i) {
+      Node& n = _nodes[i];
+      uint64_t delta = n.when - _now;
+      uint64_t when = n.when;
+      unsigned level = 0;
+      if(delta >= slots) {
+        level = (63 - __builtin_clzll(delta)) / slot_bits;
+        if(level >= levels) {
+          level = levels - 1;
+          when = _now + (uint64_t(1) << (levels * slot_bits)) - 1;
+        }
+      }
+      link(i, level * slots + (uint32_t(when >> (level * slot_bits)) & slot_mask));
+    }
+
+    void
+    cascade(unsigned level, uint32_t slot) {
+      uint32_t i = _heads[level * slots + slot];
+      _heads[level * slots + slot] = none;
+      vacate(level * slots + slot);
+      while(i != none) {
+        uint32_t next = _nodes[i].next;
+        place(i);
+        i = next;
+      }
+    }
+
+    void
+    link(uint32_t i, uint32_t list) {
+      Node& n = _nodes[i];
+      n.list = list;
+      n.prev = none;
+      n.next = _heads[list];
+      if(n.next != none)
+        _nodes[n.next].prev = i;
+      _heads[list] = i;
+      _occupied[list >> 6] |= uint64_t(1) << (list & 63);
+    }
+
+    void
+    unlink(uint32_t i) {
+      Node& n = _nodes[i];
+      if(n.prev != none)
+        _nodes[n.prev].next = n.next;
+      else if((_heads[n.list] = n.next) == none)
+        vacate(n.list);
+      if(n.next != none)
+        _nodes[n.next].prev = n.prev;
+    }
+
+    void vacate(uint32_t list) { _occupied[list >> 6] &= ~(uint64_t(1) << (list & 63)); }
+
+    // slots from a slot of the level to the first occupied one, going round
+    // from it; slots if the level is empty
+    uint32_t
+    scan(unsigned level, uint32_t from) const {
+      const uint64_t* bits = _occupied + level * (slots / 64);
+      for(uint32_t n=0; n<=slots/64; n++) {
+        uint32_t word = ((from >> 6) + n) % (slots / 64);
+        uint64_t w = bits[word];
+        if(n == 0)
+          w &= ~uint64_t(0) << (from & 63);
+        else if(n == slots/64)
+          w &= ~(~uint64_t(0) << (from & 63));
+        if(w)
+          return (word * 64 + __builtin_ctzll(w) - from) & slot_mask;
+      }
+      return slots;
+    }
+
+    void
+    release(uint32_t i) {
+      Node& n = _nodes[i];
+      n.list = none;
+      n.generation++;
+      n.next = _free;
+      _free = i;
+      _size--;
+    }
+
+    std::vector<Node> _nodes;
+    // indexed by list, level * slots + slot, the firing list last
+    uint32_t _heads[levels * slots + 1];
+    uint64_t _occupied[levels * slots / 64 + 1];
+    uint32_t _free = none;
+    uint64_t _now;
+    size_t _size = 0;
+  };
+}
@@ -0,0 +1,130 @@
+#include <cstring>
+
+#include "token_index.h"
+
+using namespace OUCHSim;
+using namespace std;
+
+TokenIndex::TokenIndex(size_t capacity) {
+  size_t n = 16;
+  while(n < capacity)
+    n <<= 1;
+  rehash(n);
+}
+
+void
+TokenIndex::load_key(const char* token, uint64_t& lo, uint64_t& hi) {
+  memcpy(&lo, token, sizeof(lo));
+  memcpy(&hi, token + token_len - sizeof(hi), sizeof(hi));
+}
+
+size_t
+TokenIndex::home(uint64_t lo, uint64_t hi) const {
+  uint64_t h = (lo ^ (hi * 0xc2b2ae3d27d4eb4fULL)) * 0x9e3779b97f4a7c15ULL;
+  return h >> _shift;
+}
+
+oid_t
+TokenIndex::find(const char* token) const {
+  uint64_t lo, hi;
+  load_key(token, lo, hi);
+
+  for(size_t i = home(lo, hi); ; i = (i + 1) & _mask) {
+    const Slot& slot = _slots[i];
+    if(slot.oid == INVALID_OID)
+      return INVALID_OID;
+    if(slot.lo == lo && slot.hi == hi)
+      return slot.oid;
+  }
+}
+
+bool
+TokenIndex::insert(const char* token, oid_t oid) {
+  if(_size >= _grow_at)
+    rehash(_slots.size() * 2);
+
+  uint64_t lo, hi;
+  load_key(token, lo, hi);
+
+  for(size_t i = home(lo, hi); ; i = (i + 1) & _mask) {
+    Slot& slot = _slots[i];
+    if(slot.oid == INVALID_OID) {
+      slot = Slot{lo, hi, oid};
+      _size++;
+      return true;
+    }
+    if(slot.lo == lo && slot.hi == hi)
+      return false;
+  }
+}
+
+bool
+TokenIndex::erase(const char* token) {
+  uint64_t lo, hi;
+  load_key(token, lo, hi);
+
+  size_t i = home(lo, hi);
+  while(true) {
+    Slot& slot = _slots[i];
+    if(slot.oid == INVALID_OID)
+      return false;
+    if(slot.lo == lo && slot.hi == hi)
+      break;
+    i = (i + 1) & _mask;
+  }
+
+  // backward shift: pull later entries of the chain into the hole unless
+  // that would move them in front of their home slot
+  size_t hole = i;
+  for(size_t j = (i + 1) & _mask; _slots[j].oid != INVALID_OID; j = (j + 1) & _mask) {
+    size_t h = home(_slots[j].lo, _slots[j].hi);
+    if(((j - h) & _mask) >= ((j - hole) & _mask)) {
+      _slots[hole] = _slots[j];
+      hole = j;
+    }
+  }
+
+  _slots[hole].oid = INVALID_OID;
+  _size--;
+  return true;
+}
+
+void
+TokenIndex::reserve(size_t n) {
+  size_t capacity = _slots.size();
+  while(n >= capacity - capacity/4)
+    capacity <<= 1;
+  if(capacity != _slots.size())
+    rehash(capacity);
+}
+
+void
+TokenIndex::clear() {
+  for(Slot& slot : _slots)
+    slot.oid = INVALID_OID;
+  _size = 0;
+}
+
+void
+TokenIndex::rehash(size_t capacity) {
+  vector<Slot> old;
+  old.swap(_slots);
+
+  _slots.assign(capacity, Slot{0, 0, INVALID_OID});
+  _mask = capacity - 1;
+  _shift = 64 - __builtin_ctzll(capacity);
+  _grow_at = capacity - capacity/4;
+  _size = 0;
+
+  for(const Slot& slot : old) {
+    if(slot.oid == INVALID_OID)
+      continue;
+    for(size_t i = home(slot.lo, slot.hi); ; i = (i + 1) & _mask) {
+      if(_slots[i].oid == INVALID_OID) {
+        _slots[i] = slot;
+        _size++;
+        break;
+      }
+    }
+  }
+}
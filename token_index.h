@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "ouch_order.h"
+
+namespace OUCHSim {
+  // open-addressing map from a 14-byte OUCH token to an oid. the key is held
+  // as two overlapping 8-byte words (bytes 0-7 and 6-13) so a probe is two
+  // integer compares. linear probing with backward-shift deletion keeps
+  // chains short without tombstones; the table only allocates when it grows.
+  class TokenIndex {
+  public:
+    static constexpr size_t token_len = 14;
+
+    TokenIndex(size_t capacity = 1024);
+    oid_t find(const char* token) const;
+    bool insert(const char* token, oid_t oid);
+    bool erase(const char* token);
+    void reserve(size_t n);
+    void clear();
+    size_t size() const     { return _size; }
+    size_t capacity() const { return _slots.size(); }
+
+    template <typename F>
+    void
+    for_each_oid(F f) const {
+      for(const Slot& slot : _slots) {
+        if(slot.oid != INVALID_OID)
+          f(slot.oid);
+      }
+    }
+
+  private:
+    struct Slot {
+      uint64_t lo;
+      uint64_t hi;
+      oid_t oid;
+    };
+
+    static void load_key(const char* token, uint64_t& lo, uint64_t& hi);
+    size_t home(uint64_t lo, uint64_t hi) const;
+    void rehash(size_t capacity);
+
+    std::vector<Slot> _slots;
+    size_t _mask = 0;
+    int _shift = 0;
+    size_t _size = 0;
+    size_t _grow_at = 0;
+  };
+}
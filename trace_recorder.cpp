@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "trace_recorder.h"
+#include "tsc_clock.h"
+
+using namespace elf;
+using namespace std;
+
+static const char trace_magic[8] = {'O', 'U', 'C', 'H', 'T', 'R', 'C', '1'};
+static constexpr uint32_t trace_version = 1;
+
+struct TraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+};
+
+static runtime_error
+trace_error(const string& path, const char* what) {
+  return runtime_error(path + ": " + what + ": " + strerror(errno));
+}
+
+// the ring is a power of two, so positions wrap with a mask
+TraceRing::TraceRing(size_t size) {
+  size_t len = size_t(sysconf(_SC_PAGESIZE));
+  while(len < size || len < 2 * trace_record_size(max_payload))
+    len <<= 1;
+  _memory.init(len);
+  _base = _memory._buffer;
+  _size = _memory.capacity();
+  _mask = _size - 1;
+}
+
+bool
+TraceRing::report_lost(uint64_t tsc) {
+  uint64_t n = _unreported;
+  if(!put(TraceKind::Lost, 0, tsc, reinterpret_cast<const char*>(&n), sizeof(n)))
+    return false;
+  _unreported = 0;
+  return true;
+}
+
+TraceRecorder::TraceRecorder(const string& path, uint32_t flags)
+  : _path(path) {
+  _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(_fd < 0)
+    throw trace_error(path, "open");
+
+  try {
+    extend();
+  } catch(...) {
+    ::close(_fd);
+    throw;
+  }
+
+  TraceFileHeader h;
+  memcpy(h.magic, trace_magic, sizeof(h.magic));
+  h.version = trace_version;
+  h.flags = flags;
+  append(reinterpret_cast<const char*>(&h), sizeof(h));
+  write_clock();
+}
+
+// a recorder that wasn't stopped leaves its file at a window boundary,
+// zero filled past the last record
+TraceRecorder::~TraceRecorder() {
+  halt();
+  if(_window)
+    munmap(_window, window_size);
+  if(_fd >= 0)
+    ::close(_fd);
+}
+
+TraceRing*
+TraceRecorder::add_ring(size_t size) {
+  std::lock_guard<std::mutex> guard(_rings_lock);
+  _rings.emplace_back(new TraceRing(size));
+  return _rings.back().get();
+}
+
+void
+TraceRecorder::start(std::chrono::milliseconds poll_interval) {
+  _stop = false;
+  _thread = std::thread([this, poll_interval] { drain_loop(poll_interval); });
+}
+
+void
+TraceRecorder::stop() {
+  halt();
+  if(_fd < 0)
+    return;
+
+  drain();
+  munmap(_window, window_size);
+  _window = nullptr;
+  int fd = _fd;
+  _fd = -1;
+  if(ftruncate(fd, _written) < 0) {
+    ::close(fd);
+    throw trace_error(_path, "ftruncate");
+  }
+  ::close(fd);
+}
+
+void
+TraceRecorder::halt() {
+  if(!_thread.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _stop = true;
+  }
+  _cv.notify_all();
+  _thread.join();
+}
+
+uint64_t
+TraceRecorder::dropped() const {
+  uint64_t n = 0;
+  for(auto& ring : _rings)
+    n += ring->dropped();
+  return n;
+}
+
+// producers don't signal, so that recording stays free of system calls;
+// the rings are polled instead and sized to ride out the interval
+void
+TraceRecorder::drain_loop(std::chrono::milliseconds poll_interval) {
+  auto next_clock = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  std::unique_lock<std::mutex> lock(_lock);
+  while(!_stop) {
+    lock.unlock();
+    drain();
+    if(std::chrono::steady_clock::now() >= next_clock) {
+      write_clock();
+      next_clock += std::chrono::seconds(1);
+    }
+    lock.lock();
+    _cv.wait_for(lock, poll_interval, [this] { return _stop; });
+  }
+}
+
+size_t
+TraceRecorder::drain() {
+  std::lock_guard<std::mutex> guard(_rings_lock);
+  size_t n = 0;
+  for(auto& ring : _rings)
+    n += ring->consume([this](const char* data, size_t len) { append(data, len); });
+  return n;
+}
+
+void
+TraceRecorder::write_clock() {
+  char rec[trace_record_size(sizeof(TraceClock))];
+  TraceRecord* r = reinterpret_cast<TraceRecord*>(rec);
+  TraceClock* c = reinterpret_cast<TraceClock*>(rec + sizeof(TraceRecord));
+  memset(rec, 0, sizeof(rec));
+  r->tsc = TSCClock::rdtsc();
+  c->ns = TSCClock::realtime_ns();
+  c->ns_per_tick = tsc_clock().ns_per_tick();
+  r->len = sizeof(TraceClock);
+  r->kind = TraceKind::Clock;
+  append(rec, sizeof(rec));
+}
+
+void
+TraceRecorder::append(const char* data, size_t len) {
+  while(len) {
+    if(_window_pos == window_size)
+      extend();
+    size_t n = std::min(len, window_size - _window_pos);
+    memcpy(_window + _window_pos, data, n);
+    _window_pos += n;
+    _written += n;
+    data += n;
+    len -= n;
+  }
+}
+
+// grow the file by a window and map it in place of the full one
+void
+TraceRecorder::extend() {
+  if(_window) {
+    munmap(_window, window_size);
+    _window = nullptr;
+    _window_offset += window_size;
+  }
+  if(ftruncate(_fd, _window_offset + window_size) < 0)
+    throw trace_error(_path, "ftruncate");
+
+  void* p = mmap(nullptr, window_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, _window_offset);
+  if(p == MAP_FAILED)
+    throw trace_error(_path, "mmap");
+  _window = static_cast<char*>(p);
+  _window_pos = 0;
+}
+
+TraceFile::TraceFile(const string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw trace_error(path, "open");
+
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    ::close(fd);
+    throw trace_error(path, "fstat");
+  }
+  if(size_t(st.st_size) < sizeof(TraceFileHeader)) {
+    ::close(fd);
+    throw runtime_error(path + ": short trace");
+  }
+
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(p == MAP_FAILED)
+    throw trace_error(path, "mmap");
+  _base = static_cast<const char*>(p);
+  _len = st.st_size;
+  madvise(p, _len, MADV_SEQUENTIAL);
+
+  const TraceFileHeader* h = reinterpret_cast<const TraceFileHeader*>(_base);
+  if(memcmp(h->magic, trace_magic, sizeof(h->magic)) || h->version != trace_version) {
+    munmap(p, _len);
+    throw runtime_error(path + ": not a version " + to_string(trace_version) + " trace");
+  }
+  _flags = h->flags;
+  _begin = sizeof(TraceFileHeader);
+}
+
+TraceFile::~TraceFile() {
+  munmap(const_cast<char*>(_base), _len);
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ring_buffer.h"
+
+namespace elf {
+  namespace TraceKind {
+    static const uint8_t Name  = 1; // payload names the stream, e.g. its peer
+    static const uint8_t In    = 2; // bytes read from the stream
+    static const uint8_t Out   = 3; // bytes written to it
+    static const uint8_t Close = 4; // the stream ended; no payload
+    static const uint8_t Lost  = 5; // uint64 count of records dropped on a full ring
+    static const uint8_t Clock = 6; // TraceClock, pairing the tsc with wall time
+  }
+
+  namespace TraceFlags {
+    // streams are SoupBinTCP framed rather than bare OUCH
+    static const uint32_t SoupBin = 1;
+  }
+
+  // a record is this header and len bytes of payload, padded to a multiple
+  // of 8. kind 0 never occurs, so zeroes past the last record end a trace.
+  struct TraceRecord {
+    uint64_t tsc;
+    uint32_t stream;
+    uint16_t len;
+    uint8_t kind;
+    uint8_t pad;
+  } __attribute__((packed));
+
+  static_assert(sizeof(TraceRecord) == 16, "trace records are 8 byte aligned");
+
+  struct TraceClock {
+    uint64_t ns;
+    double ns_per_tick;
+  } __attribute__((packed));
+
+  inline size_t
+  trace_record_size(size_t len) {
+    return sizeof(TraceRecord) + ((len + 7) & ~size_t(7));
+  }
+
+  // single producer, single consumer ring of trace records. the producer
+  // never waits: a record that doesn't fit is dropped and counted, and the
+  // count goes out as a Lost record ahead of the next one that fits.
+  // records are laid down whole thanks to the ring's double mapping, so the
+  // consumer sees the unread region as one run of bytes.
+  class TraceRing {
+  public:
+    static constexpr size_t max_payload = 65528;
+
+    explicit TraceRing(size_t size);
+    TraceRing(const TraceRing&) = delete;
+    TraceRing& operator=(const TraceRing&) = delete;
+
+    // payloads over max_payload are split across records
+    void
+    record(uint8_t kind, uint32_t stream, uint64_t tsc, const char* data, size_t len) {
+      if(__builtin_expect(_unreported != 0, 0) && !report_lost(tsc)) {
+        drop(len / max_payload + 1);
+        return;
+      }
+      while(__builtin_expect(len > max_payload, 0)) {
+        if(!put(kind, stream, tsc, data, max_payload))
+          drop(1);
+        data += max_payload;
+        len -= max_payload;
+      }
+      if(!put(kind, stream, tsc, data, len))
+        drop(1);
+    }
+
+    // consumer: hand the unread records to f(data, len) and free them
+    template <typename F>
+    size_t
+    consume(F&& f) {
+      uint64_t tail = _tail.load(std::memory_order_relaxed);
+      uint64_t head = _head.load(std::memory_order_acquire);
+      if(head == tail)
+        return 0;
+      f(_base + (tail & _mask), head - tail);
+      _tail.store(head, std::memory_order_release);
+      return head - tail;
+    }
+
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+    size_t size() const      { return _size; }
+
+  private:
+    bool
+    put(uint8_t kind, uint32_t stream, uint64_t tsc, const char* data, size_t len) {
+      size_t need = trace_record_size(len);
+      uint64_t head = _head.load(std::memory_order_relaxed);
+      if(need > _size - (head - _cached_tail)) {
+        _cached_tail = _tail.load(std::memory_order_acquire);
+        if(need > _size - (head - _cached_tail))
+          return false;
+      }
+
+      char* p = _base + (head & _mask);
+      // zero the padding, so a trace holds nothing but what was recorded
+      reinterpret_cast<uint64_t*>(p + need)[-1] = 0;
+      TraceRecord* r = reinterpret_cast<TraceRecord*>(p);
+      r->tsc = tsc;
+      r->stream = stream;
+      r->len = uint16_t(len);
+      r->kind = kind;
+      r->pad = 0;
+      memcpy(p + sizeof(TraceRecord), data, len);
+      _head.store(head + need, std::memory_order_release);
+      return true;
+    }
+
+    void
+    drop(uint64_t n) {
+      _unreported += n;
+      _dropped.store(_dropped.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    bool report_lost(uint64_t tsc);
+
+    RingBuffer _memory;
+    char* _base;
+    size_t _size;
+    uint64_t _mask;
+
+    alignas(64) std::atomic<uint64_t> _head{0};
+    uint64_t _cached_tail = 0;
+    uint64_t _unreported = 0;
+    std::atomic<uint64_t> _dropped{0};
+
+    alignas(64) std::atomic<uint64_t> _tail{0};
+  };
+
+  // writes the rings of a set of producer threads to a trace file. a
+  // background thread polls the rings and copies their records into the
+  // file through a shared mapping, extended a window at a time, and adds a
+  // Clock record every second so that tsc stamps can be turned into wall
+  // time. records of one ring keep their order in the file; records of
+  // different rings interleave in batches.
+  class TraceRecorder {
+  public:
+    static constexpr size_t default_ring_size = size_t(8) << 20;
+    static constexpr size_t window_size = size_t(64) << 20;
+
+    // create the file at path, replacing any there; flags go into its header
+    TraceRecorder(const std::string& path, uint32_t flags);
+    ~TraceRecorder();
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // a ring for one producer, owned by the recorder
+    TraceRing* add_ring(size_t size = default_ring_size);
+
+    void start(std::chrono::milliseconds poll_interval = std::chrono::milliseconds(1));
+    // drain what is left and cut the file to its length. producers must
+    // have stopped.
+    void stop();
+
+    const std::string& path() const { return _path; }
+    uint64_t bytes() const          { return _written; }
+    uint64_t dropped() const;
+
+  private:
+    void halt();
+    void drain_loop(std::chrono::milliseconds poll_interval);
+    size_t drain();
+    void write_clock();
+    void append(const char* data, size_t len);
+    void extend();
+
+    std::string _path;
+    int _fd = -1;
+    char* _window = nullptr;
+    uint64_t _window_offset = 0;
+    size_t _window_pos = 0;
+    uint64_t _written = 0;
+
+    std::mutex _rings_lock;
+    std::vector<std::unique_ptr<TraceRing>> _rings;
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    bool _stop = false;
+  };
+
+  // a trace file mapped for reading
+  class TraceFile {
+  public:
+    explicit TraceFile(const std::string& path);
+    ~TraceFile();
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    uint32_t flags() const { return _flags; }
+
+    // f(record, payload) for each record in file order
+    template <typename F>
+    size_t
+    for_each(F&& f) const {
+      size_t n = 0;
+      size_t pos = _begin;
+      while(pos + sizeof(TraceRecord) <= _len) {
+        const TraceRecord* r = reinterpret_cast<const TraceRecord*>(_base + pos);
+        size_t size = trace_record_size(r->len);
+        if(!r->kind || pos + size > _len)
+          break;
+        f(*r, _base + pos + sizeof(TraceRecord));
+        pos += size;
+        n++;
+      }
+      return n;
+    }
+
+  private:
+    const char* _base = nullptr;
+    size_t _len = 0;
+    size_t _begin = 0;
+    uint32_t _flags = 0;
+  };
+}
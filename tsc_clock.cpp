@@ -0,0 +1,131 @@
+#include <time.h>
+
+#include "tsc_clock.h"
+
+using namespace elf;
+using namespace std;
+
+TSCClock&
+elf::tsc_clock() {
+  static TSCClock clock;
+  return clock;
+}
+
+uint64_t
+TSCClock::realtime_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// take the tightest of a few rdtsc/clock_gettime/rdtsc brackets
+void
+TSCClock::sample(uint64_t& tsc, uint64_t& ns) {
+  uint64_t best = UINT64_MAX;
+  for(int i=0; i<5; i++) {
+    uint64_t t0 = rdtsc();
+    uint64_t n = realtime_ns();
+    uint64_t t1 = rdtsc();
+    if(t1 - t0 < best) {
+      best = t1 - t0;
+      tsc = t0 + (t1 - t0) / 2;
+      ns = n;
+    }
+  }
+}
+
+// the local midnight that starts the day ns falls in, or one days later.
+// mktime works out whether daylight saving time is in effect then, so a
+// day with a clock change is 23 or 25 hours long.
+uint64_t
+TSCClock::local_midnight_ns(uint64_t ns, int days) {
+  time_t secs = ns / 1000000000ULL;
+  struct tm tm;
+  localtime_r(&secs, &tm);
+  tm.tm_mday += days;
+  tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  return uint64_t(mktime(&tm)) * 1000000000ULL;
+}
+
+TSCClock::Params
+TSCClock::load() const {
+  Params p;
+  uint32_t seq0, seq1;
+  do {
+    seq0 = _seq.load(memory_order_acquire);
+    p = _params;
+    atomic_thread_fence(memory_order_acquire);
+    seq1 = _seq.load(memory_order_relaxed);
+  } while(seq0 != seq1 || (seq0 & 1));
+  return p;
+}
+
+void
+TSCClock::store(const Params& p) {
+  _seq.fetch_add(1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  _params = p;
+  _seq.fetch_add(1, memory_order_release);
+}
+
+uint64_t
+TSCClock::now_ns() const {
+  Params p = load();
+  return p.base_ns + uint64_t(int64_t(rdtsc() - p.base_tsc) * p.ns_per_tick);
+}
+
+// the day rolls over at midnight, not at the next recalibration
+uint64_t
+TSCClock::nanos_since_midnight() const {
+  Params p = load();
+  uint64_t ns = p.base_ns + uint64_t(int64_t(rdtsc() - p.base_tsc) * p.ns_per_tick);
+  return ns - (ns >= p.next_midnight_ns ? p.next_midnight_ns : p.midnight_ns);
+}
+
+// rate is measured over the whole span since start(), so it converges as
+// the process runs; the base is moved to the newest sample
+void
+TSCClock::calibrate() {
+  uint64_t tsc, ns;
+  sample(tsc, ns);
+
+  Params p;
+  p.base_tsc = tsc;
+  p.base_ns = ns;
+  p.midnight_ns = local_midnight_ns(ns, 0);
+  p.next_midnight_ns = local_midnight_ns(ns, 1);
+  p.ns_per_tick = tsc > _anchor_tsc ? double(ns - _anchor_ns) / double(tsc - _anchor_tsc) : 1.0;
+  store(p);
+}
+
+void
+TSCClock::start(chrono::milliseconds recalibrate_interval) {
+  if(_thread.joinable())
+    return;
+
+  sample(_anchor_tsc, _anchor_ns);
+  this_thread::sleep_for(chrono::milliseconds(20));
+  calibrate();
+
+  _stop = false;
+  _thread = thread([this, recalibrate_interval] { recalibrate_loop(recalibrate_interval); });
+}
+
+void
+TSCClock::stop() {
+  {
+    lock_guard<mutex> guard(_lock);
+    _stop = true;
+  }
+  _cv.notify_all();
+  if(_thread.joinable())
+    _thread.join();
+}
+
+void
+TSCClock::recalibrate_loop(chrono::milliseconds interval) {
+  unique_lock<mutex> guard(_lock);
+  while(!_cv.wait_for(guard, interval, [this] { return _stop; }))
+    calibrate();
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace elf {
+  // wall clock driven by the cpu timestamp counter. calibrated against
+  // CLOCK_REALTIME at start() and recalibrated by a background thread; the
+  // conversion parameters are published through a seqlock so readers never
+  // block or make a syscall.
+  class TSCClock {
+  public:
+    void start(std::chrono::milliseconds recalibrate_interval = std::chrono::milliseconds(1000));
+    void stop();
+
+    static uint64_t
+    rdtsc() {
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#else
+      return realtime_ns();
+#endif
+    }
+
+    uint64_t now_ns() const;
+    uint64_t nanos_since_midnight() const;
+    uint64_t ticks_to_ns(uint64_t ticks) const { return uint64_t(ticks * load().ns_per_tick); }
+    uint64_t ns_to_ticks(uint64_t ns) const    { return uint64_t(ns / load().ns_per_tick); }
+    double ns_per_tick() const { return load().ns_per_tick; }
+
+    static uint64_t realtime_ns();
+
+  private:
+    struct Params {
+      uint64_t base_tsc = 0;
+      uint64_t base_ns = 0;
+      uint64_t midnight_ns = 0;
+      uint64_t next_midnight_ns = 0;
+      double ns_per_tick = 1.0;
+    };
+
+    Params load() const;
+    void store(const Params& p);
+    void calibrate();
+    static void sample(uint64_t& tsc, uint64_t& ns);
+    static uint64_t local_midnight_ns(uint64_t ns, int days);
+    void recalibrate_loop(std::chrono::milliseconds interval);
+
+    std::atomic<uint32_t> _seq{0};
+    Params _params;
+    uint64_t _anchor_tsc = 0;
+    uint64_t _anchor_ns = 0;
+
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    bool _stop = false;
+  };
+
+  TSCClock& tsc_clock();
+}
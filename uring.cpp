@@ -0,0 +1,193 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace elf;
+using namespace std;
+
+static runtime_error
+uring_error(const char* what, int err) {
+  return runtime_error(string("io_uring: ") + what + ": " + strerror(err));
+}
+
+static int
+uring_setup(unsigned entries, io_uring_params* p) {
+  return int(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int
+uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return int(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+static void*
+map_ring(int fd, size_t len, off_t offset) {
+  void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  if(p == MAP_FAILED)
+    throw uring_error("mmap", errno);
+  return p;
+}
+
+IOUring::IOUring(unsigned entries) {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER;
+  _fd = uring_setup(entries, &p);
+  if(_fd < 0 && errno == EINVAL) {
+    // older kernels know neither flag
+    memset(&p, 0, sizeof(p));
+    _fd = uring_setup(entries, &p);
+  }
+  if(_fd < 0)
+    throw uring_error("setup", errno);
+
+  try {
+    _ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+      _ring_len = max(_ring_len, cq_len);
+    _ring = map_ring(_fd, _ring_len, IORING_OFF_SQ_RING);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+      _cq_ring = _ring;
+    } else {
+      _cq_ring_len = cq_len;
+      _cq_ring = map_ring(_fd, _cq_ring_len, IORING_OFF_CQ_RING);
+    }
+    _sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = static_cast<io_uring_sqe*>(map_ring(_fd, _sqes_len, IORING_OFF_SQES));
+  } catch(...) {
+    unmap();
+    throw;
+  }
+
+  char* sq = static_cast<char*>(_ring);
+  _sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+  _sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  _sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  _sq_entries = p.sq_entries;
+  _sqe_tail = *_sq_tail;
+
+  // entry i of the submission array always names sqe slot i
+  unsigned* array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  for(unsigned i=0; i<_sq_entries; i++)
+    array[i] = i;
+
+  char* cq = static_cast<char*>(_cq_ring);
+  _cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  _cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  _cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  _cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+}
+
+IOUring::~IOUring() {
+  unmap();
+}
+
+void
+IOUring::unmap() {
+  if(_bufs)
+    munmap(_bufs, _bufs_len);
+  if(_buf_ring)
+    munmap(_buf_ring, _buf_ring_len);
+  if(_sqes)
+    munmap(_sqes, _sqes_len);
+  if(_cq_ring && _cq_ring != _ring)
+    munmap(_cq_ring, _cq_ring_len);
+  if(_ring)
+    munmap(_ring, _ring_len);
+  if(_fd >= 0)
+    close(_fd);
+  _bufs = nullptr;
+  _buf_ring = nullptr;
+  _sqes = nullptr;
+  _cq_ring = _ring = nullptr;
+  _fd = -1;
+}
+
+io_uring_sqe*
+IOUring::get_sqe() {
+  if(_sqe_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+    submit();
+
+  io_uring_sqe* sqe = &_sqes[_sqe_tail & _sq_mask];
+  _sqe_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int
+IOUring::submit(unsigned wait_nr) {
+  unsigned to_submit = _sqe_tail - *_sq_tail;
+  if(!to_submit && !wait_nr)
+    return 0;
+
+  __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+  int rc;
+  do {
+    rc = uring_enter(_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+  } while(rc < 0 && errno == EINTR);
+  return rc < 0 ? -errno : rc;
+}
+
+void
+IOUring::register_eventfd(int efd) {
+  if(uring_register(_fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+    throw uring_error("register eventfd", errno);
+}
+
+void
+IOUring::provide_buffers(uint16_t group, unsigned count, size_t size) {
+  unsigned entries = 1;
+  while(entries < count)
+    entries <<= 1;
+
+  _buf_ring_len = entries * sizeof(io_uring_buf);
+  void* ring = mmap(nullptr, _buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(ring == MAP_FAILED)
+    throw uring_error("mmap buffer ring", errno);
+  _buf_ring = static_cast<io_uring_buf_ring*>(ring);
+
+  _bufs_len = entries * size;
+  void* bufs = mmap(nullptr, _bufs_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if(bufs == MAP_FAILED)
+    throw uring_error("mmap buffers", errno);
+  _bufs = static_cast<char*>(bufs);
+  _buf_size = size;
+  _buf_mask = entries - 1;
+
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(_buf_ring);
+  reg.ring_entries = entries;
+  reg.bgid = group;
+  if(uring_register(_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    throw uring_error("register buffer ring", errno);
+
+  for(unsigned bid=0; bid<entries; bid++)
+    recycle(uint16_t(bid));
+}
+
+void
+IOUring::recycle(uint16_t bid) {
+  // the header's flexible bufs member lands past offset 0 when compiled as
+  // C++, so the ring is indexed as a plain array; tail overlays bufs[0].resv
+  io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(_buf_ring)[_buf_tail & _buf_mask];
+  buf.addr = reinterpret_cast<uint64_t>(buffer(bid));
+  buf.len = uint32_t(_buf_size);
+  buf.bid = bid;
+  _buf_tail++;
+  __atomic_store_n(&_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE);
+}
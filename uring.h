@@ -0,0 +1,86 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace elf {
+  // a minimal io_uring over the raw system calls, for one issuing thread.
+  // submission entries are queued with get_sqe() and handed to the kernel in
+  // one io_uring_enter by submit(). a provided-buffer ring gives multishot
+  // receives registered memory to land in; buffers go back with recycle().
+  class IOUring {
+  public:
+    // throws std::runtime_error when the kernel won't set up a ring
+    explicit IOUring(unsigned entries);
+    ~IOUring();
+    IOUring(const IOUring&) = delete;
+    IOUring& operator=(const IOUring&) = delete;
+
+    // a zeroed entry; submits the queue first when it is full
+    io_uring_sqe* get_sqe();
+
+    // hand queued entries to the kernel, waiting for at least wait_nr
+    // completions. returns the number submitted or -errno.
+    int submit(unsigned wait_nr = 0);
+
+    // pass each available completion to f and release it
+    template <typename F>
+    unsigned
+    reap(F f) {
+      unsigned head = *_cq_head;
+      unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+      unsigned n = tail - head;
+      for(; head != tail; head++)
+        f(_cqes[head & _cq_mask]);
+      __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+      return n;
+    }
+
+    // signal efd whenever a completion is posted
+    void register_eventfd(int efd);
+
+    // count buffers of size bytes for IOSQE_BUFFER_SELECT in group; count
+    // is rounded up to a power of two
+    void provide_buffers(uint16_t group, unsigned count, size_t size);
+    char* buffer(uint16_t bid) const { return _bufs + size_t(bid) * _buf_size; }
+    size_t buffer_size() const       { return _buf_size; }
+    void recycle(uint16_t bid);
+
+    int fd() const { return _fd; }
+    unsigned sq_entries() const { return _sq_entries; }
+
+  private:
+    void unmap();
+
+    int _fd = -1;
+
+    void* _ring = nullptr;
+    size_t _ring_len = 0;
+    void* _cq_ring = nullptr;
+    size_t _cq_ring_len = 0;
+    io_uring_sqe* _sqes = nullptr;
+    size_t _sqes_len = 0;
+
+    unsigned* _sq_head = nullptr;
+    unsigned* _sq_tail = nullptr;
+    unsigned _sq_mask = 0;
+    unsigned _sq_entries = 0;
+    // entries handed out by get_sqe(), published at submit()
+    unsigned _sqe_tail = 0;
+
+    unsigned* _cq_head = nullptr;
+    unsigned* _cq_tail = nullptr;
+    unsigned _cq_mask = 0;
+    io_uring_cqe* _cqes = nullptr;
+
+    io_uring_buf_ring* _buf_ring = nullptr;
+    size_t _buf_ring_len = 0;
+    unsigned _buf_mask = 0;
+    uint16_t _buf_tail = 0;
+    char* _bufs = nullptr;
+    size_t _buf_size = 0;
+    size_t _bufs_len = 0;
+  };
+}